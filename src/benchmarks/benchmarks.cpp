@@ -0,0 +1,324 @@
+// system includes
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+// library includes
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <benchmark/benchmark.h>
+extern "C" {
+    #include <appimage/appimage.h>
+}
+
+// local includes
+#include "shared.h"
+#include "integrationengine.h"
+#ifndef BUILD_LITE
+#include "elf.h"
+#endif
+
+/*
+ * Benchmarks for the integration primitives shared by AppImageLauncher, appimagelauncherd and ail-cli.
+ *
+ * All benchmarks run against a temporary XDG environment, so they neither depend on nor modify the user's desktop
+ * integration. Benchmarks which depend on the number of files involved report scaling curves from 10 to 10,000 entries.
+ *
+ * Integrating an AppImage requires a real AppImage, which can be passed via $APPIMAGELAUNCHER_BENCHMARK_APPIMAGE.
+ * The benchmark is skipped otherwise.
+ */
+
+// makes this binary look like an AppImage with an embedded digest, see makeFakeAppImage(...)
+__attribute__((section(".digest_md5"), used)) static const char embeddedDigest[16] = "benchmarkdigest";
+
+namespace {
+
+    // the entry counts used for the scaling curves
+    constexpr int MIN_ENTRIES = 10;
+    constexpr int MAX_ENTRIES = 10000;
+
+    QString applicationsDir() {
+        return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/applications";
+    }
+
+    void resetApplicationsDir() {
+        QDir(applicationsDir()).removeRecursively();
+        QDir().mkpath(applicationsDir());
+    }
+
+    bool writeFile(const QString& path, const QByteArray& contents) {
+        QFile file(path);
+
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+
+        return file.write(contents) == contents.size();
+    }
+
+    // creates count desktop files the way libappimage names them
+    // existingAppImage decides whether the AppImages referenced by the desktop files exist
+    void writeDesktopFiles(const int count, const QString& nameEntry, const QString& existingAppImage = QString()) {
+        for (int i = 0; i < count; ++i) {
+            const auto appImagePath = existingAppImage.isEmpty() ?
+                QString("/nonexistent/benchmark-%1.AppImage").arg(i) : existingAppImage;
+
+            const auto contents = QString(
+                "[Desktop Entry]\n"
+                "Type=Application\n"
+                "Name=%1 (%2)\n"
+                "Exec=%3\n"
+                "TryExec=%3\n"
+            ).arg(nameEntry).arg(i).arg(appImagePath);
+
+            const auto path = QString("%1/appimagekit_%2-benchmark.desktop")
+                .arg(applicationsDir()).arg(i, 8, 10, QChar('0'));
+
+            if (!writeFile(path, contents.toUtf8())) {
+                std::cerr << "Failed to write desktop file " << path.toStdString() << std::endl;
+                std::abort();
+            }
+        }
+    }
+
+    // creates a file which libappimage recognizes as a type 2 AppImage, followed by payloadSize bytes of random data
+    // the ELF part is a copy of this binary, which contains a .digest_md5 section
+    // if embedDigest is false, the section is zeroed, which makes getAppImageDigestMd5(...) calculate the digest
+    QString makeFakeAppImage(const qint64 payloadSize, const bool embedDigest) {
+        const auto path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+            QString("/fake-%1-%2.AppImage").arg(payloadSize).arg(embedDigest ? "embedded" : "calculated");
+
+        QDir().mkpath(QFileInfo(path).absolutePath());
+        QFile::remove(path);
+
+        if (!QFile::copy(QCoreApplication::applicationFilePath(), path)) {
+            std::cerr << "Failed to copy benchmark binary to " << path.toStdString() << std::endl;
+            std::abort();
+        }
+
+        QFile file(path);
+
+        if (!file.open(QIODevice::ReadWrite)) {
+            std::abort();
+        }
+
+        // AppImage type 2 magic bytes
+        file.seek(8);
+        file.write("AI\x02", 3);
+
+        if (!embedDigest) {
+            unsigned long offset = 0, length = 0;
+
+            if (!appimage_get_elf_section_offset_and_length(path.toStdString().c_str(), ".digest_md5", &offset, &length)) {
+                std::abort();
+            }
+
+            file.seek(static_cast<qint64>(offset));
+            file.write(QByteArray(static_cast<int>(length), '\0'));
+        }
+
+        file.seek(file.size());
+
+        std::mt19937 random(42);
+        QByteArray chunk(1024 * 1024, '\0');
+
+        for (qint64 written = 0; written < payloadSize; written += chunk.size()) {
+            for (auto& c : chunk) {
+                c = static_cast<char>(random());
+            }
+
+            file.write(chunk.constData(), std::min<qint64>(chunk.size(), payloadSize - written));
+        }
+
+        return path;
+    }
+
+    // payload sizes are given in KiB, so the digest's scaling curve covers the same range as the other benchmarks
+    void digestMd5(benchmark::State& state, const bool embedDigest) {
+        const auto payloadSize = state.range(0) * 1024;
+        const auto path = makeFakeAppImage(payloadSize, embedDigest);
+
+        for (auto _ : state) {
+            const auto digest = getAppImageDigestMd5(path);
+
+            if (digest.isEmpty()) {
+                state.SkipWithError("failed to calculate digest");
+                break;
+            }
+
+            benchmark::DoNotOptimize(digest);
+        }
+
+        state.SetBytesProcessed(state.iterations() * payloadSize);
+        state.SetComplexityN(state.range(0));
+
+        QFile::remove(path);
+    }
+
+    void BM_getAppImageDigestMd5_embedded(benchmark::State& state) {
+        digestMd5(state, true);
+    }
+
+    void BM_getAppImageDigestMd5_calculated(benchmark::State& state) {
+        digestMd5(state, false);
+    }
+
+    void BM_findCollisions(benchmark::State& state) {
+        resetApplicationsDir();
+        writeDesktopFiles(static_cast<int>(state.range(0)), "Benchmark App");
+
+        for (auto _ : state) {
+            const auto collisions = appimagelauncher::findCollisions("Benchmark App");
+            benchmark::DoNotOptimize(collisions);
+        }
+
+        state.SetComplexityN(state.range(0));
+    }
+
+    // the existing desktop files are candidates for name collisions, which have to be checked on every integration
+    void BM_installDesktopFileAndIcons(benchmark::State& state) {
+        const auto* appImage = getenv("APPIMAGELAUNCHER_BENCHMARK_APPIMAGE");
+
+        if (appImage == nullptr) {
+            state.SkipWithError("$APPIMAGELAUNCHER_BENCHMARK_APPIMAGE not set");
+            return;
+        }
+
+        resetApplicationsDir();
+        writeDesktopFiles(static_cast<int>(state.range(0)), "Benchmark App");
+
+        const auto context = appimagelauncher::IntegrationContext::fromApplication();
+        appimagelauncher::IntegrationEngine engine;
+
+        for (auto _ : state) {
+            const auto result = engine.installDesktopFileAndIcons(QFileInfo(appImage).absoluteFilePath(), context);
+
+            if (!result.success()) {
+                state.SkipWithError(result.errorMessage.toStdString().c_str());
+                break;
+            }
+        }
+
+        state.SetComplexityN(state.range(0));
+    }
+
+    // every iteration removes all the stale entries, so they have to be recreated in between
+    void BM_cleanUpOldDesktopIntegrationResources_stale(benchmark::State& state) {
+        for (auto _ : state) {
+            state.PauseTiming();
+            resetApplicationsDir();
+            writeDesktopFiles(static_cast<int>(state.range(0)), "Stale App");
+            state.ResumeTiming();
+
+            if (!cleanUpOldDesktopIntegrationResources()) {
+                state.SkipWithError("cleanup failed");
+                break;
+            }
+        }
+
+        state.SetComplexityN(state.range(0));
+    }
+
+    // the common case: nothing to clean up, the resource index is up to date already
+    void BM_cleanUpOldDesktopIntegrationResources_current(benchmark::State& state) {
+        resetApplicationsDir();
+        writeDesktopFiles(static_cast<int>(state.range(0)), "Current App", QCoreApplication::applicationFilePath());
+
+        for (auto _ : state) {
+            if (!cleanUpOldDesktopIntegrationResources()) {
+                state.SkipWithError("cleanup failed");
+                break;
+            }
+        }
+
+        state.SetComplexityN(state.range(0));
+    }
+
+    // depends on the system's mount table rather than anything the benchmark controls, so there's no scaling curve
+    void BM_additionalAppImagesLocations(benchmark::State& state) {
+        const bool includeValidMountPoints = state.range(0) != 0;
+
+        for (auto _ : state) {
+            const auto locations = additionalAppImagesLocations(includeValidMountPoints);
+            benchmark::DoNotOptimize(locations);
+        }
+    }
+
+#ifndef BUILD_LITE
+    // the ELF headers are parsed, the payload is never read, so the time must not depend on the payload size
+    void BM_elf_binary_size(benchmark::State& state) {
+        const auto path = makeFakeAppImage(state.range(0) * 1024, true).toStdString();
+
+        for (auto _ : state) {
+            const auto size = elf_binary_size(path);
+
+            if (size <= 0) {
+                state.SkipWithError("failed to calculate ELF size");
+                break;
+            }
+
+            benchmark::DoNotOptimize(size);
+        }
+
+        state.SetComplexityN(state.range(0));
+
+        QFile::remove(QString::fromStdString(path));
+    }
+#endif
+
+}
+
+BENCHMARK(BM_getAppImageDigestMd5_embedded)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_getAppImageDigestMd5_calculated)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_findCollisions)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_installDesktopFileAndIcons)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_cleanUpOldDesktopIntegrationResources_stale)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_cleanUpOldDesktopIntegrationResources_current)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_additionalAppImagesLocations)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+#ifndef BUILD_LITE
+BENCHMARK(BM_elf_binary_size)
+    ->RangeMultiplier(10)->Range(MIN_ENTRIES, MAX_ENTRIES)->Complexity()->Unit(benchmark::kMicrosecond);
+#endif
+
+int main(int argc, char** argv) {
+    // make sure shared won't try to use the UI
+    setenv("_FORCE_HEADLESS", "1", 1);
+
+    // the benchmarks must not touch the user's desktop integration, so everything is redirected into a temporary
+    // directory
+    QTemporaryDir xdgRoot;
+
+    if (!xdgRoot.isValid()) {
+        std::cerr << "Failed to create temporary directory" << std::endl;
+        return 1;
+    }
+
+    for (const auto& name : {"XDG_DATA_HOME", "XDG_CONFIG_HOME", "XDG_CACHE_HOME"}) {
+        const auto path = xdgRoot.path() + "/" + name;
+        QDir().mkpath(path);
+        setenv(name, path.toStdString().c_str(), 1);
+    }
+
+    QCoreApplication app(argc, argv);
+
+    benchmark::Initialize(&argc, argv);
+
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+// build-time tool generating a C header which embeds a file in compressed form (see compression.h)
+// similar to xxd -i, and uses the same naming scheme for the generated symbols:
+// <name>_compressed[] contains the compressed data, <name>_compressed_len its size and <name>_len the size of the
+// original file, where <name> is the file name with all non-alphanumeric characters replaced by underscores
+
+// system headers
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// own headers
+#include "compression.h"
+
+static unsigned char* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    unsigned char* data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+
+    for (;;) {
+        if (*size == capacity) {
+            capacity = capacity == 0 ? 65536 : capacity * 2;
+            data = realloc(data, capacity);
+
+            if (data == NULL) {
+                fclose(file);
+                return NULL;
+            }
+        }
+
+        const size_t read = fread(data + *size, 1, capacity - *size, file);
+
+        if (read == 0) {
+            break;
+        }
+
+        *size += read;
+    }
+
+    const int failed = ferror(file);
+    fclose(file);
+
+    if (failed) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input file> <output header>\n", argv[0]);
+        return 1;
+    }
+
+    const char* input_path = argv[1];
+    const char* output_path = argv[2];
+
+    size_t size;
+    unsigned char* data = read_file(input_path, &size);
+
+    if (data == NULL) {
+        fprintf(stderr, "Failed to read %s\n", input_path);
+        return 1;
+    }
+
+    unsigned char* compressed = malloc(lz_compress_bound(size));
+    unsigned char* verification = malloc(size > 0 ? size : 1);
+
+    if (compressed == NULL || verification == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    const size_t compressed_size = lz_compress(data, size, compressed);
+
+    // better safe than sorry: a broken blob would only be noticed at runtime, on systems lacking the installed library
+    if (lz_decompress(compressed, compressed_size, verification, size) != 0 || memcmp(data, verification, size) != 0) {
+        fprintf(stderr, "Verification of compressed data failed\n");
+        return 1;
+    }
+
+    // like xxd, we derive the symbol names from the input file's name
+    const char* file_name = strrchr(input_path, '/');
+    file_name = file_name != NULL ? file_name + 1 : input_path;
+
+    char* symbol = strdup(file_name);
+
+    for (char* c = symbol; *c != '\0'; ++c) {
+        if (!isalnum((unsigned char) *c)) {
+            *c = '_';
+        }
+    }
+
+    FILE* output = fopen(output_path, "w");
+
+    if (output == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", output_path);
+        return 1;
+    }
+
+    fprintf(output, "// generated by blob2header from %s, do not edit\n", file_name);
+    fprintf(output, "// compressed %zu bytes to %zu bytes\n\n", size, compressed_size);
+    fprintf(output, "static const unsigned char %s_compressed[] = {", symbol);
+
+    for (size_t i = 0; i < compressed_size; ++i) {
+        fprintf(output, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", compressed[i]);
+    }
+
+    fprintf(output, "\n};\n\n");
+    fprintf(output, "static const unsigned int %s_compressed_len = %zu;\n", symbol, compressed_size);
+    fprintf(output, "static const unsigned int %s_len = %zu;\n", symbol, size);
+
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Failed to write %s\n", output_path);
+        return 1;
+    }
+
+    free(symbol);
+    free(verification);
+    free(compressed);
+    free(data);
+
+    return 0;
+}
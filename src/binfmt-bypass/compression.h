@@ -0,0 +1,201 @@
+#pragma once
+
+// minimal LZ77 codec used to embed the preload libraries into the binfmt interpreter in compressed form
+// the binary is pinned in memory by binfmt_misc (F flag), so every byte we save there counts
+// the format follows the LZ4 block format: a sequence consists of a token byte (upper nibble: literal count, lower
+// nibble: match length - 4), optional extra length bytes (255 = more bytes follow), the literals and a 16-bit
+// little-endian match offset followed by optional extra match length bytes
+// the last sequence consists of literals only
+// the compressor is only used by the build-time tool, the decompressor doesn't allocate any memory and rejects
+// malformed input, so it can be used safely in the (static) interpreter
+// this header must remain valid C, as the build-time tool is written in C
+
+// system headers
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+/**
+ * Calculate the size of a buffer large enough to hold the compressed data in the worst case.
+ * @param src_size size of uncompressed data
+ * @return buffer size
+ */
+inline static size_t lz_compress_bound(const size_t src_size) {
+    return src_size + src_size / 255 + 16;
+}
+
+inline static unsigned char* lz_write_length(unsigned char* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+
+    *op++ = (unsigned char) length;
+    return op;
+}
+
+// a match length of 0 marks the last sequence
+inline static unsigned char* lz_write_sequence(
+    unsigned char* op,
+    const unsigned char* literals,
+    const size_t literal_count,
+    const size_t offset,
+    const size_t match_length
+) {
+    const size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+
+    *op++ = (unsigned char) (((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+    if (literal_count >= 15) {
+        op = lz_write_length(op, literal_count - 15);
+    }
+
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+
+    if (match_length == 0) {
+        return op;
+    }
+
+    *op++ = (unsigned char) (offset & 0xff);
+    *op++ = (unsigned char) (offset >> 8);
+
+    if (match_code >= 15) {
+        op = lz_write_length(op, match_code - 15);
+    }
+
+    return op;
+}
+
+/**
+ * Compress data. Greedy matching using a single hash table entry per position, which is good enough for build time.
+ * @param src data to compress
+ * @param src_size size of data
+ * @param dst buffer for compressed data, must be at least lz_compress_bound(src_size) bytes large
+ * @return size of compressed data
+ */
+inline static size_t lz_compress(const unsigned char* src, const size_t src_size, unsigned char* dst) {
+    // positions are stored + 1, so 0 marks empty slots
+    static uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char* op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    while (ip + LZ_MIN_MATCH <= src_size) {
+        uint32_t sequence;
+        memcpy(&sequence, src + ip, sizeof(sequence));
+
+        const uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+        const uint32_t candidate = table[hash];
+        table[hash] = (uint32_t) ip + 1;
+
+        if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET ||
+            memcmp(src + candidate - 1, src + ip, LZ_MIN_MATCH) != 0) {
+            ++ip;
+            continue;
+        }
+
+        const size_t match = candidate - 1;
+        size_t match_length = LZ_MIN_MATCH;
+
+        while (ip + match_length < src_size && src[match + match_length] == src[ip + match_length]) {
+            ++match_length;
+        }
+
+        op = lz_write_sequence(op, src + anchor, ip - anchor, ip - match, match_length);
+
+        ip += match_length;
+        anchor = ip;
+    }
+
+    op = lz_write_sequence(op, src + anchor, src_size - anchor, 0, 0);
+
+    return (size_t) (op - dst);
+}
+
+inline static int lz_read_length(const unsigned char* src, const size_t src_size, size_t* ip, size_t* length) {
+    unsigned char byte;
+
+    do {
+        if (*ip >= src_size) {
+            return -1;
+        }
+
+        byte = src[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+
+    return 0;
+}
+
+/**
+ * Decompress data.
+ * @param src compressed data
+ * @param src_size size of compressed data
+ * @param dst buffer for decompressed data
+ * @param dst_size exact size of decompressed data
+ * @return 0 on success, -1 if the data is malformed or doesn't match the expected size
+ */
+inline static int lz_decompress(const unsigned char* src, const size_t src_size, unsigned char* dst, const size_t dst_size) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < src_size) {
+        const unsigned char token = src[ip++];
+
+        size_t literal_count = token >> 4;
+
+        if (literal_count == 15 && lz_read_length(src, src_size, &ip, &literal_count) != 0) {
+            return -1;
+        }
+
+        if (literal_count > src_size - ip || literal_count > dst_size - op) {
+            return -1;
+        }
+
+        memcpy(dst + op, src + ip, literal_count);
+        ip += literal_count;
+        op += literal_count;
+
+        // the last sequence doesn't contain a match
+        if (ip == src_size) {
+            break;
+        }
+
+        if (src_size - ip < 2) {
+            return -1;
+        }
+
+        const size_t offset = (size_t) src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+
+        size_t match_length = token & 0x0f;
+
+        if (match_length == 15 && lz_read_length(src, src_size, &ip, &match_length) != 0) {
+            return -1;
+        }
+
+        match_length += LZ_MIN_MATCH;
+
+        if (match_length > dst_size - op) {
+            return -1;
+        }
+
+        // matches may overlap with the data they produce, therefore we have to copy byte by byte
+        for (size_t i = 0; i < match_length; ++i, ++op) {
+            dst[op] = dst[op - offset];
+        }
+    }
+
+    return op == dst_size ? 0 : -1;
+}
@@ -2,12 +2,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <type_traits>
 #include <linux/elf.h>
 #include <byteswap.h>
-#include <fstream>
-#include <iostream>
-#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // own headers
 #include "elf.h"
@@ -21,195 +24,283 @@
 #error "Unknown machine endian"
 #endif
 
-template<typename T>
-T bswap(T val) = delete;
-
-template<>
-uint16_t bswap(uint16_t val) {
-    return bswap_16(val);
+// the runtime is located at the beginning of the file and is normally a few hundred kiB in size, mapping (a lot) more
+// than that is not necessary, and would only fail for huge AppImages on 32-bit systems
+#define MAX_MAPPED_SIZE (256 * 1024 * 1024)
+
+// bundles the types of an ELF class, so the parser can be written once for both of them
+struct Elf32Types {
+    typedef Elf32_Ehdr Ehdr;
+    typedef Elf32_Phdr Phdr;
+    typedef Elf32_Shdr Shdr;
+};
+
+struct Elf64Types {
+    typedef Elf64_Ehdr Ehdr;
+    typedef Elf64_Phdr Phdr;
+    typedef Elf64_Shdr Shdr;
+};
+
+template<bool Swap, typename T>
+T swap_if_necessary(T val) {
+    static_assert(std::is_integral<T>::value, "must be an integral type");
+
+    if constexpr (!Swap || sizeof(T) == 1) {
+        return val;
+    } else if constexpr (sizeof(T) == 2) {
+        return bswap_16(val);
+    } else if constexpr (sizeof(T) == 4) {
+        return bswap_32(val);
+    } else {
+        static_assert(sizeof(T) == 8, "unsupported type size");
+        return bswap_64(val);
+    }
 }
 
-template<>
-uint32_t bswap(uint32_t val) {
-    return bswap_32(val);
+// read a struct from the mapped file, checking the bounds
+// the data might not be aligned properly, therefore we have to copy it
+template<typename T>
+bool read_struct(const char* data, size_t data_size, uint64_t offset, T& out) {
+    if (offset > data_size || data_size - offset < sizeof(T)) {
+        return false;
+    }
+
+    memcpy(&out, data + offset, sizeof(T));
+    return true;
 }
 
-template<>
-unsigned long long bswap(unsigned long long val) {
-    return bswap_64(val);
+// the offsets and sizes are read from the file, so calculating the end of a region must not overflow
+// returns false if the result doesn't fit
+static bool region_end(uint64_t offset, uint64_t size, uint64_t& end) {
+    return !__builtin_add_overflow(offset, size, &end);
 }
 
-template<typename EhdrT, typename ValT>
-void swap_data_if_necessary(const EhdrT& ehdr, ValT& val) {
-    static_assert(std::is_same<Elf64_Ehdr, EhdrT>::value || std::is_same<Elf32_Ehdr, EhdrT>::value,
-                  "must be Elf{32,64}_Ehdr");
+// data_size is the size of the mapped part of the file, file_size the size of the entire file, which the ELF binary
+// must fit into, otherwise reading the runtime would fail (or even raise SIGBUS when reading the runtime from a mapping)
+template<typename Types, bool Swap>
+bool parse_elf(const char* data, size_t data_size, uint64_t file_size, ElfInfo& info) {
+    typename Types::Ehdr ehdr{};
 
-    if (ehdr.e_ident[EI_DATA] != NATIVE_BYTE_ORDER) {
-        val = bswap(val);
+    if (!read_struct(data, data_size, 0, ehdr)) {
+        log_error("failed to read ELF header\n");
+        return false;
     }
-}
 
-template<typename EhdrT, typename ShdrT>
-off_t get_elf_size(std::ifstream& ifs)
-{
-    static_assert(std::is_same<Elf64_Ehdr, EhdrT>::value || std::is_same<Elf32_Ehdr, EhdrT>::value,
-                  "must be Elf{32,64}_Ehdr");
-    static_assert(std::is_same<Elf64_Shdr, ShdrT>::value || std::is_same<Elf32_Shdr, ShdrT>::value,
-                  "must be Elf{32,64}_Shdr");
+    const uint64_t phoff = swap_if_necessary<Swap>(ehdr.e_phoff);
+    const uint64_t phentsize = swap_if_necessary<Swap>(ehdr.e_phentsize);
+    const uint64_t phnum = swap_if_necessary<Swap>(ehdr.e_phnum);
+    const uint64_t shoff = swap_if_necessary<Swap>(ehdr.e_shoff);
+    const uint64_t shentsize = swap_if_necessary<Swap>(ehdr.e_shentsize);
+    const uint64_t shnum = swap_if_necessary<Swap>(ehdr.e_shnum);
 
-    EhdrT elf_header{};
+    // the ELF binary ends either with a segment, a section or one of the header tables
+    uint64_t size = sizeof(ehdr);
 
-    ifs.seekg(0, std::ifstream::beg);
-    ifs.read(reinterpret_cast<char*>(&elf_header), sizeof(elf_header));
+    info.is_32bit = std::is_same<Types, Elf32Types>::value;
+    info.is_dynamic = false;
+    info.interpreter.clear();
 
-    if (!ifs) {
-        log_error("failed to read ELF header\n");
-        return -1;
-    }
+    if (phnum > 0) {
+        if (phentsize < sizeof(typename Types::Phdr)) {
+            log_error("invalid program header entry size\n");
+            return false;
+        }
 
-    swap_data_if_necessary(elf_header, elf_header.e_shoff);
-    swap_data_if_necessary(elf_header, elf_header.e_shentsize);
-    swap_data_if_necessary(elf_header, elf_header.e_shnum);
-    swap_data_if_necessary(elf_header, elf_header.e_shnum);
+        for (uint64_t i = 0; i < phnum; ++i) {
+            typename Types::Phdr phdr{};
+            uint64_t phdr_offset;
+
+            if (!region_end(phoff, i * phentsize, phdr_offset) || !read_struct(data, data_size, phdr_offset, phdr)) {
+                log_error("failed to read ELF program header\n");
+                return false;
+            }
+
+            const uint64_t p_offset = swap_if_necessary<Swap>(phdr.p_offset);
+            const uint64_t p_filesz = swap_if_necessary<Swap>(phdr.p_filesz);
+            uint64_t segment_end;
+
+            if (!region_end(p_offset, p_filesz, segment_end)) {
+                log_error("invalid ELF segment size\n");
+                return false;
+            }
+
+            size = std::max(size, segment_end);
+
+            if (swap_if_necessary<Swap>(phdr.p_type) == PT_INTERP) {
+                if (p_offset > data_size || data_size - p_offset < p_filesz) {
+                    log_error("failed to read ELF program interpreter\n");
+                    return false;
+                }
+
+                // the string is null terminated within the segment, but we cannot rely on that
+                const char* interp = data + p_offset;
+                info.interpreter.assign(interp, strnlen(interp, p_filesz));
+                info.is_dynamic = true;
+            }
+        }
 
-    off_t last_shdr_offset = elf_header.e_shoff + (elf_header.e_shentsize * (elf_header.e_shnum - 1));
-    ShdrT section_header{};
+        uint64_t table_end;
 
-    ifs.seekg(last_shdr_offset, std::ifstream::beg);
-    ifs.read(reinterpret_cast<char*>(&section_header), sizeof(elf_header));
+        if (!region_end(phoff, phnum * phentsize, table_end)) {
+            log_error("invalid ELF program header table offset\n");
+            return false;
+        }
 
-    if (!ifs) {
-        log_error("failed to read ELF section header\n");
-        return -1;
+        size = std::max(size, table_end);
     }
 
-    swap_data_if_necessary(elf_header, section_header.sh_offset);
-    swap_data_if_necessary(elf_header, section_header.sh_size);
+    if (shoff != 0 && shnum > 0) {
+        if (shentsize < sizeof(typename Types::Shdr)) {
+            log_error("invalid section header entry size\n");
+            return false;
+        }
 
-    /* ELF ends either with the table of section headers (SHT) or with a section. */
-    off_t sht_end = elf_header.e_shoff + (elf_header.e_shentsize * elf_header.e_shnum);
-    off_t last_section_end = section_header.sh_offset + section_header.sh_size;
-    return sht_end > last_section_end ? sht_end : last_section_end;
-}
+        for (uint64_t i = 0; i < shnum; ++i) {
+            typename Types::Shdr shdr{};
+            uint64_t shdr_offset;
 
-template<typename EhdrT, typename ShdrT>
-ssize_t get_pt_dynamic_offset(std::ifstream& ifs)
-{
-    static_assert(std::is_same<Elf64_Ehdr, EhdrT>::value || std::is_same<Elf32_Ehdr, EhdrT>::value,
-                  "must be Elf{32,64}_Ehdr");
-    static_assert(std::is_same<Elf64_Shdr, ShdrT>::value || std::is_same<Elf32_Shdr, ShdrT>::value,
-                  "must be Elf{32,64}_Shdr");
+            if (!region_end(shoff, i * shentsize, shdr_offset) || !read_struct(data, data_size, shdr_offset, shdr)) {
+                log_error("failed to read ELF section header\n");
+                return false;
+            }
 
-    EhdrT elf_header{};
+            // sections like .bss don't occupy any space in the file
+            if (swap_if_necessary<Swap>(shdr.sh_type) == SHT_NOBITS) {
+                continue;
+            }
 
-    ifs.seekg(0, std::ifstream::beg);
-    ifs.read(reinterpret_cast<char*>(&elf_header), sizeof(elf_header));
+            const uint64_t sh_offset = swap_if_necessary<Swap>(shdr.sh_offset);
+            const uint64_t sh_size = swap_if_necessary<Swap>(shdr.sh_size);
+            uint64_t section_end;
 
-    if (!ifs) {
-        log_error("failed to read ELF header\n");
-        return -1;
-    }
+            if (!region_end(sh_offset, sh_size, section_end)) {
+                log_error("invalid ELF section size\n");
+                return false;
+            }
 
-    swap_data_if_necessary(elf_header, elf_header.e_shoff);
-    swap_data_if_necessary(elf_header, elf_header.e_shentsize);
-    swap_data_if_necessary(elf_header, elf_header.e_shnum);
-    swap_data_if_necessary(elf_header, elf_header.e_shnum);
+            size = std::max(size, section_end);
+        }
 
-    off_t last_shdr_offset = elf_header.e_shoff + (elf_header.e_shentsize * (elf_header.e_shnum - 1));
-    ShdrT section_header{};
+        uint64_t table_end;
 
-    ifs.seekg(last_shdr_offset, std::ifstream::beg);
-    ifs.read(reinterpret_cast<char*>(&section_header), sizeof(elf_header));
+        if (!region_end(shoff, shnum * shentsize, table_end)) {
+            log_error("invalid ELF section header table offset\n");
+            return false;
+        }
 
-    if (!ifs) {
-        log_error("failed to read ELF section header\n");
-        return -1;
+        size = std::max(size, table_end);
     }
 
-    swap_data_if_necessary(elf_header, section_header.sh_offset);
-    swap_data_if_necessary(elf_header, section_header.sh_size);
+    if (size > file_size) {
+        log_error("ELF binary exceeds the file's size, file truncated?\n");
+        return false;
+    }
 
-    /* ELF ends either with the table of section headers (SHT) or with a section. */
-    off_t sht_end = elf_header.e_shoff + (elf_header.e_shentsize * elf_header.e_shnum);
-    off_t last_section_end = section_header.sh_offset + section_header.sh_size;
-    return sht_end > last_section_end ? sht_end : last_section_end;
+    info.size = static_cast<off_t>(size);
+    return true;
 }
 
-bool is_32bit_elf(std::ifstream& ifs) {
-    if (!ifs) {
-        log_error("failed to read e_ident from ELF file\n");
+bool read_elf_info(const std::string& filename, ElfInfo& info) {
+    const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        log_error("could not open file %s: %s\n", filename.c_str(), strerror(errno));
         return false;
     }
 
-    // for the beginning, we just need to read e_ident to determine ELF class (i.e., either 32-bit or 64-bit)
-    // that way, we can decide which way to go
-    // the easiest way is to just use the ELF API
-    Elf64_Ehdr ehdr;
+    struct stat st{};
 
-    ifs.read(reinterpret_cast<char*>(&ehdr.e_ident), EI_NIDENT);
+    if (fstat(fd, &st) != 0) {
+        log_error("could not stat file %s: %s\n", filename.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
 
-    switch (ehdr.e_ident[EI_CLASS]) {
-        case ELFCLASS32: {
-            return true;
-        }
-        case ELFCLASS64: {
-            return false;
-        }
+    if (st.st_size < EI_NIDENT) {
+        log_error("file too small to be an ELF file: %s\n", filename.c_str());
+        close(fd);
+        return false;
     }
 
-    throw std::logic_error{"ELF binary is neither 32-bit nor 64-bit"};
-}
+    const size_t mapped_size = std::min<uint64_t>(st.st_size, MAX_MAPPED_SIZE);
 
-bool is_32bit_elf(const std::string& filename) {
-    std::ifstream ifs(filename);
+    // only the pages we actually look at will be read from disk
+    void* mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    if (!ifs) {
-        log_error("could not open file: %s\n", filename.c_str());
+    // the mapping remains valid after closing the file descriptor
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        log_error("could not map file %s: %s\n", filename.c_str(), strerror(errno));
         return false;
     }
 
-    return is_32bit_elf(ifs);
-}
+    const auto* data = static_cast<const char*>(mapping);
 
-bool is_statically_linked_elf(std::ifstream& ifs) {
-    if (!ifs) {
-        log_error("failed to read e_ident from ELF file\n");
-        return false;
+    bool success = false;
+
+    if (memcmp(data, ELFMAG, SELFMAG) != 0) {
+        log_error("not an ELF file: %s\n", filename.c_str());
+    } else {
+        constexpr bool native_is_lsb = NATIVE_BYTE_ORDER == ELFDATA2LSB;
+
+        const auto elf_class = data[EI_CLASS];
+        const auto elf_data = data[EI_DATA];
+
+        if (elf_data != ELFDATA2LSB && elf_data != ELFDATA2MSB) {
+            log_error("ELF binary has invalid byte order\n");
+        } else {
+            const bool swap = (elf_data == ELFDATA2LSB) != native_is_lsb;
+
+            switch (elf_class) {
+                case ELFCLASS32: {
+                    success = swap ? parse_elf<Elf32Types, true>(data, mapped_size, st.st_size, info)
+                                   : parse_elf<Elf32Types, false>(data, mapped_size, st.st_size, info);
+                    break;
+                }
+                case ELFCLASS64: {
+                    success = swap ? parse_elf<Elf64Types, true>(data, mapped_size, st.st_size, info)
+                                   : parse_elf<Elf64Types, false>(data, mapped_size, st.st_size, info);
+                    break;
+                }
+                default: {
+                    log_error("ELF binary is neither 32-bit nor 64-bit\n");
+                    break;
+                }
+            }
+        }
     }
 
-    ssize_t pt_dynamic_offset;
+    munmap(mapping, mapped_size);
+    return success;
+}
 
-    if (is_32bit_elf(ifs)) {
-        pt_dynamic_offset = get_pt_dynamic_offset<Elf32_Ehdr, Elf32_Shdr>(ifs);
-    } else {
-        pt_dynamic_offset = get_pt_dynamic_offset<Elf64_Ehdr, Elf64_Shdr>(ifs);
+bool is_32bit_elf(const std::string& filename) {
+    ElfInfo info;
+
+    if (!read_elf_info(filename, info)) {
+        return false;
     }
 
-    return pt_dynamic_offset != -1;
+    return info.is_32bit;
 }
 
 bool is_statically_linked_elf(const std::string& filename) {
-    std::ifstream ifs(filename);
+    ElfInfo info;
 
-    if (!ifs) {
-        log_error("could not open file: %s\n", filename.c_str());
+    if (!read_elf_info(filename, info)) {
         return false;
     }
 
-    return is_statically_linked_elf(ifs);
+    return !info.is_dynamic;
 }
 
 ssize_t elf_binary_size(const std::string& filename) {
-    std::ifstream ifs(filename);
+    ElfInfo info;
 
-    if (!ifs) {
-        log_error("could not open file\n");
+    if (!read_elf_info(filename, info)) {
         return -1;
     }
 
-    if (is_32bit_elf(ifs)) {
-        return get_elf_size<Elf32_Ehdr, Elf32_Shdr>(ifs);
-    } else {
-        return get_elf_size<Elf64_Ehdr, Elf64_Shdr>(ifs);
-    }
+    return info.size;
 }
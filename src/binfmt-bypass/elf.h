@@ -1,6 +1,34 @@
 #pragma once
 
 #include <string>
+#include <sys/types.h>
+
+/**
+ * Information about an ELF binary required to launch an AppImage runtime.
+ */
+struct ElfInfo {
+    // ELF class, i.e., whether it's a 32-bit or a 64-bit binary
+    bool is_32bit = false;
+
+    // size of the ELF part of the file in bytes, i.e., the offset at which an AppImage's payload begins
+    off_t size = -1;
+
+    // whether the binary requests a program interpreter (i.e., the dynamic loader), which will honor $LD_PRELOAD
+    // static-pie binaries have a PT_DYNAMIC segment, but no program interpreter, so they count as statically linked
+    bool is_dynamic = false;
+
+    // path to the program interpreter (PT_INTERP), empty for statically linked binaries
+    std::string interpreter;
+};
+
+/**
+ * Parse an ELF file's header, program headers and section headers in a single pass.
+ * Both ELF classes and byte orders are supported.
+ * @param filename path to ELF file
+ * @param info information about the ELF file, only valid if the function returns true
+ * @return true on success, false otherwise
+ */
+bool read_elf_info(const std::string& filename, ElfInfo& info);
 
 /**
  * Check whether file is linked staticallly.
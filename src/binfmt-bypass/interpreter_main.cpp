@@ -1,11 +1,17 @@
 // system headers
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
 // own headers
 #include "logging.h"
 #include "lib.h"
+#include "integrationindex.h"
+#include "zygote.h"
+#include "tracing.h"
 
 bool executableExists(const std::string& path) {
     if (access(path.c_str(), X_OK) != 0) {
@@ -16,8 +22,51 @@ bool executableExists(const std::string& path) {
     return true;
 }
 
+// checks the integration index maintained by AppImageLauncher, appimagelauncherd and ail-cli
+// if the AppImage is integrated already and its integration is up to date, AppImageLauncher would just launch it
+// anyway, so we can skip initializing Qt etc. and launch it right away
+bool isIntegratedAndUpToDate(const std::string& path) {
+    // the launcher updates the desktop files of integrated AppImages after it has been updated itself
+    struct stat launcherStat{};
+    if (stat(APPIMAGELAUNCHER_PATH, &launcherStat) != 0) {
+        return false;
+    }
+
+    std::unique_ptr<char, decltype(&free)> canonicalPath(realpath(path.c_str(), nullptr), &free);
+
+    if (canonicalPath == nullptr) {
+        return false;
+    }
+
+    appimagelauncher::TraceSpan span("integration index lookup");
+
+    const appimagelauncher::IntegrationIndex index(appimagelauncher::defaultIntegrationIndexPath());
+
+    if (!index.isValid()) {
+        log_debug("integration index not available or outdated\n");
+        return false;
+    }
+
+    return index.isIntegratedAndUpToDate(canonicalPath.get(), launcherStat.st_mtim.tv_sec);
+}
+
+// --appimagelauncher-* options are handled by AppImageLauncher (which, e.g., also runs its cleanup tasks then), so
+// none of the shortcuts around it must be taken if any of them has been passed
+bool hasAppImageLauncherOptions(const std::vector<char*>& args) {
+    static const char prefix[] = "--appimagelauncher-";
+
+    for (const auto* arg : args) {
+        if (strncmp(arg, prefix, sizeof(prefix) - 1) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int main(int argc, char** argv) {
     log_debug("Welcome to AppImageLauncher's binfmt_misc interpreter!\n");
+    tracing_instant("interpreter main", argc > 1 ? argv[1] : nullptr);
 
     if (argc <= 1) {
         log_message("Usage: %s <AppImage file> [args...]\n", argv[0]);
@@ -52,6 +101,30 @@ int main(int argc, char** argv) {
         return bypassBinfmtAndRunAppImage(argv[1], args);
     }
 
+    const bool mayBypassAppImageLauncher = !hasAppImageLauncherOptions(args);
+
+    // if appimagelauncherd runs in zygote mode, it can make the launch decision and launch the AppImage right away
+    // the launched process is detached from our session, so this is used only for launches which are not made from a
+    // terminal (e.g., from a file manager or a desktop file)
+    if (mayBypassAppImageLauncher && isatty(STDIN_FILENO) == 0) {
+        appimagelauncher::TraceSpan span("zygote launch");
+        const auto rv = launch_via_zygote(appImagePath, args);
+
+        if (rv != ZYGOTE_NOT_AVAILABLE) {
+            return rv;
+        }
+    }
+
+    // AppImageLauncher is only needed if an integration decision has to be made or a dialog has to be shown
+    if (mayBypassAppImageLauncher && isIntegratedAndUpToDate(appImagePath)) {
+        log_debug("AppImage %s is integrated already, launching it directly\n", appImagePath.c_str());
+
+        // same as AppImageLauncher does before launching an AppImage: suppress desktop integration scripts
+        setenv("DESKTOPINTEGRATION", "AppImageLauncher", true);
+
+        return bypassBinfmtAndRunAppImage(argv[1], args);
+    }
+
     log_debug(
         "AppImageLauncher found at %s, launching AppImage %s with it\n",
         APPIMAGELAUNCHER_PATH,
@@ -62,9 +135,13 @@ int main(int argc, char** argv) {
     args.emplace(args.begin(), strdup(appImagePath.c_str()));
     args.emplace(args.begin(), strdup(APPIMAGELAUNCHER_PATH));
 
+    // argv must be null terminated
+    args.push_back(nullptr);
+
+    tracing_instant("exec AppImageLauncher", appImagePath.c_str());
     const auto rv = execv(APPIMAGELAUNCHER_PATH, args.data());
 
     assert(rv == -1);
-    log_error("execv(%s, ...) failed\n");
+    log_error("execv(%s, ...) failed\n", APPIMAGELAUNCHER_PATH);
     return EXIT_CODE_FAILURE;
 }
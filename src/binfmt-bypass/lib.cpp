@@ -1,21 +1,31 @@
 // system headers
 #include <cstdio>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <wait.h>
+#include <poll.h>
+#include <csignal>
 #include <vector>
 #include <memory.h>
 #include <memory>
 #include <stdexcept>
-#include <cassert>
 #include <filesystem>
+#include <climits>
+#include <sys/stat.h>
 
 // own headers
 #include "elf.h"
 #include "logging.h"
 #include "lib.h"
+#include "runtime_cache.h"
+#include "prefetch_profile.h"
+#include "compression.h"
 #include "binfmt-bypass-preload.h"
+#include "tracing.h"
 
 #ifdef PRELOAD_LIB_NAME_32BIT
     #include "binfmt-bypass-preload_32bit.h"
@@ -23,23 +33,93 @@
 
 #define EXIT_CODE_FAILURE 0xff
 
+// copies the first count bytes of in_fd to out_fd without any round trip through user space
+// copy_file_range(...) is tried first, as it may even share the data between the files, depending on the file systems
+// it doesn't work across file systems on all kernels, though, therefore sendfile(...) is used as a fallback
+bool copy_file_contents(int in_fd, int out_fd, const off_t count) {
+    off_t offset = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    bool use_copy_file_range = true;
+#endif
+
+    while (offset < count) {
+        const auto remaining = static_cast<size_t>(count - offset);
+        ssize_t copied;
+
+#ifdef HAVE_COPY_FILE_RANGE
+        if (use_copy_file_range) {
+            loff_t in_offset = offset;
+            loff_t out_offset = offset;
+
+            copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, remaining, 0);
+
+            if (copied < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                log_debug("copy_file_range failed (%s), falling back to sendfile\n", strerror(errno));
+                use_copy_file_range = false;
+
+                // unlike copy_file_range with explicit offsets, sendfile writes at the current position
+                if (lseek(out_fd, offset, SEEK_SET) != offset) {
+                    log_error("lseek failed: %s\n", strerror(errno));
+                    return false;
+                }
+
+                continue;
+            }
+        } else
+#endif
+        {
+            off_t in_offset = offset;
+            copied = sendfile(out_fd, in_fd, &in_offset, remaining);
+        }
+
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log_error("failed to copy runtime: %s\n", strerror(errno));
+            return false;
+        }
+
+        // the runtime size has been calculated from the file's headers, so the file should be at least that large
+        if (copied == 0) {
+            log_error("failed to copy runtime: unexpected end of file\n");
+            return false;
+        }
+
+        offset += copied;
+    }
+
+    return true;
+}
+
 bool copy_and_patch_runtime(int fd, const char* const appimage_filename, const ssize_t elf_size) {
     // copy runtime header into memfd "file"
     {
-        const auto realfd = open(appimage_filename, O_RDONLY);
-        std::vector<char> buffer(elf_size);
-        // TODO: check for errors
-        read(realfd, buffer.data(), elf_size);
-        write(fd, buffer.data(), elf_size);
+        const auto realfd = open(appimage_filename, O_RDONLY | O_CLOEXEC);
+
+        if (realfd < 0) {
+            log_error("could not open %s: %s\n", appimage_filename, strerror(errno));
+            return false;
+        }
+
+        const auto copied = copy_file_contents(realfd, fd, elf_size);
         close(realfd);
+
+        if (!copied) {
+            return false;
+        }
     }
 
     // erase magic bytes
-    lseek(fd, 8, SEEK_SET);
-    char null_buf[]{0, 0, 0};
-    write(fd, null_buf, 3);
+    static const char null_buf[]{0, 0, 0};
+
+    if (pwrite(fd, null_buf, sizeof(null_buf), 8) != sizeof(null_buf)) {
+        log_error("failed to erase magic bytes: %s\n", strerror(errno));
+        return false;
+    }
 
-    // TODO: handle errors properly
     return true;
 }
 
@@ -49,9 +129,10 @@ bool copy_and_patch_runtime(int fd, const char* const appimage_filename, const s
 // shm_open or classic tempfiles
 
 int create_memfd_with_patched_runtime(const char* const appimage_filename, const ssize_t elf_size) {
-    // as we call exec() after fork() to create a child process (the parent keeps it alive, the child doesn't require
-    // access anyway), we enable close-on-exec
-    const auto memfd = memfd_create("runtime", MFD_CLOEXEC);
+    // we enable close-on-exec, as the executed runtime doesn't require access to the file descriptor
+    // this doesn't prevent us from executing the memfd: the kernel holds its own reference to the file while loading
+    // an ELF binary (only scripts need to be able to open /dev/fd/... after exec())
+    const auto memfd = memfd_create("runtime", MFD_CLOEXEC | MFD_ALLOW_SEALING);
 
     if (memfd < 0) {
         log_error("memfd_create failed: %s\n", strerror(errno));
@@ -64,6 +145,11 @@ int create_memfd_with_patched_runtime(const char* const appimage_filename, const
         return -1;
     }
 
+    // make the patched runtime immutable, so nobody can modify it while it's being executed
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        log_debug("failed to seal memfd: %s\n", strerror(errno));
+    }
+
     return memfd;
 }
 
@@ -146,6 +232,91 @@ std::filesystem::path find_preload_library(bool is_32bit) {
     return rv;
 }
 
+// the preload libraries are embedded in compressed form (see compression.h), and only decompressed when needed
+struct EmbeddedPreloadLib {
+    const unsigned char* compressed_data;
+    size_t compressed_size;
+    size_t size;
+};
+
+EmbeddedPreloadLib embedded_preload_lib(const bool is_32bit) {
+#ifdef PRELOAD_LIB_NAME_32BIT
+    if (is_32bit) {
+        return {
+            libbinfmt_bypass_preload_32bit_so_compressed,
+            libbinfmt_bypass_preload_32bit_so_compressed_len,
+            libbinfmt_bypass_preload_32bit_so_len,
+        };
+    }
+#else
+    (void) is_32bit;
+#endif
+
+    return {
+        libbinfmt_bypass_preload_so_compressed,
+        libbinfmt_bypass_preload_so_compressed_len,
+        libbinfmt_bypass_preload_so_len,
+    };
+}
+
+// serves the embedded copy of the preload library from memory, so launching AppImages doesn't require any writes to
+// the file system even if the library isn't installed next to this binary (e.g., in containers or chroots)
+// the library is decompressed straight into the memfd, so no additional buffer is needed
+// unlike the runtime's memfd, the file descriptor must survive exec(), as the dynamic loader opens the library by path
+// returns -1 if this is not possible, the caller should fall back to a temporary file then
+int create_preload_lib_memfd(const EmbeddedPreloadLib& lib) {
+#ifdef HAVE_MEMFD_CREATE
+    appimagelauncher::TraceSpan span("preload library memfd setup");
+
+    // the dynamic loader needs to be able to access the file via /proc
+    if (access("/proc/self/fd", F_OK) != 0) {
+        log_debug("/proc not available, cannot use memfd for preload library\n");
+        return -1;
+    }
+
+    const int fd = memfd_create("preload", MFD_ALLOW_SEALING);
+
+    if (fd < 0) {
+        log_debug("memfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(lib.size)) != 0) {
+        log_debug("failed to resize memfd: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    auto* data = static_cast<unsigned char*>(mmap(nullptr, lib.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+
+    if (data == MAP_FAILED) {
+        log_debug("failed to map memfd: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    const auto rv = lz_decompress(lib.compressed_data, lib.compressed_size, data, lib.size);
+
+    // the memfd can only be sealed once there are no writable mappings left
+    munmap(data, lib.size);
+
+    if (rv != 0) {
+        log_error("failed to decompress embedded preload library\n");
+        close(fd);
+        return -1;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        log_debug("failed to seal memfd: %s\n", strerror(errno));
+    }
+
+    return fd;
+#else
+    (void) lib;
+    return -1;
+#endif
+}
+
 /**
  * Create a temporary file within the shm file system and maintain its existence using the RAII principle.
  * This is a first attempt, creating the files within /tmp. Future versions could try to put the files next to the
@@ -153,7 +324,13 @@ std::filesystem::path find_preload_library(bool is_32bit) {
  */
 class TemporaryPreloadLibFile {
 public:
-    TemporaryPreloadLibFile(const unsigned char* libContents, const std::streamsize libContentsSize) {
+    explicit TemporaryPreloadLibFile(const EmbeddedPreloadLib& lib) {
+        std::vector<unsigned char> libContents(lib.size);
+
+        if (lz_decompress(lib.compressed_data, lib.compressed_size, libContents.data(), libContents.size()) != 0) {
+            throw std::runtime_error("failed to decompress embedded preload lib");
+        }
+
         char tempFilePattern[] = "/tmp/appimagelauncher-preload-XXXXXX.so";
 
         _fd = mkstemps(tempFilePattern, 3);
@@ -163,7 +340,7 @@ public:
 
         _path = tempFilePattern;
 
-        if (write(_fd, libContents, libContentsSize) != libContentsSize) {
+        if (write(_fd, libContents.data(), libContents.size()) != static_cast<ssize_t>(libContents.size())) {
             throw std::runtime_error("failed to write contents to temporary preload lib");
         }
     }
@@ -182,138 +359,478 @@ private:
     std::filesystem::path _path;
 };
 
-// need to keep track of the subprocess pid in a global variable, as signal handlers in C(++) are simple interrupt
-// handlers that are not aware of any state in main()
-// note that we only connect the signal handler once we have created a subprocess, i.e., we don't need to worry about
-// subprocess_pid not being set yet
-// it's best practice to implement a check anyway, though
-static pid_t subprocess_pid = 0;
-
-void forwardSignal(int signal) {
-    if (subprocess_pid != 0) {
-        log_debug("forwarding signal %d to subprocess %ld\n", signal, subprocess_pid);
-        kill(subprocess_pid, signal);
-    } else {
-        log_error("signal %d received but no subprocess created yet, shutting down\n", signal);
-        exit(signal);
+// tells the kernel to read the parts of the AppImage which the runtime is going to need during startup, based on a
+// prefetch profile recorded earlier (see prefetch_profile.h)
+// posix_fadvise(...) only initiates the reads, so the runtime can start in parallel
+void prefetch_appimage(const std::string& appimage_path) {
+    if (getenv(PREFETCH_PROFILE_DISABLE_ENV_VAR) != nullptr || getenv(PREFETCH_PROFILE_RECORD_ENV_VAR) != nullptr) {
+        return;
+    }
+
+    appimagelauncher::TraceSpan span("prefetch");
+
+    const int appimage_fd = open(appimage_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (appimage_fd < 0) {
+        return;
+    }
+
+    struct stat appimage_stat{};
+    char profile_path[PATH_MAX];
+
+    if (fstat(appimage_fd, &appimage_stat) != 0 ||
+        prefetch_profile_path(profile_path, sizeof(profile_path), &appimage_stat) != 0) {
+        close(appimage_fd);
+        return;
+    }
+
+    const int profile_fd = open(profile_path, O_RDONLY | O_CLOEXEC);
+
+    if (profile_fd < 0) {
+        close(appimage_fd);
+        return;
+    }
+
+    prefetch_profile_header header{};
+    std::vector<prefetch_profile_range> ranges;
+
+    if (read(profile_fd, &header, sizeof(header)) == sizeof(header) &&
+        memcmp(header.magic, PREFETCH_PROFILE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == PREFETCH_PROFILE_VERSION &&
+        header.range_count <= PREFETCH_PROFILE_MAX_RANGES) {
+        ranges.resize(header.range_count);
+
+        const auto ranges_size = static_cast<ssize_t>(ranges.size() * sizeof(prefetch_profile_range));
+
+        if (read(profile_fd, ranges.data(), ranges_size) != ranges_size) {
+            ranges.clear();
+        }
     }
+
+    close(profile_fd);
+
+    log_debug("prefetching %zu ranges from %s\n", ranges.size(), profile_path);
+
+    for (const auto& range : ranges) {
+        posix_fadvise(appimage_fd, static_cast<off_t>(range.offset), static_cast<off_t>(range.length), POSIX_FADV_WILLNEED);
+    }
+
+    // the data remains in the page cache after closing the file
+    close(appimage_fd);
 }
 
-int bypassBinfmtAndRunAppImage(const std::string& appimage_path, const std::vector<char*>& target_args) {
-    // read size of AppImage runtime (i.e., detect size of ELF binary)
-    const auto size = elf_binary_size(appimage_path.c_str());
+// fills the set with the signals we forward to the runtime
+// synchronous signals such as SIGSEGV must not be blocked, SIGKILL and SIGSTOP cannot be blocked anyway
+// SIGCHLD and SIGPIPE are part of the set, too, but are handled by the supervisor itself
+void make_forwarded_signal_set(sigset_t& set) {
+    sigfillset(&set);
 
-    if (size < 0) {
-        log_error("failed to detect runtime size\n");
+    for (const auto sig : {SIGKILL, SIGSTOP, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGTRAP, SIGSYS, SIGABRT}) {
+        sigdelset(&set, sig);
+    }
+}
+
+void forward_signal(const pid_t pid, const int pidfd, const int sig) {
+    log_debug("forwarding signal %d to subprocess %ld\n", sig, (long) pid);
+
+#ifdef SYS_pidfd_send_signal
+    if (pidfd >= 0 && syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0) == 0) {
+        return;
+    }
+#else
+    (void) pidfd;
+#endif
+
+    // as the runtime is our child, its PID can't be reused before we have reaped it, so this is safe as well
+    if (kill(pid, sig) != 0) {
+        log_debug("failed to forward signal %d: %s\n", sig, strerror(errno));
+    }
+}
+
+// the subprocess the signal handler below forwards the signals to
+static volatile pid_t signal_handler_target_pid = -1;
+
+// fallback for systems without signalfd(...), only uses async-signal-safe functions
+static void forward_signal_handler(const int sig) {
+    // see supervise_subprocess(...)
+    if (sig == SIGCHLD || sig == SIGPIPE) {
+        return;
+    }
+
+    const auto saved_errno = errno;
+    kill(signal_handler_target_pid, sig);
+    errno = saved_errno;
+}
+
+// installs forward_signal_handler(...) for all the forwarded signals, and unblocks them
+// signals received while they were blocked are delivered to the handler right away
+void install_forwarding_signal_handlers(const pid_t pid, const sigset_t& forwarded_signals) {
+    signal_handler_target_pid = pid;
+
+    struct sigaction action{};
+    action.sa_handler = forward_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigfillset(&action.sa_mask);
+
+    for (int sig = 1; sig < NSIG; ++sig) {
+        // SIGCHLD's default action is fine, the subprocess is reaped with waitpid(...) anyway
+        if (sig == SIGCHLD || sigismember(&forwarded_signals, sig) != 1) {
+            continue;
+        }
+
+        // some signals reserved by the C library can't be handled, they are of no interest anyway
+        sigaction(sig, &action, nullptr);
+    }
+
+    sigprocmask(SIG_UNBLOCK, &forwarded_signals, nullptr);
+}
+
+int exit_code_from_wait_status(const int status) {
+    if (status == -1) {
         return EXIT_CODE_FAILURE;
     }
 
+    if (WIFSIGNALED(status) != 0) {
+        // like shells do, we report the signal as exit code 128 + <signal number>
+        log_debug("child was terminated by signal %d\n", WTERMSIG(status));
+        return 128 + WTERMSIG(status);
+    }
+
+    if (WIFEXITED(status) != 0) {
+        log_debug("child exited normally with code %d\n", WEXITSTATUS(status));
+        return WEXITSTATUS(status);
+    }
+
+    log_error("unknown error: child didn't exit with signal or regular exit code\n");
+    return EXIT_CODE_FAILURE;
+}
+
+// waits for the runtime to exit, forwarding all signals we receive in the meantime
+// the signals must have been blocked before creating the subprocess, so none of them can get lost
+// returns the subprocess's wait status, or -1 on errors
+int supervise_subprocess(const pid_t pid, const sigset_t& forwarded_signals) {
+    // receiving signals through a file descriptor allows us to handle them synchronously, so we don't have to worry
+    // about doing anything that's not allowed in a signal handler
+    const int sfd = signalfd(-1, &forwarded_signals, SFD_CLOEXEC);
+
+    if (sfd < 0) {
+        log_warning("signalfd failed, forwarding signals with signal handlers: %s\n", strerror(errno));
+        install_forwarding_signal_handlers(pid, forwarded_signals);
+    }
+
+    // a pidfd becomes readable once the process terminates
+    // older kernels (< 5.3) don't support pidfds, then we have to rely on SIGCHLD
+    int pidfd = -1;
+
+#ifdef SYS_pidfd_open
+    pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+
+    if (pidfd < 0) {
+        log_debug("pidfd_open not available, falling back to SIGCHLD\n");
+    }
+
+    int status = -1;
+
+    for (;;) {
+        // without a pidfd, we check whether the runtime has exited after every signal (SIGCHLD in particular)
+        if (sfd < 0 || pidfd < 0) {
+            const auto rv = waitpid(pid, &status, sfd < 0 ? 0 : WNOHANG);
+
+            if (rv == pid) {
+                break;
+            }
+
+            if (rv < 0 && errno != EINTR) {
+                log_error("waitpid failed: %s\n", strerror(errno));
+                status = -1;
+                break;
+            }
+
+            if (sfd < 0) {
+                continue;
+            }
+        }
+
+        pollfd fds[2] = {
+            {sfd, POLLIN, 0},
+            {pidfd, POLLIN, 0},
+        };
+
+        if (poll(fds, pidfd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            log_error("poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if ((fds[0].revents & POLLIN) != 0) {
+            signalfd_siginfo info{};
+
+            if (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                const auto sig = static_cast<int>(info.ssi_signo);
+
+                // SIGPIPE can only be caused by our own writes (e.g., log messages to a closed stderr), and must not
+                // terminate us while the runtime is still running
+                if (sig != SIGCHLD && sig != SIGPIPE) {
+                    forward_signal(pid, pidfd, sig);
+                }
+            }
+        }
+
+        if (pidfd >= 0 && (fds[1].revents & POLLIN) != 0) {
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) {
+                    log_error("waitpid failed: %s\n", strerror(errno));
+                    status = -1;
+                    break;
+                }
+            }
+
+            break;
+        }
+    }
+
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+
+    if (sfd >= 0) {
+        close(sfd);
+    }
+
+    return status;
+}
+
+int create_uncached_patched_runtime(const std::string& appimage_path, const off_t runtime_size) {
 #ifdef HAVE_MEMFD_CREATE
     // create "file" in memory, copy runtime there and patch out magic bytes
-    const int runtime_fd = create_memfd_with_patched_runtime(appimage_path.c_str(), size);
+    return create_memfd_with_patched_runtime(appimage_path.c_str(), runtime_size);
 #else
-    const int runtime_fd = create_shm_fd_with_patched_runtime(appimage_filename.c_str(), size);
+    return create_shm_fd_with_patched_runtime(appimage_path.c_str(), runtime_size);
 #endif
+}
 
-    if (runtime_fd < 0) {
-        log_error("failed to set up in-memory file with patched runtime\n");
-        return EXIT_CODE_FAILURE;
-    }
+// replaces the current process with the runtime, only returns in case of errors (errno is set accordingly)
+void exec_runtime_fd(const int runtime_fd, char* const* argv) {
+    // launch memfd directly, no path needed
+    // execveat(...) doesn't depend on /proc being mounted, unlike glibc's fallback implementation of fexecve(...)
+#ifdef SYS_execveat
+    log_debug("execveat(...)\n");
+    syscall(SYS_execveat, runtime_fd, "", argv, environ, AT_EMPTY_PATH);
 
-    // to keep alive the memfd, we launch the AppImage as a subprocess
-    if ((subprocess_pid = fork()) == 0) {
-        // create new argv array, using passed filename as argv[0]
-        std::vector<char*> new_argv;
+    if (errno == ENOSYS)
+#endif
+    {
+        log_debug("fexecve(...)\n");
+        fexecve(runtime_fd, argv, environ);
+    }
+}
 
-        new_argv.push_back(strdup(appimage_path.c_str()));
+PreparedRuntime::PreparedRuntime() = default;
 
-        // insert remaining args, if any
-        for (const auto& arg : target_args) {
-            new_argv.push_back(strdup(arg));
+PreparedRuntime::~PreparedRuntime() {
+    for (const auto fd : {runtime_fd, preload_lib_fd}) {
+        if (fd >= 0) {
+            close(fd);
         }
+    }
+}
+
+bool prepare_patched_runtime(
+    const std::string& appimage_path,
+    const bool allow_temporary_files,
+    PreparedRuntime& runtime
+) {
+    appimagelauncher::TraceSpan span("runtime memfd setup");
 
-        // needs to be null terminated, of course
-        new_argv.push_back(nullptr);
+    // parse the AppImage runtime's ELF headers once, providing the runtime size as well as the information whether
+    // our preload library can be used
+    ElfInfo runtime_info;
 
+    if (!read_elf_info(appimage_path, runtime_info) || runtime_info.size <= 0) {
+        log_error("failed to detect runtime size\n");
+        return false;
+    }
+
+    log_debug(
+        "runtime: %s, size %ld, interpreter: %s\n",
+        runtime_info.is_32bit ? "32-bit" : "64-bit",
+        (long) runtime_info.size,
+        runtime_info.is_dynamic ? runtime_info.interpreter.c_str() : "none (statically linked)"
+    );
+
+    // calculate absolute path to AppImage, for use in the preloaded lib
+    std::unique_ptr<char, decltype(&free)> abs_appimage_path(realpath(appimage_path.c_str(), nullptr), &free);
+
+    if (abs_appimage_path == nullptr) {
+        log_error("failed to resolve path %s: %s\n", appimage_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    log_debug("absolute AppImage path: %s\n", abs_appimage_path.get());
+
+    runtime.appimage_path = abs_appimage_path.get();
+    runtime.runtime_size = runtime_info.size;
+
+    // statically linked runtimes don't make use of $LD_PRELOAD anyway
+    if (runtime_info.is_dynamic) {
         // preload our library
-        auto preload_lib_path = find_preload_library(is_32bit_elf(appimage_path));
+        auto preload_lib_path = find_preload_library(runtime_info.is_32bit);
 
         log_debug("preload lib path: %s\n", preload_lib_path.string().c_str());
 
-        // may or may not be used, but must survive until this application terminates
-        std::unique_ptr<TemporaryPreloadLibFile> temporaryPreloadLibFile;
-
         if (!std::filesystem::exists(preload_lib_path)) {
-            log_warning("could not find preload library, creating new temporary file for it\n");
+            // only the library matching the runtime's architecture is decompressed
+            const auto embedded_lib = embedded_preload_lib(runtime_info.is_32bit);
 
-#ifdef PRELOAD_LIB_NAME_32BIT
-            if (is_32bit_elf(appimage_path)) {
-                temporaryPreloadLibFile = std::make_unique<TemporaryPreloadLibFile>(
-                    libbinfmt_bypass_preload_32bit_so,
-                    libbinfmt_bypass_preload_32bit_so_len
-                );
-            }
-#endif
+            runtime.preload_lib_fd = create_preload_lib_memfd(embedded_lib);
 
-            if (temporaryPreloadLibFile == nullptr) {
-                temporaryPreloadLibFile = std::make_unique<TemporaryPreloadLibFile>(
-                    libbinfmt_bypass_preload_so,
-                    libbinfmt_bypass_preload_so_len
-                );
-            }
+            if (runtime.preload_lib_fd >= 0) {
+                log_debug("could not find preload library, using embedded copy\n");
+
+                const auto fd_string = std::to_string(runtime.preload_lib_fd);
+                preload_lib_path = "/proc/self/fd/" + fd_string;
 
-            assert(temporaryPreloadLibFile != nullptr);
+                // the preload library closes the file descriptor once it has been loaded
+                runtime.env.emplace_back("APPIMAGELAUNCHER_PRELOAD_LIB_FD", fd_string);
+            } else if (allow_temporary_files) {
+                log_warning("could not find preload library, creating new temporary file for it\n");
 
-            preload_lib_path = temporaryPreloadLibFile->path();
+                runtime.temporary_preload_lib_file = std::make_unique<TemporaryPreloadLibFile>(embedded_lib);
+                preload_lib_path = runtime.temporary_preload_lib_file->path();
+            } else {
+                log_error("could not find preload library, and cannot serve it from memory\n");
+                return false;
+            }
         }
 
-        if (!is_statically_linked_elf(appimage_path)) {
-            log_debug("library to preload: %s\n", preload_lib_path.string().c_str());
-            setenv("LD_PRELOAD", preload_lib_path.c_str(), true);
+        log_debug("library to preload: %s\n", preload_lib_path.string().c_str());
+        runtime.env.emplace_back("LD_PRELOAD", preload_lib_path.string());
+    }
+
+    // TARGET_APPIMAGE is further needed for static runtimes which do not make any use of LD_PRELOAD
+    runtime.env.emplace_back("REDIRECT_APPIMAGE", runtime.appimage_path);
+    runtime.env.emplace_back("TARGET_APPIMAGE", runtime.appimage_path);
+
+    // most AppImages share the same few runtimes, so we try to reuse a previously patched copy first
+    runtime.runtime_fd = open_cached_patched_runtime(appimage_path, runtime_info.size);
+
+    if (runtime.runtime_fd < 0) {
+        runtime.runtime_fd = create_uncached_patched_runtime(appimage_path, runtime_info.size);
+    }
+
+    if (runtime.runtime_fd < 0) {
+        log_error("failed to set up in-memory file with patched runtime\n");
+        return false;
+    }
+
+    return true;
+}
+
+// sets up the environment for the patched runtime and replaces the current process with it
+// only returns in case of errors
+int exec_patched_runtime(
+    const PreparedRuntime& runtime,
+    const std::string& appimage_path,
+    const std::vector<char*>& target_args
+) {
+    // create new argv array, using passed filename as argv[0]
+    std::vector<char*> new_argv;
+
+    new_argv.push_back(strdup(appimage_path.c_str()));
+
+    // insert remaining args, if any
+    for (const auto& arg : target_args) {
+        new_argv.push_back(strdup(arg));
+    }
+
+    // needs to be null terminated, of course
+    new_argv.push_back(nullptr);
+
+    for (const auto& var : runtime.env) {
+        setenv(var.first.c_str(), var.second.c_str(), true);
+    }
+
+    tracing_instant("exec patched runtime", appimage_path.c_str());
+
+    exec_runtime_fd(runtime.runtime_fd, new_argv.data());
+
+    // cached runtimes can't be executed if the cache's file system has been mounted with noexec (or a security module
+    // denies it), in-memory copies usually can
+    if (errno == EACCES || errno == EPERM) {
+        log_warning("failed to execute patched runtime (%s), retrying with in-memory copy\n", strerror(errno));
+
+        const int fallback_fd = create_uncached_patched_runtime(runtime.appimage_path, runtime.runtime_size);
+
+        if (fallback_fd >= 0) {
+            exec_runtime_fd(fallback_fd, new_argv.data());
+
+            const auto exec_errno = errno;
+            close(fallback_fd);
+            errno = exec_errno;
         }
+    }
 
-        // calculate absolute path to AppImage, for use in the preloaded lib
-        char* abs_appimage_path = realpath(appimage_path.c_str(), nullptr);
-        log_debug("absolute AppImage path: %s\n", abs_appimage_path);
-        // TARGET_APPIMAGE is further needed for static runtimes which do not make any use of LD_PRELOAD
-        setenv("REDIRECT_APPIMAGE", abs_appimage_path, true);
-        setenv("TARGET_APPIMAGE", abs_appimage_path, true);
+    log_error("failed to execute patched runtime: %s\n", strerror(errno));
+    return EXIT_CODE_FAILURE;
+}
 
-        // launch memfd directly, no path needed
-        log_debug("fexecve(...)\n");
-        fexecve(runtime_fd, new_argv.data(), environ);
+int bypassBinfmtAndExecAppImage(const std::string& appimage_path, const std::vector<char*>& target_args) {
+    PreparedRuntime runtime;
 
-        log_error("failed to execute patched runtime: %s\n", strerror(errno));
+    if (!prepare_patched_runtime(appimage_path, true, runtime)) {
         return EXIT_CODE_FAILURE;
     }
 
-    // now that we have a subprocess and know its process ID, it's time to set up signal forwarding
-    // note that from this point on, we don't handle signals ourselves any more, but rely on the subprocess to exit
-    // properly
-    for (int i = 0; i < 32; ++i) {
-        signal(i, forwardSignal);
+    log_debug("replacing current process with runtime\n");
+    prefetch_appimage(appimage_path);
+
+    return exec_patched_runtime(runtime, appimage_path, target_args);
+}
+
+int bypassBinfmtAndRunAppImage(const std::string& appimage_path, const std::vector<char*>& target_args) {
+    // opt-in mode: replace this process with the runtime rather than supervising it in a subprocess
+    // the caller then sees the runtime's exit code and signals natively, and there's no idle process left per
+    // running AppImage
+    if (getenv("APPIMAGELAUNCHER_BINFMT_BYPASS_NO_FORK") != nullptr) {
+        return bypassBinfmtAndExecAppImage(appimage_path, target_args);
     }
 
-    // wait for child process to exit, and exit with its return code
-    int status;
-    wait(&status);
+    PreparedRuntime runtime;
 
-    // clean up
-    close(runtime_fd);
+    if (!prepare_patched_runtime(appimage_path, true, runtime)) {
+        return EXIT_CODE_FAILURE;
+    }
 
-    // calculate return code based on child's behavior
-    int child_retcode;
+    // to keep alive the memfd, we launch the AppImage as a subprocess
+    // signals are blocked before forking, so any signal sent to us in the meantime can be forwarded later
+    sigset_t forwarded_signals, original_signal_mask;
+    make_forwarded_signal_set(forwarded_signals);
+    sigprocmask(SIG_BLOCK, &forwarded_signals, &original_signal_mask);
 
-    if (WIFSIGNALED(status) != 0) {
-        child_retcode = WTERMSIG(status);
-        log_error("child exited with code %d\n", child_retcode);
-    } else if (WIFEXITED(status) != 0) {
-        child_retcode = WEXITSTATUS(status);
-        log_debug("child exited normally with code %d\n", child_retcode);
-    } else {
-        log_error("unknown error: child didn't exit with signal or regular exit code\n");
-        child_retcode = EXIT_CODE_FAILURE;
+    const pid_t subprocess_pid = fork();
+
+    if (subprocess_pid < 0) {
+        log_error("fork() failed: %s\n", strerror(errno));
+        sigprocmask(SIG_SETMASK, &original_signal_mask, nullptr);
+        return EXIT_CODE_FAILURE;
+    }
+
+    if (subprocess_pid == 0) {
+        // the runtime must receive signals normally
+        sigprocmask(SIG_SETMASK, &original_signal_mask, nullptr);
+        return exec_patched_runtime(runtime, appimage_path, target_args);
     }
 
-    return child_retcode;
+    // while the subprocess starts the runtime, we can prefetch the data it's going to need
+    prefetch_appimage(appimage_path);
+
+    // wait for child process to exit, and exit with its return code
+    const int status = supervise_subprocess(subprocess_pid, forwarded_signals);
+
+    // calculate return code based on child's behavior
+    return exit_code_from_wait_status(status);
 }
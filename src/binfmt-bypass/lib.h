@@ -1,9 +1,114 @@
 #pragma once
 
 // system headers
+#include <csignal>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
+#include <sys/types.h>
 
 #define EXIT_CODE_FAILURE 0xff
 
+class TemporaryPreloadLibFile;
+
+/**
+ * Everything needed to execute an AppImage's patched runtime.
+ * Preparing it doesn't modify the current process, therefore the runtime can also be executed by a forked child of a
+ * multithreaded process, which may only call async-signal-safe functions (see zygote_spawn(...)).
+ */
+struct PreparedRuntime {
+    // absolute path to the AppImage
+    std::string appimage_path;
+
+    // size of the runtime, i.e., the offset at which the AppImage's payload begins
+    off_t runtime_size = -1;
+
+    // read-only file descriptor of the patched runtime, close-on-exec is set
+    int runtime_fd = -1;
+
+    // file descriptor of the embedded preload library, which must be inherited by the runtime, or -1 if not used
+    int preload_lib_fd = -1;
+
+    // variables which have to be set in the runtime's environment
+    std::vector<std::pair<std::string, std::string>> env;
+
+    // only used if the preload library can't be served from memory, removed along with this object
+    std::unique_ptr<TemporaryPreloadLibFile> temporary_preload_lib_file;
+
+    PreparedRuntime();
+    ~PreparedRuntime();
+
+    PreparedRuntime(const PreparedRuntime&) = delete;
+    PreparedRuntime& operator=(const PreparedRuntime&) = delete;
+};
+
+/**
+ * Prepare executing an AppImage's patched runtime: provide the patched runtime, the preload library and the
+ * environment variables the latter needs.
+ * @param appimage_path path to AppImage
+ * @param allow_temporary_files whether the preload library may be written to a temporary file if it can neither be
+ *     found next to this binary nor be served from memory
+ * @param runtime object to fill in
+ * @return true on success, false otherwise
+ */
+bool prepare_patched_runtime(const std::string& appimage_path, bool allow_temporary_files, PreparedRuntime& runtime);
+
+/**
+ * Create a patched copy of an AppImage's runtime in memory, bypassing the runtime cache.
+ * Used if a cached runtime can't be executed.
+ * @param appimage_path path to AppImage
+ * @param runtime_size size of the runtime
+ * @return read-only file descriptor of the patched runtime, or -1 on errors
+ */
+int create_uncached_patched_runtime(const std::string& appimage_path, off_t runtime_size);
+
+/**
+ * Copy an AppImage's runtime into the given file and erase the AppImage magic bytes, so that it can be executed
+ * without being picked up by binfmt_misc again.
+ * @param fd writable file descriptor to write the patched runtime to
+ * @param appimage_filename path to AppImage
+ * @param elf_size size of the runtime
+ * @return true on success, false otherwise
+ */
+bool copy_and_patch_runtime(int fd, const char* appimage_filename, ssize_t elf_size);
+
+/**
+ * Fill the set with the signals which are forwarded to a launched runtime.
+ * SIGCHLD and SIGPIPE are part of the set, but must not be forwarded.
+ * @param set set to fill
+ */
+void make_forwarded_signal_set(sigset_t& set);
+
+/**
+ * Forward a signal to a process, using its pidfd if available.
+ * @param pid process ID
+ * @param pidfd pidfd referring to the process, or -1
+ * @param sig signal to send
+ */
+void forward_signal(pid_t pid, int pidfd, int sig);
+
+/**
+ * Calculate the exit code to report for a terminated runtime.
+ * Like shells do, signals are reported as 128 + <signal number>.
+ * @param status wait status of the runtime, -1 if unknown
+ * @return exit code
+ */
+int exit_code_from_wait_status(int status);
+
+/**
+ * Run the AppImage's patched runtime in a subprocess and wait for it to exit.
+ * If $APPIMAGELAUNCHER_BINFMT_BYPASS_NO_FORK is set, bypassBinfmtAndExecAppImage(...) is used instead.
+ * @param appimage_path path to AppImage
+ * @param target_args arguments to pass to the AppImage
+ * @return exit code
+ */
 int bypassBinfmtAndRunAppImage(const std::string& appimage_path, const std::vector<char*>& target_args);
+
+/**
+ * Replace the current process with the AppImage's patched runtime.
+ * @param appimage_path path to AppImage
+ * @param target_args arguments to pass to the AppImage
+ * @return exit code, only returns in case of errors
+ */
+int bypassBinfmtAndExecAppImage(const std::string& appimage_path, const std::vector<char*>& target_args);
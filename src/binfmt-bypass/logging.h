@@ -5,28 +5,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #ifndef COMPONENT_NAME
 #error component name undefined
 #endif
 
-inline static int v_log_message(const char* const format, va_list args) {
-    static const char prefix[] = "[appimagelauncher-binfmt-bypass/" COMPONENT_NAME "] ";
+// the prefixes are assembled by the compiler, so logging doesn't need to allocate any memory
+// this is important for the preload library, which logs from within hooks called by arbitrary applications
+#define LOG_PREFIX "[appimagelauncher-binfmt-bypass/" COMPONENT_NAME "] "
+#define LOG_PREFIX_DEBUG LOG_PREFIX "DEBUG: "
+#define LOG_PREFIX_WARNING LOG_PREFIX "WARNING: "
+#define LOG_PREFIX_ERROR LOG_PREFIX "ERROR: "
+
+// longer messages are truncated
+#define LOG_MESSAGE_BUFFER_SIZE 1024
 
-    char* patched_format = (char*) (malloc(strlen(format) + strlen(prefix) + 1));
-    strcpy(patched_format, prefix);
-    strcat(patched_format, format);
+// formats the message into a buffer on the stack and writes it to stderr along with the prefix in a single system call
+// this way, messages from different processes (e.g., the runtime and the application) don't get mixed up
+inline static int v_log_message_prefix(const char* const prefix, const size_t prefix_length, const char* const format, va_list args) {
+    char buffer[LOG_MESSAGE_BUFFER_SIZE];
 
-    return vfprintf(stderr, patched_format, args);
+    const int formatted_length = vsnprintf(buffer, sizeof(buffer), format, args);
+
+    if (formatted_length < 0) {
+        return formatted_length;
+    }
+
+    size_t message_length = (size_t) formatted_length;
+
+    // make sure truncated messages still end with a newline
+    if (message_length >= sizeof(buffer)) {
+        message_length = sizeof(buffer) - 1;
+        buffer[message_length - 1] = '\n';
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) prefix;
+    iov[0].iov_len = prefix_length;
+    iov[1].iov_base = buffer;
+    iov[1].iov_len = message_length;
+
+    return (int) writev(STDERR_FILENO, iov, 2);
 }
 
-inline static int v_log_message_prefix(const char* const prefix, const char* const format, va_list args) {
-    char* patched_format = (char*) (malloc(strlen(format) + strlen(prefix) + 2 + 1));
-    strcpy(patched_format, prefix);
-    strcat(patched_format, ": ");
-    strcat(patched_format, format);
+// the prefix must be a string literal
+#define V_LOG_MESSAGE_PREFIX(prefix, format, args) v_log_message_prefix(prefix, sizeof(prefix) - 1, format, args)
 
-    return v_log_message(patched_format, args);
+inline static int v_log_message(const char* const format, va_list args) {
+    return V_LOG_MESSAGE_PREFIX(LOG_PREFIX, format, args);
 }
 
 inline static int log_message(const char* const format, ...) {
@@ -41,14 +69,21 @@ inline static int log_message(const char* const format, ...) {
 }
 
 inline static void log_debug(const char* const format, ...) {
-    if (getenv("DEBUG") == NULL) {
+    // looking up the environment variable once is enough, log_debug is called in hot paths of the preload library
+    static int debug_enabled = -1;
+
+    if (debug_enabled < 0) {
+        debug_enabled = getenv("DEBUG") != NULL;
+    }
+
+    if (!debug_enabled) {
         return;
     }
 
     va_list args;
     va_start(args, format);
 
-    v_log_message_prefix("DEBUG", format, args);
+    V_LOG_MESSAGE_PREFIX(LOG_PREFIX_DEBUG, format, args);
 
     va_end(args);
 }
@@ -57,7 +92,7 @@ inline static void log_error(const char* const format, ...) {
     va_list args;
     va_start(args, format);
 
-    v_log_message_prefix("ERROR", format, args);
+    V_LOG_MESSAGE_PREFIX(LOG_PREFIX_ERROR, format, args);
 
     va_end(args);
 }
@@ -67,7 +102,7 @@ inline static void log_warning(const char* const format, ...) {
     va_list args;
     va_start(args, format);
 
-    v_log_message_prefix("WARNING", format, args);
+    V_LOG_MESSAGE_PREFIX(LOG_PREFIX_WARNING, format, args);
 
     va_end(args);
 }
@@ -0,0 +1,79 @@
+#pragma once
+
+// prefetch profiles list the byte ranges of an AppImage which its runtime reads during startup
+// they are recorded by the preload library and used by the bypass lib to tell the kernel to read these ranges ahead
+// of time on later launches
+// this header is shared between the preload library (C) and the bypass lib (C++), therefore it must remain valid C
+
+// system headers
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// profiles are per-host, per-user cache files, so we can just use the native byte order
+// the version must be bumped whenever the layout changes
+#define PREFETCH_PROFILE_MAGIC "AILPFP\0\0"
+#define PREFETCH_PROFILE_VERSION 1
+
+// upper limit for the number of ranges in a profile, keeps the files (and the recorder's static buffer) small
+#define PREFETCH_PROFILE_MAX_RANGES 16384
+
+// setting this environment variable enables recording a profile
+// its value may specify the number of seconds after launch during which reads are recorded
+#define PREFETCH_PROFILE_RECORD_ENV_VAR "APPIMAGELAUNCHER_RECORD_PREFETCH_PROFILE"
+#define PREFETCH_PROFILE_DEFAULT_RECORD_SECONDS 10
+
+// setting this environment variable disables the use of existing profiles
+#define PREFETCH_PROFILE_DISABLE_ENV_VAR "APPIMAGELAUNCHER_DISABLE_PREFETCH"
+
+struct prefetch_profile_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t range_count;
+};
+
+struct prefetch_profile_range {
+    uint64_t offset;
+    uint64_t length;
+};
+
+/**
+ * Calculate the path of the prefetch profile of an AppImage.
+ * The path depends on the file's identity and modification time, so modified AppImages don't use outdated profiles.
+ * @param buffer buffer to write path to
+ * @param buffer_size size of buffer
+ * @param appimage_stat stat(...) result of the AppImage
+ * @return 0 on success, -1 if the path cannot be determined or doesn't fit into the buffer
+ */
+inline static int prefetch_profile_path(char* buffer, size_t buffer_size, const struct stat* appimage_stat) {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* cache_subdir = "";
+
+    // like the runtime cache, we ignore relative paths
+    if (cache_home == NULL || cache_home[0] != '/') {
+        cache_home = getenv("HOME");
+        cache_subdir = "/.cache";
+
+        if (cache_home == NULL || cache_home[0] != '/') {
+            return -1;
+        }
+    }
+
+    const int rv = snprintf(
+        buffer, buffer_size, "%s%s/appimagelauncher/prefetch/%llx-%llx-%llx-%llx.%lx",
+        cache_home, cache_subdir,
+        (unsigned long long) appimage_stat->st_dev,
+        (unsigned long long) appimage_stat->st_ino,
+        (unsigned long long) appimage_stat->st_size,
+        (unsigned long long) appimage_stat->st_mtim.tv_sec,
+        (unsigned long) appimage_stat->st_mtim.tv_nsec
+    );
+
+    if (rv < 0 || (size_t) rv >= buffer_size) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -1,16 +1,24 @@
+// needed for statx(...) and O_TMPFILE
+#define _GNU_SOURCE
+
 // system headers
 #include <stdio.h>
 #include <dlfcn.h>
 #include <unistd.h>
 #include <memory.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
 
 // own headers
 #include "logging.h"
+#include "prefetch_profile.h"
+#include "tracing.h"
 
 // saw this trick somewhere on the Internet... don't recall where it was, but it works well
 #ifndef RTLD_NEXT
@@ -22,121 +30,353 @@
 // TODO: move into central header, it's the same value in main.cpp
 #define EXIT_CODE_FAILURE 0xff
 
+// open(...) and friends only take a mode argument if a file may be created
+#ifdef O_TMPFILE
+#define OPEN_NEEDS_MODE(flags) (((flags) & O_CREAT) != 0 || ((flags) & O_TMPFILE) == O_TMPFILE)
+#else
+#define OPEN_NEEDS_MODE(flags) (((flags) & O_CREAT) != 0)
+#endif
+
 // pointers to actual implementations in libc
 // will be initialized by __init()
-// TODO: create a macro for this pattern (DRY)
 static char* (*__libc_realpath)(const char*, char*) = NULL;
-static int (*__libc_open)(const char*, int) = NULL;
+static int (*__libc_open)(const char*, int, ...) = NULL;
+static int (*__libc_open64)(const char*, int, ...) = NULL;
+static int (*__libc_openat)(int, const char*, int, ...) = NULL;
+static FILE* (*__libc_fopen)(const char*, const char*) = NULL;
+static ssize_t (*__libc_pread)(int, void*, size_t, off_t) = NULL;
+static ssize_t (*__libc_pread64)(int, void*, size_t, off64_t) = NULL;
 static ssize_t (*__libc_readlink)(const char*, void*, size_t) = NULL;
-
-// TODO: write __init() and call that from all functions, loading all required symbols, the AppImage path etc. once
-// to improve performance
+#ifdef STATX_BASIC_STATS
+// statx(...) has been added in glibc 2.28, therefore it's optional
+static int (*__libc_statx)(int, const char*, int, unsigned int, struct statx*) = NULL;
+#endif
 
 // DRY
 static const char proc_self_exe[] = "/proc/self/exe";
 
+// absolute path to the AppImage, resolved once during initialization, so the hooks don't have to allocate any memory
+// or look up environment variables
+static char abs_appimage_path[PATH_MAX];
+static size_t abs_appimage_path_len = 0;
 
-void __init() {
-    static bool initialized = false;
+static bool initialized = false;
 
-    if (!initialized) {
-        initialized = true;
+// state of the prefetch profile recorder (see prefetch_profile.h)
+// the ranges are stored in a static buffer, so recording doesn't require any memory allocations either
+static bool recording = false;
+static volatile int recording_lock = 0;
+static struct timespec recording_deadline;
+static int recorded_fd = -1;
+static char recorded_profile_path[PATH_MAX];
+static struct prefetch_profile_range recorded_ranges[PREFETCH_PROFILE_MAX_RANGES];
+static size_t recorded_range_count = 0;
 
-        // get rid of $LD_PRELOAD in the first binary which this library is preloaded into (should be the runtime)
-        // the easiest way is to wait for one of these functions to be used, then unset it
-        unsetenv("LD_PRELOAD");
+static void __init_recording();
+static void __save_recording();
 
-        // load symbols from libc
-        __libc_readlink = (ssize_t (*) (const char*, void*, size_t)) dlsym(REAL_LIBC, "readlink");
-        __libc_realpath = (char* (*) (const char*, char*)) dlsym(REAL_LIBC, "realpath");
-        __libc_open = (int (*) (const char*, int)) dlsym(REAL_LIBC, "open");
+// loads a symbol from libc, exiting if it can't be found
+static void* __load_symbol(const char* name) {
+    void* symbol = dlsym(REAL_LIBC, name);
 
-        if (__libc_readlink == NULL || __libc_realpath == NULL || __libc_open == NULL) {
-            log_error("failed to load symbol from libc\n");
-            exit(EXIT_CODE_FAILURE);
-        }
+    if (symbol == NULL) {
+        log_error("failed to load symbol %s from libc\n", name);
+        exit(EXIT_CODE_FAILURE);
     }
+
+    return symbol;
 }
 
-char* __abs_appimage_path() {
-    __init();
+// runs when the library is loaded, i.e., before the runtime's main()
+// other libraries' constructors might call one of our hooks before this runs, therefore the hooks check whether this
+// function has been called already
+__attribute__((constructor))
+static void __init() {
+    if (initialized) {
+        return;
+    }
+
+    initialized = true;
+
+    // marks the point at which the patched runtime has been loaded
+    tracing_instant("preload init", NULL);
+
+    // get rid of $LD_PRELOAD in the first binary which this library is preloaded into (should be the runtime)
+    unsetenv("LD_PRELOAD");
+
+    // if the library has been loaded from a memfd, we have to close the file descriptor, as the application
+    // doesn't know about it
+    {
+        static const char fd_env_var_name[] = "APPIMAGELAUNCHER_PRELOAD_LIB_FD";
+        const char* fd_string = getenv(fd_env_var_name);
 
+        if (fd_string != NULL) {
+            close(atoi(fd_string));
+            unsetenv(fd_env_var_name);
+        }
+    }
+
+    // load symbols from libc
+    __libc_readlink = (ssize_t (*) (const char*, void*, size_t)) __load_symbol("readlink");
+    __libc_realpath = (char* (*) (const char*, char*)) __load_symbol("realpath");
+    __libc_open = (int (*) (const char*, int, ...)) __load_symbol("open");
+    __libc_open64 = (int (*) (const char*, int, ...)) __load_symbol("open64");
+    __libc_openat = (int (*) (int, const char*, int, ...)) __load_symbol("openat");
+    __libc_fopen = (FILE* (*) (const char*, const char*)) __load_symbol("fopen");
+    __libc_pread = (ssize_t (*) (int, void*, size_t, off_t)) __load_symbol("pread");
+    __libc_pread64 = (ssize_t (*) (int, void*, size_t, off64_t)) __load_symbol("pread64");
+#ifdef STATX_BASIC_STATS
+    __libc_statx = (int (*) (int, const char*, int, unsigned int, struct statx*)) dlsym(REAL_LIBC, "statx");
+#endif
+
+    // resolve the AppImage's path
     static const char env_var_name[] = "TARGET_APPIMAGE";
 
-    char* appimage_var = getenv(env_var_name);
+    const char* appimage_var = getenv(env_var_name);
 
     if (appimage_var == NULL || appimage_var[0] == '\0') {
-        log_error("$%s not set\n", env_var_name);
-        exit(EXIT_CODE_FAILURE);
+        // we only fail once the path is actually needed
+        log_debug("$%s not set\n", env_var_name);
+        return;
     }
 
     // make path absolute if needed (best effort, it's better to pass an absolute value)
     if (appimage_var[0] != '/') {
         log_warning("$%s value is not absolute, trying to make it absolute\n", env_var_name);
 
-        char* abspath = calloc(PATH_MAX, sizeof(char));
-
-        if (readlink(appimage_var, abspath, sizeof(abspath)) == -1) {
-            log_error("readlink failed on %s: %s\n", appimage_var, strerror(errno));
-            exit(EXIT_CODE_FAILURE);
+        if (__libc_realpath(appimage_var, abs_appimage_path) == NULL) {
+            log_error("realpath failed on %s: %s\n", appimage_var, strerror(errno));
+            abs_appimage_path[0] = '\0';
+            return;
+        }
+    } else {
+        if (strlen(appimage_var) >= sizeof(abs_appimage_path)) {
+            log_error("$%s value too long\n", env_var_name);
+            return;
         }
 
-        return abspath;
+        strcpy(abs_appimage_path, appimage_var);
     }
 
-    return strdup(appimage_var);
+    abs_appimage_path_len = strlen(abs_appimage_path);
+
+    if (getenv(PREFETCH_PROFILE_RECORD_ENV_VAR) != NULL) {
+        __init_recording();
+    }
 }
 
-__attribute__((visibility ("default")))
-extern ssize_t readlink(const char* path, char* buf, size_t len) {
-    __init();
+static void __init_recording() {
+    struct stat appimage_stat;
 
-    log_debug("readlink %s, len %ld\n", path, len);
+    if (stat(abs_appimage_path, &appimage_stat) != 0 ||
+        prefetch_profile_path(recorded_profile_path, sizeof(recorded_profile_path), &appimage_stat) != 0) {
+        log_warning("cannot record prefetch profile\n");
+        return;
+    }
+
+    long seconds = atol(getenv(PREFETCH_PROFILE_RECORD_ENV_VAR));
 
-    if (strncmp(path, proc_self_exe, strlen(proc_self_exe)) == 0) {
-        char* abspath = __abs_appimage_path();
+    if (seconds <= 0) {
+        seconds = PREFETCH_PROFILE_DEFAULT_RECORD_SECONDS;
+    }
 
-        log_debug("redirecting readlink to %s\n", abspath);
+    clock_gettime(CLOCK_MONOTONIC, &recording_deadline);
+    recording_deadline.tv_sec += seconds;
 
-        size_t ret = strlen(abspath);
+    log_debug("recording prefetch profile for %ld seconds\n", seconds);
+    recording = true;
+}
 
-        strncpy(buf, abspath, ret);
+static void __lock_recording() {
+    while (__sync_lock_test_and_set(&recording_lock, 1)) {
+        // spin, the critical sections are tiny
+    }
+}
 
-        log_debug("buf: %s, len: %ld\n", buf, ret);
+static void __unlock_recording() {
+    __sync_lock_release(&recording_lock);
+}
 
-        free(abspath);
-        return ret;
+// remembers the file descriptor if it refers to the AppImage
+static void __track_open(const char* path, int fd) {
+    if (!recording || fd < 0 || path == NULL) {
+        return;
     }
 
-    return __libc_readlink(path, buf, len);
+    if (path == abs_appimage_path || strcmp(path, abs_appimage_path) == 0) {
+        log_debug("recording reads from fd %d\n", fd);
+        recorded_fd = fd;
+    }
+}
+
+static void __record_read(int fd, off64_t offset, ssize_t length) {
+    if (!recording || fd != recorded_fd || length <= 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (now.tv_sec > recording_deadline.tv_sec ||
+        (now.tv_sec == recording_deadline.tv_sec && now.tv_nsec >= recording_deadline.tv_nsec)) {
+        __save_recording();
+        return;
+    }
+
+    __lock_recording();
+
+    // the profile might have been saved by another thread in the meantime
+    if (!recording) {
+        __unlock_recording();
+        return;
+    }
+
+    // squashfs images are mostly read sequentially, so merging with the previous range keeps the profile small
+    struct prefetch_profile_range* last = recorded_range_count > 0 ? &recorded_ranges[recorded_range_count - 1] : NULL;
+
+    if (last != NULL && (uint64_t) offset >= last->offset && (uint64_t) offset <= last->offset + last->length) {
+        const uint64_t end = (uint64_t) offset + (uint64_t) length;
+
+        if (end > last->offset + last->length) {
+            last->length = end - last->offset;
+        }
+    } else if (recorded_range_count < PREFETCH_PROFILE_MAX_RANGES) {
+        recorded_ranges[recorded_range_count].offset = (uint64_t) offset;
+        recorded_ranges[recorded_range_count].length = (uint64_t) length;
+        ++recorded_range_count;
+    }
+
+    __unlock_recording();
+}
+
+static int __compare_ranges(const void* a, const void* b) {
+    const uint64_t offset_a = ((const struct prefetch_profile_range*) a)->offset;
+    const uint64_t offset_b = ((const struct prefetch_profile_range*) b)->offset;
+    return offset_a < offset_b ? -1 : (offset_a > offset_b ? 1 : 0);
+}
+
+// sorts and merges the recorded ranges and writes them to the profile file
+// the runtime forks, so this might be called in more than one process; the profile is replaced atomically, though
+__attribute__((destructor))
+static void __save_recording() {
+    __lock_recording();
+
+    if (!recording || recorded_range_count == 0) {
+        recording = false;
+        __unlock_recording();
+        return;
+    }
+
+    recording = false;
+
+    qsort(recorded_ranges, recorded_range_count, sizeof(recorded_ranges[0]), __compare_ranges);
+
+    size_t merged_count = 1;
+
+    for (size_t i = 1; i < recorded_range_count; ++i) {
+        struct prefetch_profile_range* last = &recorded_ranges[merged_count - 1];
+        const struct prefetch_profile_range* current = &recorded_ranges[i];
+
+        if (current->offset <= last->offset + last->length) {
+            if (current->offset + current->length > last->offset + last->length) {
+                last->length = current->offset + current->length - last->offset;
+            }
+        } else {
+            recorded_ranges[merged_count++] = *current;
+        }
+    }
+
+    __unlock_recording();
+
+    // create the directories if needed, the cache dir itself should exist on any reasonable system
+    {
+        char dir_path[PATH_MAX];
+        strcpy(dir_path, recorded_profile_path);
+
+        char* prefetch_dir_end = strrchr(dir_path, '/');
+        *prefetch_dir_end = '\0';
+        char* appimagelauncher_dir_end = strrchr(dir_path, '/');
+
+        *appimagelauncher_dir_end = '\0';
+        mkdir(dir_path, 0700);
+        *appimagelauncher_dir_end = '/';
+        mkdir(dir_path, 0700);
+    }
+
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", recorded_profile_path);
+
+    const int fd = mkostemp(temp_path, O_CLOEXEC);
+
+    if (fd < 0) {
+        log_warning("failed to create prefetch profile: %s\n", strerror(errno));
+        return;
+    }
+
+    struct prefetch_profile_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PREFETCH_PROFILE_MAGIC, sizeof(header.magic));
+    header.version = PREFETCH_PROFILE_VERSION;
+    header.range_count = (uint32_t) merged_count;
+
+    const size_t ranges_size = merged_count * sizeof(recorded_ranges[0]);
+
+    const bool success = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                         write(fd, recorded_ranges, ranges_size) == (ssize_t) ranges_size;
+
+    if (close(fd) != 0 || !success || rename(temp_path, recorded_profile_path) != 0) {
+        log_warning("failed to write prefetch profile\n");
+        unlink(temp_path);
+        return;
+    }
+
+    log_debug("saved prefetch profile with %zu ranges to %s\n", merged_count, recorded_profile_path);
+}
+
+// returns the path to use instead of the given one, or the given path if it doesn't need to be redirected
+static const char* __redirect_path(const char* path) {
+    if (path == NULL || strcmp(path, proc_self_exe) != 0) {
+        return path;
+    }
+
+    if (abs_appimage_path_len == 0) {
+        log_error("path to AppImage unknown, cannot redirect %s\n", proc_self_exe);
+        exit(EXIT_CODE_FAILURE);
+    }
+
+    log_debug("redirecting %s to %s\n", path, abs_appimage_path);
+    return abs_appimage_path;
 }
 
 __attribute__((visibility ("default")))
-extern char* realpath(const char* name, char* resolved) {
+extern ssize_t readlink(const char* path, char* buf, size_t len) {
     __init();
 
-    log_debug("realpath %s, %s\n", name, resolved);
+    if (__redirect_path(path) != path) {
+        // like the original, we neither append a null byte nor report truncation
+        const size_t ret = abs_appimage_path_len < len ? abs_appimage_path_len : len;
+        memcpy(buf, abs_appimage_path, ret);
+        return (ssize_t) ret;
+    }
 
-    if (strncmp(name, proc_self_exe, strlen(proc_self_exe)) == 0) {
-        char* appimage = __abs_appimage_path();
+    return __libc_readlink(path, buf, len);
+}
 
-        log_debug("changing realpath destination to %s\n", appimage);
+__attribute__((visibility ("default")))
+extern char* realpath(const char* name, char* resolved) {
+    __init();
 
+    if (__redirect_path(name) != name) {
+        // the caller expects a buffer allocated with malloc(...) if they don't pass their own
         if (resolved == NULL) {
-            resolved = appimage;
-        } else {
-            strncpy(resolved, appimage, PATH_MAX);
-            free(appimage);
+            return strdup(abs_appimage_path);
         }
 
+        memcpy(resolved, abs_appimage_path, abs_appimage_path_len + 1);
         return resolved;
     }
 
-    char* retval = __libc_realpath(name, resolved);
-
-    log_debug("realpath result: %s -> %s, retval %s\n", name, resolved, retval);
-
-    return retval;
+    return __libc_realpath(name, resolved);
 }
 
 // used by squashfuse, specifically util.c/sqfs_fd_open
@@ -144,21 +384,104 @@ __attribute__((visibility ("default")))
 extern int open(const char* file, int flags, ...) {
     __init();
 
-    log_debug("open(%s, %d)\n", file, flags);
+    mode_t mode = 0;
+
+    if (OPEN_NEEDS_MODE(flags)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    const char* path = __redirect_path(file);
+    const int fd = __libc_open(path, flags, mode);
 
-    char* abspath = NULL;
+    __track_open(path, fd);
+    return fd;
+}
 
-    if (strncmp(file, proc_self_exe, strlen(proc_self_exe)) == 0) {
-        abspath = __abs_appimage_path();
-        log_debug("redirecting open to %s\n", abspath);
-        file = abspath;
+__attribute__((visibility ("default")))
+extern int open64(const char* file, int flags, ...) {
+    __init();
+
+    mode_t mode = 0;
+
+    if (OPEN_NEEDS_MODE(flags)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
     }
 
-    int result = __libc_open(file, flags);
+    const char* path = __redirect_path(file);
+    const int fd = __libc_open64(path, flags, mode);
+
+    __track_open(path, fd);
+    return fd;
+}
+
+// /proc/self/exe is an absolute path, therefore we can ignore the directory file descriptor
+__attribute__((visibility ("default")))
+extern int openat(int dirfd, const char* file, int flags, ...) {
+    __init();
+
+    mode_t mode = 0;
+
+    if (OPEN_NEEDS_MODE(flags)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    const char* path = __redirect_path(file);
+    const int fd = __libc_openat(dirfd, path, flags, mode);
+
+    __track_open(path, fd);
+    return fd;
+}
+
+__attribute__((visibility ("default")))
+extern FILE* fopen(const char* file, const char* mode) {
+    __init();
+
+    return __libc_fopen(__redirect_path(file), mode);
+}
 
-    if (abspath != NULL) {
-        free(abspath);
+#ifdef STATX_BASIC_STATS
+__attribute__((visibility ("default")))
+extern int statx(int dirfd, const char* path, int flags, unsigned int mask, struct statx* buf) {
+    __init();
+
+    if (__libc_statx == NULL) {
+        errno = ENOSYS;
+        return -1;
     }
 
-    return result;
+    // when asked for information about the symlink itself, there's nothing to redirect
+    if ((flags & AT_SYMLINK_NOFOLLOW) == 0) {
+        path = __redirect_path(path);
+    }
+
+    return __libc_statx(dirfd, path, flags, mask, buf);
+}
+#endif
+
+// used by squashfuse to read the image, needed for recording prefetch profiles
+__attribute__((visibility ("default")))
+extern ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    __init();
+
+    const ssize_t rv = __libc_pread(fd, buf, count, offset);
+    __record_read(fd, offset, rv);
+    return rv;
+}
+
+__attribute__((visibility ("default")))
+extern ssize_t pread64(int fd, void* buf, size_t count, off64_t offset) {
+    __init();
+
+    const ssize_t rv = __libc_pread64(fd, buf, count, offset);
+    __record_read(fd, offset, rv);
+    return rv;
 }
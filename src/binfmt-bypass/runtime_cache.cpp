@@ -0,0 +1,436 @@
+// system headers
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+// own headers
+#include "runtime_cache.h"
+#include "lib.h"
+#include "logging.h"
+
+// offset and length of the magic bytes which are erased in the patched runtime
+#define MAGIC_BYTES_OFFSET 8
+#define MAGIC_BYTES_LENGTH 3
+
+// entries which no AppImage has been linked to for this long are removed
+#define UNUSED_ENTRY_MAX_AGE_SECS (7 * 24 * 60 * 60)
+
+namespace {
+    // simple, fast non-cryptographic hash processing 8 bytes at a time (FNV-1a style mixing with an additional
+    // avalanche step)
+    // it's only used to identify runtimes, which are created by the user anyway, it doesn't need to withstand attacks
+    class RuntimeHash {
+    public:
+        void update(const unsigned char* data, size_t size) {
+            while (size >= sizeof(uint64_t)) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                mix(word);
+
+                data += sizeof(word);
+                size -= sizeof(word);
+            }
+
+            // remaining bytes
+            uint64_t word = 0;
+            memcpy(&word, data, size);
+            mix(word ^ (uint64_t(size) << 56));
+        }
+
+        uint64_t digest() const {
+            uint64_t h = _state;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return h;
+        }
+
+    private:
+        void mix(uint64_t word) {
+            _state ^= word;
+            _state *= 0x100000001b3ull;
+            _state ^= _state >> 29;
+        }
+
+        uint64_t _state = 0xcbf29ce484222325ull;
+    };
+
+    // calculate the hash of the patched runtime, i.e., with the magic bytes set to zero
+    // the first block is hashed separately, so the source data doesn't need to be modified
+    uint64_t hash_patched_runtime(const unsigned char* data, size_t size) {
+        static_assert(MAGIC_BYTES_OFFSET + MAGIC_BYTES_LENGTH <= 16, "magic bytes must be within first block");
+
+        RuntimeHash hash;
+
+        unsigned char first_block[16]{};
+        const auto first_block_size = size < sizeof(first_block) ? size : sizeof(first_block);
+
+        memcpy(first_block, data, first_block_size);
+        memset(first_block + MAGIC_BYTES_OFFSET, 0, MAGIC_BYTES_LENGTH);
+
+        hash.update(first_block, first_block_size);
+        hash.update(data + first_block_size, size - first_block_size);
+
+        return hash.digest();
+    }
+
+    // read-only mapping of the first size bytes of a file
+    class FileMapping {
+    public:
+        FileMapping(int fd, off_t size) : _size(static_cast<size_t>(size)) {
+            _data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (_data == MAP_FAILED) {
+                log_error("failed to map runtime: %s\n", strerror(errno));
+                _data = nullptr;
+            }
+        }
+
+        ~FileMapping() {
+            if (_data != nullptr) {
+                munmap(_data, _size);
+            }
+        }
+
+        FileMapping(const FileMapping&) = delete;
+        FileMapping& operator=(const FileMapping&) = delete;
+
+        const unsigned char* data() const {
+            return static_cast<const unsigned char*>(_data);
+        }
+
+    private:
+        void* _data;
+        size_t _size;
+    };
+
+    // compares a cache entry byte by byte with the patched version of the original runtime
+    // the hash used as the entry's key is not collision resistant, so entries must not be trusted on the key alone
+    bool entry_matches_runtime(int entry_fd, const unsigned char* runtime, off_t runtime_size) {
+        const FileMapping entry(entry_fd, runtime_size);
+
+        if (entry.data() == nullptr) {
+            return false;
+        }
+
+        const auto size = static_cast<size_t>(runtime_size);
+
+        unsigned char first_block[16]{};
+        const auto first_block_size = size < sizeof(first_block) ? size : sizeof(first_block);
+
+        memcpy(first_block, runtime, first_block_size);
+        memset(first_block + MAGIC_BYTES_OFFSET, 0, MAGIC_BYTES_LENGTH);
+
+        return memcmp(entry.data(), first_block, first_block_size) == 0 &&
+               memcmp(entry.data() + first_block_size, runtime + first_block_size, size - first_block_size) == 0;
+    }
+
+    // name of the by-id link of an AppImage
+    std::string make_id_name(const struct stat& appimage_st, off_t runtime_size) {
+        char id_name[160];
+        snprintf(
+            id_name, sizeof(id_name), "%llx-%llx-%lld-%lld.%09ld-%lld",
+            (unsigned long long) appimage_st.st_dev, (unsigned long long) appimage_st.st_ino,
+            (long long) appimage_st.st_size, (long long) appimage_st.st_mtim.tv_sec, appimage_st.st_mtim.tv_nsec,
+            (long long) runtime_size
+        );
+        return id_name;
+    }
+
+    // every by-id link has a symlink next to it (suffix .path) pointing to the AppImage it has been created for
+    // links whose AppImages have been changed or removed are removed, as well as entries which no AppImage has been
+    // linked to for a while; only the directory listings and an inode per entry are read, the runtimes aren't
+    void sweep_cache(const std::string& cache_dir) {
+        const auto by_id_dir = cache_dir + "/by-id";
+
+        if (DIR* dir = opendir(by_id_dir.c_str())) {
+            while (const auto* dirent = readdir(dir)) {
+                const std::string name = dirent->d_name;
+                static const std::string path_suffix = ".path";
+
+                if (name == "." || name == ".." || (name.size() > path_suffix.size() &&
+                    name.compare(name.size() - path_suffix.size(), path_suffix.size(), path_suffix) == 0)) {
+                    continue;
+                }
+
+                const auto link_path = by_id_dir + "/" + name;
+                const auto path_link_path = link_path + path_suffix;
+
+                char appimage_path[PATH_MAX];
+                const auto length = readlink(path_link_path.c_str(), appimage_path, sizeof(appimage_path) - 1);
+
+                struct stat appimage_st{};
+                bool current = false;
+
+                if (length > 0) {
+                    appimage_path[length] = '\0';
+
+                    const auto separator = name.rfind('-');
+                    const auto runtime_size = separator == std::string::npos ? 0 : atoll(name.c_str() + separator + 1);
+
+                    current = stat(appimage_path, &appimage_st) == 0 &&
+                              make_id_name(appimage_st, runtime_size) == name;
+                }
+
+                if (!current) {
+                    log_debug("removing stale runtime cache link %s\n", link_path.c_str());
+                    unlinkat(dirfd(dir), name.c_str(), 0);
+                    unlinkat(dirfd(dir), (name + path_suffix).c_str(), 0);
+                }
+            }
+
+            closedir(dir);
+        }
+
+        if (DIR* dir = opendir(cache_dir.c_str())) {
+            const auto now = time(nullptr);
+
+            while (const auto* dirent = readdir(dir)) {
+                const std::string name = dirent->d_name;
+
+                // temporary files (see create_cache_entry(...)) contain a dot
+                if (name == "." || name == ".." || name == "by-id") {
+                    continue;
+                }
+
+                struct stat st{};
+
+                if (fstatat(dirfd(dir), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+                    continue;
+                }
+
+                // removing the last by-id link updates the entry's ctime
+                const bool unused = st.st_nlink == 1 || name.find('.') != std::string::npos;
+
+                if (unused && now - st.st_ctime > UNUSED_ENTRY_MAX_AGE_SECS) {
+                    log_debug("removing unused runtime cache entry %s\n", name.c_str());
+                    unlinkat(dirfd(dir), name.c_str(), 0);
+                }
+            }
+
+            closedir(dir);
+        }
+    }
+
+    std::string runtime_cache_dir() {
+        const char* cache_home = getenv("XDG_CACHE_HOME");
+
+        if (cache_home != nullptr && cache_home[0] == '/') {
+            return std::string(cache_home) + "/appimagelauncher/runtimes";
+        }
+
+        const char* home = getenv("HOME");
+
+        if (home == nullptr || home[0] != '/') {
+            return "";
+        }
+
+        return std::string(home) + "/.cache/appimagelauncher/runtimes";
+    }
+
+    // creates the directory and its parent directories, if necessary
+    bool make_cache_dir(const std::string& path) {
+        const auto by_id = path + "/by-id";
+        const auto parent = path.substr(0, path.rfind('/'));
+
+        for (const auto& dir : {parent, path, by_id}) {
+            if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+                log_debug("could not create directory %s: %s\n", dir.c_str(), strerror(errno));
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // files on file systems mounted with noexec can't be executed, so there's no point in caching runtimes there
+    // returns false if the mount options can't be determined (e.g., because the directory doesn't exist yet)
+    bool cache_dir_is_noexec(const std::string& path) {
+        struct statvfs st{};
+
+        if (statvfs(path.c_str(), &st) != 0) {
+            return false;
+        }
+
+        return (st.f_flag & ST_NOEXEC) != 0;
+    }
+
+    // opens and verifies a cache entry
+    // the contents are not verified, nobody but the user can modify the entries anyway
+    int open_cache_entry(const std::string& path, off_t runtime_size) {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+
+        if (fd < 0) {
+            return -1;
+        }
+
+        // only trust files which nobody but us could have modified
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 022) != 0 ||
+            st.st_size != runtime_size) {
+            log_warning("ignoring invalid runtime cache entry %s\n", path.c_str());
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    // adds the patched runtime to the cache
+    // the entry is created in a temporary file and moved into place atomically, so concurrent launches never see
+    // incomplete files
+    bool create_cache_entry(const std::string& entry_path, const std::string& appimage_path, off_t runtime_size) {
+        auto temp_path = entry_path + ".XXXXXX";
+        const int temp_fd = mkostemp(&temp_path[0], O_CLOEXEC);
+
+        if (temp_fd < 0) {
+            log_debug("could not create temporary file in runtime cache: %s\n", strerror(errno));
+            return false;
+        }
+
+        bool success = copy_and_patch_runtime(temp_fd, appimage_path.c_str(), runtime_size) &&
+                       fchmod(temp_fd, 0500) == 0;
+
+        // we must not keep a writable file descriptor open, otherwise exec() would fail with ETXTBSY
+        if (close(temp_fd) != 0) {
+            success = false;
+        }
+
+        if (!success || rename(temp_path.c_str(), entry_path.c_str()) != 0) {
+            log_warning("failed to add runtime to cache\n");
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        log_debug("added runtime to cache: %s\n", entry_path.c_str());
+        return true;
+    }
+}
+
+int open_cached_patched_runtime(const std::string& appimage_path, off_t runtime_size) {
+    if (getenv("APPIMAGELAUNCHER_DISABLE_RUNTIME_CACHE") != nullptr) {
+        return -1;
+    }
+
+    const auto cache_dir = runtime_cache_dir();
+
+    if (cache_dir.empty()) {
+        return -1;
+    }
+
+    if (cache_dir_is_noexec(cache_dir)) {
+        log_debug("runtime cache %s is on a noexec mount, not using it\n", cache_dir.c_str());
+        return -1;
+    }
+
+    const int appimage_fd = open(appimage_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (appimage_fd < 0) {
+        return -1;
+    }
+
+    struct stat appimage_st{};
+    if (fstat(appimage_fd, &appimage_st) != 0) {
+        close(appimage_fd);
+        return -1;
+    }
+
+    // the by-id entries are hard links to the content addressed entries, named after the AppImage file's identity
+    // this way, AppImages launched before are looked up without reading their runtimes
+    // the entries are verified before they are linked, so the links can be trusted
+    const auto id_path = cache_dir + "/by-id/" + make_id_name(appimage_st, runtime_size);
+
+    // fast path: this AppImage has been launched before
+    {
+        const int fd = open_cache_entry(id_path, runtime_size);
+
+        if (fd >= 0) {
+            close(appimage_fd);
+            log_debug("using cached runtime %s\n", id_path.c_str());
+            return fd;
+        }
+    }
+
+    // calculate the key of the patched runtime from the original one
+    // the mapping stays around to verify the entry
+    const FileMapping runtime(appimage_fd, runtime_size);
+    close(appimage_fd);
+
+    if (runtime.data() == nullptr) {
+        return -1;
+    }
+
+    const auto hash = hash_patched_runtime(runtime.data(), runtime_size);
+
+    if (!make_cache_dir(cache_dir)) {
+        return -1;
+    }
+
+    // the directory might not have existed before
+    if (cache_dir_is_noexec(cache_dir)) {
+        log_debug("runtime cache %s is on a noexec mount, not using it\n", cache_dir.c_str());
+        return -1;
+    }
+
+    char entry_name[64];
+    snprintf(entry_name, sizeof(entry_name), "%016llx-%lld", (unsigned long long) hash, (long long) runtime_size);
+
+    const auto entry_path = cache_dir + "/" + entry_name;
+
+    int fd = open_cache_entry(entry_path, runtime_size);
+
+    if (fd < 0) {
+        if (!create_cache_entry(entry_path, appimage_path, runtime_size)) {
+            return -1;
+        }
+
+        fd = open_cache_entry(entry_path, runtime_size);
+
+        if (fd < 0) {
+            return -1;
+        }
+    } else {
+        log_debug("using cached runtime %s\n", entry_path.c_str());
+    }
+
+    if (!entry_matches_runtime(fd, runtime.data(), runtime_size)) {
+        log_warning("runtime cache entry %s doesn't match the AppImage's runtime, not using it\n", entry_path.c_str());
+        close(fd);
+        return -1;
+    }
+
+    // a concurrent launch may have linked the entry already, in which case there's nothing left to do
+    if (link(entry_path.c_str(), id_path.c_str()) != 0 && errno != EEXIST) {
+        log_debug("could not link runtime cache entry to %s: %s\n", id_path.c_str(), strerror(errno));
+    }
+
+    // the sweep needs to know which AppImage the link belongs to
+    std::unique_ptr<char, decltype(&free)> absolute_appimage_path(realpath(appimage_path.c_str(), nullptr), &free);
+
+    if (absolute_appimage_path != nullptr) {
+        const auto path_link_path = id_path + ".path";
+        unlink(path_link_path.c_str());
+
+        if (symlink(absolute_appimage_path.get(), path_link_path.c_str()) != 0) {
+            log_debug("could not create %s: %s\n", path_link_path.c_str(), strerror(errno));
+        }
+    }
+
+    // new links are only created when an AppImage is launched for the first time or has changed, which is also when
+    // old ones become stale
+    sweep_cache(cache_dir);
+
+    return fd;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// system headers
+#include <string>
+#include <sys/types.h>
+
+/**
+ * Look up the patched version of an AppImage's runtime in the per-user runtime cache, adding it if necessary.
+ * Most AppImages use one of a handful of upstream runtimes, so this saves copying and patching the runtime on
+ * every launch.
+ * Entries are keyed by a hash of the patched runtime's contents. Once an AppImage has been launched, its entry is also
+ * linked under the AppImage file's identity (device, inode, size and modification time), so subsequent launches don't
+ * need to read and hash the runtime.
+ * The cache is not used if it resides on a file system mounted with noexec.
+ * The cache can be disabled by setting $APPIMAGELAUNCHER_DISABLE_RUNTIME_CACHE.
+ * @param appimage_path path to AppImage
+ * @param runtime_size size of the AppImage's runtime
+ * @return read-only file descriptor (with close-on-exec set) of the cached runtime, or -1 if the cache can't be used
+ */
+int open_cached_patched_runtime(const std::string& appimage_path, off_t runtime_size);
@@ -0,0 +1,663 @@
+// system headers
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// own headers
+#include "lib.h"
+#include "logging.h"
+#include "zygote.h"
+
+namespace {
+    // reads or writes the entire buffer, retrying on short transfers and interruptions
+    template<typename F>
+    bool transfer_all(F&& transfer, char* buffer, size_t size) {
+        while (size > 0) {
+            const auto rv = transfer(buffer, size);
+
+            if (rv < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (rv <= 0) {
+                return false;
+            }
+
+            buffer += rv;
+            size -= static_cast<size_t>(rv);
+        }
+
+        return true;
+    }
+
+    bool read_all(const int fd, void* buffer, const size_t size) {
+        return transfer_all([fd](char* data, size_t count) {
+            return read(fd, data, count);
+        }, static_cast<char*>(buffer), size);
+    }
+
+    bool write_all(const int fd, const void* buffer, const size_t size) {
+        // the peer may have gone away already, which must not kill us with SIGPIPE
+        return transfer_all([fd](char* data, size_t count) {
+            return send(fd, data, count, MSG_NOSIGNAL);
+        }, static_cast<char*>(const_cast<void*>(buffer)), size);
+    }
+
+    void append_string(std::string& payload, const char* const str) {
+        payload.append(str);
+        payload.push_back('\0');
+    }
+
+    bool make_sockaddr(const std::string& path, sockaddr_un& addr) {
+        addr = {};
+        addr.sun_family = AF_UNIX;
+
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return true;
+    }
+
+    // sends the request header along with the caller's stdio file descriptors, followed by the strings
+    bool send_request(const int fd, const std::string& appimage_path, const std::vector<char*>& target_args) {
+        std::string payload;
+
+        char cwd[PATH_MAX];
+
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+            log_debug("getcwd failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        append_string(payload, appimage_path.c_str());
+        append_string(payload, cwd);
+
+        for (const auto* arg : target_args) {
+            append_string(payload, arg);
+        }
+
+        uint32_t env_count = 0;
+
+        for (auto* var = environ; *var != nullptr; ++var) {
+            append_string(payload, *var);
+            ++env_count;
+        }
+
+        if (payload.size() > ZYGOTE_MAX_PAYLOAD_SIZE) {
+            log_debug("request too large for zygote\n");
+            return false;
+        }
+
+        zygote_request_header header{
+            ZYGOTE_PROTOCOL_VERSION,
+            static_cast<uint32_t>(target_args.size()),
+            env_count,
+            static_cast<uint32_t>(payload.size()),
+        };
+
+        const int stdio_fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+        iovec iov{&header, sizeof(header)};
+
+        union {
+            char buffer[CMSG_SPACE(sizeof(stdio_fds))];
+            cmsghdr align;
+        } control{};
+
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        auto* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(stdio_fds));
+        memcpy(CMSG_DATA(cmsg), stdio_fds, sizeof(stdio_fds));
+
+        ssize_t rv;
+
+        do {
+            rv = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (rv < 0 && errno == EINTR);
+
+        if (rv != sizeof(header)) {
+            log_debug("failed to send request to zygote: %s\n", strerror(errno));
+            return false;
+        }
+
+        return write_all(fd, payload.data(), payload.size());
+    }
+
+    // waits for the launched process to exit, forwarding all signals we receive in the meantime
+    // returns the process's wait status, or -1 on errors
+    int wait_for_launched_process(const int fd, const pid_t pid, const sigset_t& forwarded_signals) {
+        const int sfd = signalfd(-1, &forwarded_signals, SFD_CLOEXEC);
+
+        if (sfd < 0) {
+            log_error("signalfd failed, cannot forward signals: %s\n", strerror(errno));
+        }
+
+        // the launched process is not our child, so a pidfd is the only race free way to send signals to it
+        int pidfd = -1;
+
+#ifdef SYS_pidfd_open
+        pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+
+        int status = -1;
+
+        for (;;) {
+            pollfd fds[2] = {
+                {fd, POLLIN, 0},
+                {sfd, POLLIN, 0},
+            };
+
+            if (poll(fds, sfd >= 0 ? 2 : 1, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                log_error("poll failed: %s\n", strerror(errno));
+                break;
+            }
+
+            if (sfd >= 0 && (fds[1].revents & POLLIN) != 0) {
+                signalfd_siginfo info{};
+
+                if (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                    const auto sig = static_cast<int>(info.ssi_signo);
+
+                    if (sig != SIGCHLD && sig != SIGPIPE) {
+                        forward_signal(pid, pidfd, sig);
+                    }
+                }
+            }
+
+            if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                zygote_reply reply{};
+
+                if (!read_all(fd, &reply, sizeof(reply)) || reply.type != ZYGOTE_REPLY_EXITED) {
+                    log_error("lost connection to zygote, cannot determine exit code of process %ld\n", (long) pid);
+                    break;
+                }
+
+                status = reply.value;
+                break;
+            }
+        }
+
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+
+        if (sfd >= 0) {
+            close(sfd);
+        }
+
+        return status;
+    }
+
+    // closes the file descriptors in the range [first_fd, last_fd]
+    // only calls async-signal-safe functions, like everything else which is called in the zygote's children
+    void close_fd_range(const int first_fd, const unsigned int last_fd, const long max_fd) {
+        if (first_fd < 0 || static_cast<unsigned int>(first_fd) > last_fd) {
+            return;
+        }
+
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, first_fd, last_fd, 0) == 0) {
+            return;
+        }
+#endif
+
+        for (long fd = first_fd; fd < max_fd && static_cast<unsigned long>(fd) <= last_fd; ++fd) {
+            close(static_cast<int>(fd));
+        }
+    }
+
+    // closes all file descriptors from first_fd on, except for the ones listed in keep_fds (sorted, -1 entries are
+    // ignored)
+    void close_fds_except(const int first_fd, const int* keep_fds, const size_t keep_fds_count, const long max_fd) {
+        int next_fd = first_fd;
+
+        for (size_t i = 0; i < keep_fds_count; ++i) {
+            if (keep_fds[i] < next_fd) {
+                continue;
+            }
+
+            close_fd_range(next_fd, static_cast<unsigned int>(keep_fds[i] - 1), max_fd);
+            next_fd = keep_fds[i] + 1;
+        }
+
+        close_fd_range(next_fd, ~0U, max_fd);
+    }
+
+    // builds the launched process's environment: the client's, plus the variables the runtime needs
+    std::vector<std::string> make_environment(const ZygoteRequest& request, const PreparedRuntime& runtime) {
+        auto overrides = runtime.env;
+
+        // same as AppImageLauncher does before launching an AppImage: suppress desktop integration scripts
+        overrides.emplace_back("DESKTOPINTEGRATION", "AppImageLauncher");
+
+        std::vector<std::string> env;
+
+        for (const auto& var : request.env) {
+            const auto name = var.substr(0, var.find('='));
+
+            const auto overridden = std::any_of(overrides.begin(), overrides.end(), [&name](const auto& override) {
+                return override.first == name;
+            });
+
+            if (!overridden) {
+                env.push_back(var);
+            }
+        }
+
+        for (const auto& override : overrides) {
+            env.push_back(override.first + "=" + override.second);
+        }
+
+        return env;
+    }
+
+    // makes a null terminated array of pointers to the strings, which must outlive the array
+    std::vector<char*> make_string_array(const std::vector<std::string>& strings) {
+        std::vector<char*> array;
+
+        for (const auto& string : strings) {
+            array.push_back(const_cast<char*>(string.c_str()));
+        }
+
+        array.push_back(nullptr);
+        return array;
+    }
+
+    // forks a child which executes the runtime
+    // the caller is typically multithreaded, therefore the child must not call anything but async-signal-safe
+    // functions: other threads may have held locks (e.g., malloc's) at the time of the fork, which are never released
+    // in the child
+    // the child waits until on_forked has been called, so it can be moved to another cgroup before it creates any
+    // processes on its own
+    // waits until the runtime has been executed, which is reported through a close-on-exec pipe
+    // returns the child's process ID, or -1 if either forking or executing the runtime failed (errno is set then)
+    pid_t spawn_runtime(const ZygoteRequest& request, const int runtime_fd, const int preload_lib_fd, char* const* argv,
+                        char* const* envp, const std::function<void(pid_t)>& on_forked) {
+        int error_pipe[2];
+        int start_pipe[2];
+
+        if (pipe2(error_pipe, O_CLOEXEC) != 0) {
+            return -1;
+        }
+
+        if (pipe2(start_pipe, O_CLOEXEC) != 0) {
+            close(error_pipe[0]);
+            close(error_pipe[1]);
+            return -1;
+        }
+
+        // everything the child needs is calculated before forking
+        const auto max_fd = sysconf(_SC_OPEN_MAX);
+        const auto* cwd = request.cwd.c_str();
+
+        int keep_fds[] = {runtime_fd, preload_lib_fd, error_pipe[1], start_pipe[0]};
+        std::sort(std::begin(keep_fds), std::end(keep_fds));
+
+        // fallback for kernels without execveat(...), which requires /proc
+        char runtime_proc_path[64];
+        snprintf(runtime_proc_path, sizeof(runtime_proc_path), "/proc/self/fd/%d", runtime_fd);
+
+        const auto pid = fork();
+
+        if (pid == 0) {
+            const int error_fd = error_pipe[1];
+
+            auto fail = [error_fd]() {
+                const int error = errno;
+                const auto rv = write(error_fd, &error, sizeof(error));
+                (void) rv;
+                _exit(EXIT_CODE_FAILURE);
+            };
+
+            // the launched process must not be affected by the daemon's session, nor be stopped along with the daemon
+            setsid();
+
+            for (int i = 0; i < 3; ++i) {
+                if (dup2(request.stdio_fds[i], i) < 0) {
+                    fail();
+                }
+            }
+
+            close_fds_except(3, keep_fds, sizeof(keep_fds) / sizeof(keep_fds[0]), max_fd);
+
+            // the parent closes its end of the pipe once we may continue; ours has been closed above
+            char start_byte;
+
+            while (read(start_pipe[0], &start_byte, 1) < 0 && errno == EINTR) {}
+
+            // the daemon's signal handling must not leak into the launched process
+            sigset_t empty_set;
+            sigemptyset(&empty_set);
+            sigprocmask(SIG_SETMASK, &empty_set, nullptr);
+
+            for (int sig = 1; sig < NSIG; ++sig) {
+                signal(sig, SIG_DFL);
+            }
+
+            if (chdir(cwd) != 0) {
+                fail();
+            }
+
+#ifdef SYS_execveat
+            syscall(SYS_execveat, runtime_fd, "", argv, envp, AT_EMPTY_PATH);
+
+            if (errno == ENOSYS)
+#endif
+            {
+                execve(runtime_proc_path, argv, envp);
+            }
+
+            fail();
+        }
+
+        const auto fork_errno = errno;
+        close(error_pipe[1]);
+        close(start_pipe[0]);
+
+        if (pid < 0) {
+            close(error_pipe[0]);
+            close(start_pipe[1]);
+            errno = fork_errno;
+            return -1;
+        }
+
+        if (on_forked) {
+            on_forked(pid);
+        }
+
+        close(start_pipe[1]);
+
+        // the pipe is closed without any data being written once the runtime has been executed
+        int child_errno = 0;
+        ssize_t rv;
+
+        do {
+            rv = read(error_pipe[0], &child_errno, sizeof(child_errno));
+        } while (rv < 0 && errno == EINTR);
+
+        close(error_pipe[0]);
+
+        if (rv == sizeof(child_errno)) {
+            while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+            errno = child_errno;
+            return -1;
+        }
+
+        return pid;
+    }
+}
+
+ZygoteRequest::~ZygoteRequest() {
+    for (const auto fd : stdio_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+std::string zygote_socket_path() {
+    // like the runtime cache, we ignore relative paths
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir == nullptr || runtime_dir[0] != '/') {
+        return "";
+    }
+
+    return std::string(runtime_dir) + "/appimagelauncher/zygote.sock";
+}
+
+int launch_via_zygote(const std::string& appimage_path, const std::vector<char*>& target_args) {
+    if (getenv(ZYGOTE_DISABLE_ENV_VAR) != nullptr) {
+        return ZYGOTE_NOT_AVAILABLE;
+    }
+
+    sockaddr_un addr{};
+
+    if (!make_sockaddr(zygote_socket_path(), addr)) {
+        return ZYGOTE_NOT_AVAILABLE;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return ZYGOTE_NOT_AVAILABLE;
+    }
+
+    // the daemon is usually not running in zygote mode, which is perfectly fine
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        log_debug("zygote not available: %s\n", strerror(errno));
+        close(fd);
+        return ZYGOTE_NOT_AVAILABLE;
+    }
+
+    // signals must be blocked before the process is launched, so none of them can get lost
+    sigset_t forwarded_signals, previous_mask;
+    make_forwarded_signal_set(forwarded_signals);
+    sigprocmask(SIG_BLOCK, &forwarded_signals, &previous_mask);
+
+    zygote_reply reply{};
+
+    if (!send_request(fd, appimage_path, target_args) || !read_all(fd, &reply, sizeof(reply))) {
+        log_debug("zygote did not respond, launching AppImage without it\n");
+        reply.type = ZYGOTE_REPLY_DECLINED;
+    }
+
+    if (reply.type != ZYGOTE_REPLY_STARTED) {
+        log_debug("zygote declined to launch %s\n", appimage_path.c_str());
+        sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+        close(fd);
+        return ZYGOTE_NOT_AVAILABLE;
+    }
+
+    const auto pid = static_cast<pid_t>(reply.value);
+    log_debug("zygote launched %s as process %ld\n", appimage_path.c_str(), (long) pid);
+
+    const auto status = wait_for_launched_process(fd, pid, forwarded_signals);
+    close(fd);
+
+    return exit_code_from_wait_status(status);
+}
+
+int zygote_create_socket(const std::string& path) {
+    sockaddr_un addr{};
+
+    if (!make_sockaddr(path, addr)) {
+        log_error("invalid zygote socket path: %s\n", path.c_str());
+        return -1;
+    }
+
+    const auto dir = path.substr(0, path.rfind('/'));
+
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        log_error("failed to create directory %s: %s\n", dir.c_str(), strerror(errno));
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if (fd < 0) {
+        log_error("failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // a previous instance may have left its socket behind
+    unlink(path.c_str());
+
+    // the socket must not be accessible by other users at any point in time
+    const auto old_umask = umask(0077);
+    const auto rv = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    umask(old_umask);
+
+    if (rv != 0 || listen(fd, SOMAXCONN) != 0) {
+        log_error("failed to listen on %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool zygote_receive_request(const int connection_fd, ZygoteRequest& request) {
+    zygote_request_header header{};
+
+    iovec iov{&header, sizeof(header)};
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(request.stdio_fds))];
+        cmsghdr align;
+    } control{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t rv;
+
+    do {
+        rv = recvmsg(connection_fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (rv < 0 && errno == EINTR);
+
+    // take ownership of the file descriptors first, so they're closed in any case
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(request.stdio_fds))) {
+            memcpy(request.stdio_fds, CMSG_DATA(cmsg), sizeof(request.stdio_fds));
+        }
+    }
+
+    if (rv != sizeof(header) || (msg.msg_flags & MSG_CTRUNC) != 0) {
+        log_error("failed to receive request header\n");
+        return false;
+    }
+
+    for (const auto fd : request.stdio_fds) {
+        if (fd < 0) {
+            log_error("request lacks stdio file descriptors\n");
+            return false;
+        }
+    }
+
+    if (header.version != ZYGOTE_PROTOCOL_VERSION) {
+        log_error("unsupported protocol version %u\n", header.version);
+        return false;
+    }
+
+    if (header.payload_size > ZYGOTE_MAX_PAYLOAD_SIZE) {
+        log_error("request payload too large\n");
+        return false;
+    }
+
+    std::string payload(header.payload_size, '\0');
+
+    if (!read_all(connection_fd, &payload[0], payload.size())) {
+        log_error("failed to receive request payload\n");
+        return false;
+    }
+
+    // split up strings, the payload must consist of exactly the announced number of null terminated strings
+    std::vector<std::string> strings;
+
+    for (size_t begin = 0; begin < payload.size();) {
+        const auto end = payload.find('\0', begin);
+
+        if (end == std::string::npos) {
+            log_error("malformed request payload\n");
+            return false;
+        }
+
+        strings.emplace_back(payload, begin, end - begin);
+        begin = end + 1;
+    }
+
+    if (strings.size() != 2 + static_cast<size_t>(header.arg_count) + header.env_count) {
+        log_error("malformed request payload\n");
+        return false;
+    }
+
+    const auto args_begin = strings.begin() + 2;
+    const auto env_begin = args_begin + header.arg_count;
+
+    request.appimage_path = strings[0];
+    request.cwd = strings[1];
+    request.args.assign(args_begin, env_begin);
+    request.env.assign(env_begin, strings.end());
+
+    return true;
+}
+
+bool zygote_send_reply(const int connection_fd, const zygote_reply_type type, const int32_t value) {
+    const zygote_reply reply{type, value};
+    return write_all(connection_fd, &reply, sizeof(reply));
+}
+
+pid_t zygote_spawn(const ZygoteRequest& request, const std::function<void(pid_t)>& on_forked) {
+    // relative paths are relative to the client's working directory
+    const auto appimage_path = request.appimage_path[0] == '/' ?
+        request.appimage_path : request.cwd + "/" + request.appimage_path;
+
+    // the daemon can't know when the launched process has loaded a temporary copy of the preload library, so it can't
+    // clean one up; the interpreter takes care of such launches on its own then
+    PreparedRuntime runtime;
+
+    if (!prepare_patched_runtime(appimage_path, false, runtime)) {
+        return -1;
+    }
+
+    // argv[0] is the path the client has been called with, as if the interpreter executed the runtime
+    std::vector<std::string> arg_strings{request.appimage_path};
+    arg_strings.insert(arg_strings.end(), request.args.begin(), request.args.end());
+
+    const auto env_strings = make_environment(request, runtime);
+
+    const auto argv = make_string_array(arg_strings);
+    const auto envp = make_string_array(env_strings);
+
+    auto pid = spawn_runtime(request, runtime.runtime_fd, runtime.preload_lib_fd, argv.data(), envp.data(), on_forked);
+
+    // cached runtimes can't be executed if the cache's file system has been mounted with noexec (or a security module
+    // denies it), in-memory copies usually can
+    if (pid < 0 && (errno == EACCES || errno == EPERM)) {
+        log_warning("failed to execute patched runtime (%s), retrying with in-memory copy\n", strerror(errno));
+
+        const int fallback_fd = create_uncached_patched_runtime(runtime.appimage_path, runtime.runtime_size);
+
+        if (fallback_fd >= 0) {
+            close(runtime.runtime_fd);
+            runtime.runtime_fd = fallback_fd;
+
+            pid = spawn_runtime(request, runtime.runtime_fd, runtime.preload_lib_fd, argv.data(), envp.data(), on_forked);
+        }
+    }
+
+    if (pid < 0) {
+        log_error("failed to launch %s: %s\n", request.appimage_path.c_str(), strerror(errno));
+    }
+
+    return pid;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// the launch zygote allows appimagelauncherd to launch integrated AppImages on behalf of the binfmt_misc interpreter
+// the interpreter just hands over the launch request (AppImage path, arguments, environment, working directory and
+// stdio file descriptors) to the daemon via a Unix socket, and waits for the launched process to exit
+// the daemon keeps the config, the integration index and the runtime cache warm, so the launch decision doesn't
+// require any exec chains, and forks a process which executes the patched runtime right away
+// this header is used by both the interpreter and the daemon, therefore the code must not depend on Qt
+
+// system headers
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// returned by launch_via_zygote(...) if the caller has to launch the AppImage on its own
+#define ZYGOTE_NOT_AVAILABLE (-1)
+
+// setting this environment variable prevents the interpreter from using the zygote
+#define ZYGOTE_DISABLE_ENV_VAR "APPIMAGELAUNCHER_DISABLE_ZYGOTE"
+
+// the protocol is private to a single installation, but we check the version anyway to be able to reject requests
+// from an interpreter which has been updated while the old daemon is still running
+#define ZYGOTE_PROTOCOL_VERSION 1
+
+// upper limit for the size of the strings in a request
+#define ZYGOTE_MAX_PAYLOAD_SIZE (4 * 1024 * 1024)
+
+enum zygote_reply_type : int32_t {
+    // the daemon won't launch the AppImage, the interpreter has to take care of it (e.g., by running AppImageLauncher)
+    ZYGOTE_REPLY_DECLINED = 1,
+    // the process has been launched, the value is its process ID
+    ZYGOTE_REPLY_STARTED = 2,
+    // the process has exited, the value is its wait status
+    ZYGOTE_REPLY_EXITED = 3,
+};
+
+struct zygote_request_header {
+    uint32_t version;
+    uint32_t arg_count;
+    uint32_t env_count;
+    uint32_t payload_size;
+};
+
+struct zygote_reply {
+    int32_t type;
+    int32_t value;
+};
+
+struct ZygoteRequest {
+    std::string appimage_path;
+    std::string cwd;
+    std::vector<std::string> args;
+    std::vector<std::string> env;
+    int stdio_fds[3] = {-1, -1, -1};
+
+    ZygoteRequest() = default;
+    ~ZygoteRequest();
+
+    ZygoteRequest(const ZygoteRequest&) = delete;
+    ZygoteRequest& operator=(const ZygoteRequest&) = delete;
+};
+
+/**
+ * Calculate the path of the zygote socket (within $XDG_RUNTIME_DIR).
+ * @return path to socket, or empty string if no suitable location can be found
+ */
+std::string zygote_socket_path();
+
+/**
+ * Ask the zygote to launch an AppImage, and wait for the launched process to exit.
+ * All signals the caller receives in the meantime are forwarded to the launched process.
+ * @param appimage_path path to AppImage
+ * @param target_args arguments to pass to the AppImage
+ * @return exit code, or ZYGOTE_NOT_AVAILABLE if the zygote cannot be used or declines the request
+ */
+int launch_via_zygote(const std::string& appimage_path, const std::vector<char*>& target_args);
+
+/**
+ * Create the zygote's listening socket, replacing stale sockets of previous instances.
+ * The socket is accessible by the current user only.
+ * @param path path to socket
+ * @return socket file descriptor, or -1 on errors
+ */
+int zygote_create_socket(const std::string& path);
+
+/**
+ * Receive a launch request from a client.
+ * @param connection_fd connection to client
+ * @param request request to fill in
+ * @return true on success, false otherwise
+ */
+bool zygote_receive_request(int connection_fd, ZygoteRequest& request);
+
+/**
+ * Send a reply to a client.
+ * @param connection_fd connection to client
+ * @param type reply type
+ * @param value reply value
+ * @return true on success, false otherwise
+ */
+bool zygote_send_reply(int connection_fd, zygote_reply_type type, int32_t value);
+
+/**
+ * Launch an AppImage as requested by a client.
+ * The child process detaches from the caller's session and uses the client's stdio, working directory and environment.
+ * Everything is prepared before forking, the child only calls async-signal-safe functions, so this may be called from
+ * multithreaded processes. Returns once the runtime has been executed.
+ * @param request launch request
+ * @param on_forked called with the child's process ID before the child executes the runtime, e.g., to move it into
+ *        another cgroup (optional, may be called more than once if the launch is retried)
+ * @return process ID of launched process, or -1 on errors
+ */
+pid_t zygote_spawn(const ZygoteRequest& request, const std::function<void(pid_t)>& on_forked = nullptr);
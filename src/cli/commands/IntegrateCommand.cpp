@@ -1,3 +1,6 @@
+// system headers
+#include <unistd.h>
+
 // library headers
 #include <QFileInfo>
 
@@ -5,6 +8,8 @@
 #include "IntegrateCommand.h"
 #include "exceptions.h"
 #include "shared.h"
+#include "daemonclient.h"
+#include "filecopy.h"
 #include "logging.h"
 
 namespace appimagelauncher {
@@ -27,6 +32,9 @@ namespace appimagelauncher {
                     path = QFileInfo(path).absoluteFilePath();
                 }
 
+                // the desktop files are installed all at once after the AppImages have been moved
+                QStringList pathsToIntegrate;
+
                 for (const auto& pathToAppImage : arguments) {
                     qout() << "Processing " << pathToAppImage << endl;
 
@@ -68,15 +76,63 @@ namespace appimagelauncher {
                         if (!QFile(pathToAppImage).rename(pathToIntegratedAppImage)) {
                             qerr() << "Cannot move AppImage to integration directory (permission problem?), attempting to copy instead" << endl;
 
-                            if (!QFile(pathToAppImage).copy(pathToIntegratedAppImage)) {
-                                throw CliError("Failed to copy AppImage, giving up");
+                            // only print the progress when somebody is watching
+                            const bool showProgress = isatty(STDERR_FILENO) != 0;
+                            int lastPercentage = -1;
+
+                            const auto copyResult = copyFile(
+                                pathToAppImage, pathToIntegratedAppImage,
+                                [showProgress, &lastPercentage](qint64 bytesCopied, qint64 bytesTotal) {
+                                    const int percentage = bytesTotal > 0 ? static_cast<int>(bytesCopied * 100 / bytesTotal) : 100;
+
+                                    if (showProgress && percentage != lastPercentage) {
+                                        qerr() << "\rCopying: " << percentage << "%" << flush;
+                                        lastPercentage = percentage;
+                                    }
+
+                                    return true;
+                                }
+                            );
+
+                            if (lastPercentage >= 0) {
+                                qerr() << endl;
+                            }
+
+                            if (!copyResult.success) {
+                                throw CliError("Failed to copy AppImage, giving up (error: " + copyResult.errorMessage() + ")");
                             }
                         }
                     } else {
                         qout() << "AppImage already in integration directory" << endl;
                     }
 
-                    installDesktopFileAndIcons(pathToIntegratedAppImage);
+                    pathsToIntegrate << pathToIntegratedAppImage;
+                }
+
+                if (pathsToIntegrate.empty()) {
+                    return;
+                }
+
+                // the daemon has everything loaded already, and refreshes the desktop database and icon caches for us
+                if (const auto failures = DaemonClient::integrate(pathsToIntegrate)) {
+                    for (auto it = failures->constBegin(); it != failures->constEnd(); ++it) {
+                        qerr() << "Failed to integrate " << it.key() << ": " << it.value().toString() << endl;
+                    }
+
+                    if (!failures->empty()) {
+                        throw CliError(QString("Failed to integrate %1 of %2 AppImages").arg(failures->size())
+                                           .arg(pathsToIntegrate.size()));
+                    }
+
+                    return;
+                }
+
+                for (const auto& pathToIntegratedAppImage : pathsToIntegrate) {
+                    if (installDesktopFileAndIcons(pathToIntegratedAppImage)) {
+                        // the AppImage resides in the integration destination now, so the binfmt interpreter may
+                        // launch it directly
+                        addToIntegrationIndex(pathToIntegratedAppImage);
+                    }
                 }
             }
         }
@@ -5,6 +5,7 @@
 #include "UnintegrateCommand.h"
 #include "exceptions.h"
 #include "shared.h"
+#include "daemonclient.h"
 #include "logging.h"
 
 namespace appimagelauncher {
@@ -27,6 +28,8 @@ namespace appimagelauncher {
                     path = QFileInfo(path).absoluteFilePath();
                 }
 
+                QStringList pathsToUnintegrate;
+
                 for (const auto& pathToAppImage : arguments) {
                     qout() << "Processing " << pathToAppImage << endl;
 
@@ -45,6 +48,28 @@ namespace appimagelauncher {
                         continue;
                     }
 
+                    pathsToUnintegrate << pathToAppImage;
+                }
+
+                if (pathsToUnintegrate.empty()) {
+                    return;
+                }
+
+                if (const auto failures = DaemonClient::unintegrate(pathsToUnintegrate)) {
+                    for (auto it = failures->constBegin(); it != failures->constEnd(); ++it) {
+                        qerr() << "Failed to unintegrate " << it.key() << ": " << it.value().toString() << endl;
+                    }
+
+                    if (!failures->empty()) {
+                        throw CliError(QString("Failed to unintegrate %1 of %2 AppImages").arg(failures->size())
+                                           .arg(pathsToUnintegrate.size()));
+                    }
+
+                    return;
+                }
+
+                // the daemon isn't running, so we have to do it ourselves
+                for (const auto& pathToAppImage : pathsToUnintegrate) {
                     unregisterAppImage(pathToAppImage);
                 }
             }
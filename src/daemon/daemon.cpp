@@ -6,7 +6,10 @@
 
 // local headers
 #include "daemon.h"
+#include "dbusinterface.h"
+#include "metrics.h"
 #include "shared.h"
+#include "appimagesniffer.h"
 #include "appimage/appimage.h"
 
 using namespace std::chrono_literals;
@@ -17,7 +20,8 @@ namespace appimagelauncher::daemon {
 
     Q_LOGGING_CATEGORY(daemonCat, "appimagelauncher.daemon")
 
-    Daemon::Daemon(QObject* parent) : QObject(parent), _settings(getConfig(this)), _worker(new Worker(this)),
+    Daemon::Daemon(QObject* parent) : QObject(parent), _negativeCache(std::make_shared<NegativeCache>()),
+                                      _worker(new Worker(_negativeCache, this)),
                                       _watcher(new FileSystemWatcher(this)), _updateWatchedDirsTimer(new QTimer(this)) {
         // when we update the watched directories, the file system watcher can calculate whether there's new directories
         // to watch these
@@ -44,6 +48,10 @@ namespace appimagelauncher::daemon {
              } else {
                  qCInfo(daemonCat) << "Directories to watch disappeared, unintegrating AppImages formerly found in there";
 
+                 auto& metrics = Metrics::instance();
+                 ScopedTimer timer(metrics.stage(Metrics::CLEANUP));
+                 metrics.cleanupSweeps.increment();
+
                  if (!cleanUpOldDesktopIntegrationResources(true)) {
                      qCCritical(daemonCat) << "Error: Failed to clean up old desktop integration resources";
                  }
@@ -62,14 +70,31 @@ namespace appimagelauncher::daemon {
         _updateWatchedDirsTimer->start();
 
 
+        // the events are counted before the worker merges them with the operations pending already
+        auto countEvent = []() {
+            Metrics::instance().inotifyEventsReceived.increment();
+        };
+        connect(_watcher, &FileSystemWatcher::fileChanged, this, countEvent);
+        connect(_watcher, &FileSystemWatcher::fileRemoved, this, countEvent);
+
         connect(_watcher, &FileSystemWatcher::fileChanged, _worker, &Worker::scheduleForIntegration,
                 Qt::QueuedConnection);
         connect(_watcher, &FileSystemWatcher::fileRemoved, _worker, &Worker::scheduleForUnintegration,
                Qt::QueuedConnection);
+
+        // the signal may be emitted from the worker's threads, the connection makes sure the slot runs in ours
+        connect(ConfigWatcher::instance(), &ConfigWatcher::configChanged, this, &Daemon::slotApplyConfig);
     }
 
     QDirSet Daemon::watchedDirectories() const {
-        return daemonDirectoriesToWatch(_settings);
+        return daemonDirectoriesToWatch(*currentConfig());
+    }
+
+    void Daemon::slotApplyConfig() {
+        qCInfo(daemonCat) << "Config file changed, updating watched directories";
+
+        // new directories are searched for AppImages right away, see the constructor
+        _watcher->updateWatchedDirectories(watchedDirectories());
     }
 
 
@@ -90,32 +115,46 @@ namespace appimagelauncher::daemon {
 
             qCInfo(daemonCat) << "Searching directory: " << dir.absolutePath();
 
+            QStringList candidates;
+
             for (QDirIterator it(dir); it.hasNext();) {
                 const auto& path = it.next();
 
-                if (QFileInfo(path).isFile()) {
-                    const auto appImageType = appimage_get_type(path.toStdString().c_str(), false);
-                    const auto isAppImage = 0 < appImageType && appImageType <= 2;
-
-                    if (isAppImage) {
-                        // at application startup, we don't want to integrate AppImages that have been integrated already,
-                        // as that it slows down very much
-                        // the integration will be updated as soon as any of these AppImages is run with AppImageLauncher
-                        qCInfo(daemonCat) << "Found AppImage: " << path;
-
-                        if (!appimage_is_registered_in_system(path.toStdString().c_str())) {
-                            qCInfo(daemonCat) << "AppImage is not integrated yet, integrating";
-                            _worker->scheduleForIntegration(path);
-                        } else if (!desktopFileHasBeenUpdatedSinceLastUpdate(path)) {
-                            qCInfo(daemonCat) << "AppImage has been integrated already but needs to be reintegrated";
-                            _worker->scheduleForIntegration(path);
-                        } else {
-                            qCInfo(daemonCat) << "AppImage integrated already, skipping";
-                        }
+                // files known not to be AppImages are skipped until they change
+                if (QFileInfo(path).isFile() && !_negativeCache->contains(path)) {
+                    candidates << path;
+                }
+            }
+
+            // the magic bytes rule out most other files quickly, only the remaining ones are inspected by libappimage
+            for (const auto& path : filterPotentialAppImages(candidates)) {
+                const auto appImageType = appimage_get_type(path.toStdString().c_str(), false);
+                const auto isAppImage = 0 < appImageType && appImageType <= 2;
+
+                if (!isAppImage) {
+                    _negativeCache->insert(path);
+                } else {
+                    // at application startup, we don't want to integrate AppImages that have been integrated already,
+                    // as that it slows down very much
+                    // the integration will be updated as soon as any of these AppImages is run with AppImageLauncher
+                    qCInfo(daemonCat) << "Found AppImage: " << path;
+
+                    if (!appimage_is_registered_in_system(path.toStdString().c_str())) {
+                        qCInfo(daemonCat) << "AppImage is not integrated yet, integrating";
+                        _worker->scheduleForIntegration(path);
+                    } else if (!desktopFileHasBeenUpdatedSinceLastUpdate(path)) {
+                        qCInfo(daemonCat) << "AppImage has been integrated already but needs to be reintegrated";
+                        _worker->scheduleForIntegration(path);
+                    } else {
+                        qCInfo(daemonCat) << "AppImage integrated already, skipping";
                     }
                 }
             }
         }
+
+        if (!_negativeCache->save()) {
+            qCWarning(daemonCat) << "Failed to save negative cache";
+        }
     }
 
     bool Daemon::startWatching() {
@@ -130,6 +169,11 @@ namespace appimagelauncher::daemon {
         return _watcher->startWatching();
     }
 
+    bool Daemon::exportDBusInterface() {
+        auto* dbusInterface = new DBusInterface(_worker, this);
+        return dbusInterface->exportOnSessionBus();
+    }
+
     void Daemon::slotStopWatching() {
         _watcher->stopWatching();
     }
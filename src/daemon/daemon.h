@@ -2,12 +2,12 @@
 
 // library headers
 #include <QObject>
-#include <QSettings>
 #include <QTimer>
 #include <QLoggingCategory>
 
 // local headers
 #include "worker.h"
+#include "negativecache.h"
 #include "types.h"
 #include "filesystemwatcher.h"
 
@@ -23,13 +23,19 @@ namespace appimagelauncher::daemon {
         QDirSet watchedDirectories() const;
         bool startWatching();
 
+        // allows other components to delegate integration requests to the daemon, see daemonclient.h
+        bool exportDBusInterface();
+
     public slots:
         void slotStopWatching();
 
+        // applies changes to the config file without requiring a restart
+        void slotApplyConfig();
+
     private:
         void initialSearchForAppImages(const QDirSet& dirsToSearch);
 
-        QSettings *_settings;
+        std::shared_ptr<NegativeCache> _negativeCache;
         Worker* _worker;
         FileSystemWatcher *_watcher;
 
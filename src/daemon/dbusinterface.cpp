@@ -0,0 +1,136 @@
+// library includes
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDBusMessage>
+#include <QFileInfo>
+
+// local includes
+#include "dbusinterface.h"
+#include "daemonclient.h"
+#include "metrics.h"
+#include "shared.h"
+
+namespace appimagelauncher::daemon {
+
+    Q_LOGGING_CATEGORY(dbusCat, "appimagelauncher.daemon.dbus")
+
+    namespace {
+        QVariantMap toVariantMap(const QMap<QString, QString>& map) {
+            QVariantMap result;
+
+            for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+                result.insert(it.key(), it.value());
+            }
+
+            return result;
+        }
+    }
+
+    DBusInterface::DBusInterface(Worker* worker, QObject* parent) : QObject(parent), _worker(worker) {}
+
+    bool DBusInterface::exportOnSessionBus() {
+        auto connection = QDBusConnection::sessionBus();
+
+        if (!connection.isConnected()) {
+            qCWarning(dbusCat) << "Not connected to session bus";
+            return false;
+        }
+
+        if (!connection.registerService(DAEMON_DBUS_SERVICE)) {
+            qCWarning(dbusCat) << "Could not register service name, is another instance running?"
+                               << connection.lastError().message();
+            return false;
+        }
+
+        if (!connection.registerObject(DAEMON_DBUS_PATH, this, QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllProperties)) {
+            qCWarning(dbusCat) << "Could not register object" << connection.lastError().message();
+            connection.unregisterService(DAEMON_DBUS_SERVICE);
+            return false;
+        }
+
+        qCInfo(dbusCat) << "Exported D-Bus interface" << DAEMON_DBUS_INTERFACE;
+        return true;
+    }
+
+    QVariantMap DBusInterface::metrics() const {
+        return Metrics::instance().toVariantMap();
+    }
+
+    qlonglong DBusInterface::queueDepth() const {
+        return Metrics::instance().queueDepth.value();
+    }
+
+    qulonglong DBusInterface::residentMemory() const {
+        return Metrics::residentMemoryBytes();
+    }
+
+    bool DBusInterface::rejectRelativePaths(const QStringList& paths) {
+        for (const auto& path : paths) {
+            if (!QFileInfo(path).isAbsolute()) {
+                qCWarning(dbusCat) << "Rejecting relative path" << path;
+                sendErrorReply(QDBusError::InvalidArgs, "Path is not absolute: " + path);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void DBusInterface::executeWithDelayedReply(const QStringList& paths, const bool integrate) {
+        if (rejectRelativePaths(paths)) {
+            return;
+        }
+
+        // the return value of the slot is ignored, the reply is sent by the callback instead
+        setDelayedReply(true);
+
+        const auto request = message();
+        auto connection = this->connection();
+
+        const auto sendReply = [request, connection](const QMap<QString, QString>& failures) {
+            connection.send(request.createReply(toVariantMap(failures)));
+        };
+
+        _worker->executeNow(paths, integrate, sendReply);
+    }
+
+    QVariantMap DBusInterface::Integrate(const QStringList& paths) {
+        qCInfo(dbusCat) << "Integration requested for" << paths;
+        executeWithDelayedReply(paths, true);
+        return {};
+    }
+
+    QVariantMap DBusInterface::Unintegrate(const QStringList& paths) {
+        qCInfo(dbusCat) << "Unintegration requested for" << paths;
+        executeWithDelayedReply(paths, false);
+        return {};
+    }
+
+    QVariantMap DBusInterface::Status(const QString& path) {
+        if (rejectRelativePaths({path})) {
+            return {};
+        }
+
+        const auto absolutePath = QFileInfo(path).absoluteFilePath();
+
+        QVariantMap status;
+
+        const bool exists = QFileInfo(absolutePath).isFile();
+        const bool appImage = exists && isAppImage(absolutePath);
+        const bool integrated = appImage && hasAlreadyBeenIntegrated(absolutePath);
+
+        status.insert("exists", exists);
+        status.insert("isAppImage", appImage);
+        status.insert("integrated", integrated);
+        // whether the desktop file has been created by this version of AppImageLauncher
+        status.insert("upToDate", integrated && desktopFileHasBeenUpdatedSinceLastUpdate(absolutePath));
+        status.insert("inIntegrationDestination", isInDirectory(absolutePath, integratedAppImagesDestination()));
+
+        return status;
+    }
+
+    QStringList DBusInterface::List() {
+        return getIntegratedAppImages();
+    }
+
+}
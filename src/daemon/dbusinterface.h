@@ -0,0 +1,67 @@
+// library includes
+#include <QDBusContext>
+#include <QObject>
+#include <QLoggingCategory>
+#include <QStringList>
+#include <QVariantMap>
+
+#pragma once
+
+// local includes
+#include "worker.h"
+
+namespace appimagelauncher::daemon {
+
+    Q_DECLARE_LOGGING_CATEGORY(dbusCat)
+
+    /**
+     * Exports the daemon's functionality on the session bus (see daemonclient.h), so other components don't have to
+     * run the entire integration stack in their own short-lived processes.
+     * Requests are executed right away by the worker, together with the operations deferred so far. The replies are
+     * sent once the batch has finished, the daemon keeps serving other requests in the meantime.
+     * All paths must be absolute, requests with relative paths are rejected.
+     */
+    class DBusInterface : public QObject, protected QDBusContext {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "org.appimagelauncher.Daemon")
+
+        // see metrics.h
+        Q_PROPERTY(QVariantMap Metrics READ metrics)
+        Q_PROPERTY(qlonglong QueueDepth READ queueDepth)
+        Q_PROPERTY(qulonglong ResidentMemory READ residentMemory)
+
+    public:
+        explicit DBusInterface(Worker* worker, QObject* parent = nullptr);
+
+        // registers the service name and the object on the session bus
+        bool exportOnSessionBus();
+
+    public:
+        QVariantMap metrics() const;
+        qlonglong queueDepth() const;
+        qulonglong residentMemory() const;
+
+    public slots:
+        // returns the error messages of the AppImages which couldn't be integrated, keyed by their paths
+        QVariantMap Integrate(const QStringList& paths);
+
+        // returns the error messages of the AppImages which couldn't be unintegrated, keyed by their paths
+        QVariantMap Unintegrate(const QStringList& paths);
+
+        QVariantMap Status(const QString& path);
+
+        QStringList List();
+
+    private:
+        // the daemon's working directory is unrelated to the caller's, so relative paths can't be resolved
+        // sends an error reply to the current request and returns true if any of the paths is relative
+        bool rejectRelativePaths(const QStringList& paths);
+
+        // hands the operations to the worker, and sends the reply to the current request once they have finished
+        void executeWithDelayedReply(const QStringList& paths, bool integrate);
+
+    private:
+        Worker* _worker;
+    };
+
+}
@@ -0,0 +1,499 @@
+// system includes
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// library includes
+#include <QCoreApplication>
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusVariant>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+// local includes
+#include "launchzygote.h"
+#include "integrationindex.h"
+#include "zygote.h"
+
+namespace {
+    // see StartTransientUnit in org.freedesktop.systemd1(5)
+    struct SystemdUnitProperty {
+        QString name;
+        QDBusVariant value;
+    };
+
+    typedef QList<SystemdUnitProperty> SystemdUnitProperties;
+
+    struct SystemdAuxUnit {
+        QString name;
+        SystemdUnitProperties properties;
+    };
+
+    typedef QList<SystemdAuxUnit> SystemdAuxUnits;
+
+    QDBusArgument& operator<<(QDBusArgument& argument, const SystemdUnitProperty& property) {
+        argument.beginStructure();
+        argument << property.name << property.value;
+        argument.endStructure();
+        return argument;
+    }
+
+    const QDBusArgument& operator>>(const QDBusArgument& argument, SystemdUnitProperty& property) {
+        argument.beginStructure();
+        argument >> property.name >> property.value;
+        argument.endStructure();
+        return argument;
+    }
+
+    QDBusArgument& operator<<(QDBusArgument& argument, const SystemdAuxUnit& unit) {
+        argument.beginStructure();
+        argument << unit.name << unit.properties;
+        argument.endStructure();
+        return argument;
+    }
+
+    const QDBusArgument& operator>>(const QDBusArgument& argument, SystemdAuxUnit& unit) {
+        argument.beginStructure();
+        argument >> unit.name >> unit.properties;
+        argument.endStructure();
+        return argument;
+    }
+}
+
+Q_DECLARE_METATYPE(SystemdUnitProperty)
+Q_DECLARE_METATYPE(SystemdAuxUnit)
+
+namespace appimagelauncher::daemon {
+
+    Q_LOGGING_CATEGORY(zygoteCat, "appimagelauncher.daemon.zygote")
+
+    class LaunchZygote::PrivateData {
+    public:
+        int socketFd = -1;
+        std::string socketPath;
+        QSocketNotifier* notifier = nullptr;
+
+        // the desktop files are updated after the launcher binary has been updated, see isIntegratedAndUpToDate(...)
+        // in the binfmt interpreter
+        std::string launcherPath;
+
+        // the index is reloaded only when the file has been replaced
+        // guarded by the mutex, as requests are handled concurrently
+        QMutex indexMutex;
+        std::string indexPath;
+        std::unique_ptr<IntegrationIndex> index;
+        ino_t indexInode = 0;
+        struct timespec indexMTime{};
+
+        // receiving requests and preparing launches involves blocking I/O, which must not stall the event loop
+        QThreadPool threadPool;
+
+        // systemd usually moves a process into a new scope within a few milliseconds
+        static constexpr int SCOPE_TIMEOUT_MSEC = 1000;
+        static constexpr int SCOPE_POLL_INTERVAL_MSEC = 5;
+
+        class ConnectionTask;
+
+    public:
+        PrivateData() : launcherPath((QCoreApplication::applicationDirPath() + "/AppImageLauncher").toStdString()),
+                        indexPath(defaultIntegrationIndexPath()) {
+            // launches are short, a few threads suffice even if many AppImages are launched at once
+            threadPool.setMaxThreadCount(4);
+        }
+
+        ~PrivateData() {
+            closeSocket();
+            threadPool.waitForDone();
+        }
+
+    public:
+        void closeSocket() {
+            if (socketFd < 0) {
+                return;
+            }
+
+            close(socketFd);
+            socketFd = -1;
+
+            // clients shall not try to connect to a zygote that's no longer there
+            unlink(socketPath.c_str());
+        }
+
+    public:
+        // AppImages launched by the zygote must keep running when the daemon is stopped, so they must not stay in the
+        // daemon's cgroup, which systemd cleans up when stopping the service
+        // therefore, they are moved into a transient scope of their own, like desktop environments do with the
+        // applications they launch
+        static void moveIntoScope(const pid_t pid, const std::string& appImagePath) {
+            // the daemon is not necessarily run as a systemd service
+            if (qEnvironmentVariableIsEmpty("INVOCATION_ID")) {
+                return;
+            }
+
+            static const bool typesRegistered = [] {
+                qDBusRegisterMetaType<SystemdUnitProperty>();
+                qDBusRegisterMetaType<SystemdUnitProperties>();
+                qDBusRegisterMetaType<SystemdAuxUnit>();
+                qDBusRegisterMetaType<SystemdAuxUnits>();
+                return true;
+            }();
+            (void) typesRegistered;
+
+            const auto cgroupPath = "/proc/" + QString::number(pid) + "/cgroup";
+            const auto originalCgroup = readFile(cgroupPath);
+
+            const SystemdUnitProperties properties{
+                {"Description", QDBusVariant("AppImage " + QString::fromStdString(appImagePath))},
+                {"PIDs", QDBusVariant(QVariant::fromValue(QList<uint>{static_cast<uint>(pid)}))},
+                {"CollectMode", QDBusVariant(QString("inactive-or-failed"))},
+            };
+
+            auto message = QDBusMessage::createMethodCall(
+                "org.freedesktop.systemd1", "/org/freedesktop/systemd1", "org.freedesktop.systemd1.Manager",
+                "StartTransientUnit"
+            );
+
+            message << QString("app-appimagelauncher-%1.scope").arg(pid) << QString("fail")
+                    << QVariant::fromValue(properties) << QVariant::fromValue(SystemdAuxUnits());
+
+            const auto reply = QDBusConnection::sessionBus().call(message, QDBus::Block, SCOPE_TIMEOUT_MSEC);
+
+            if (reply.type() == QDBusMessage::ErrorMessage) {
+                qCWarning(zygoteCat) << "Failed to move process" << pid << "into a scope of its own:"
+                                     << reply.errorMessage() << "- it will be stopped along with the daemon";
+                return;
+            }
+
+            // the process is moved once systemd has run the start job, which happens after the reply has been sent
+            // the process must not create any children of its own before, as they would stay in our cgroup
+            for (int elapsed = 0; elapsed < SCOPE_TIMEOUT_MSEC; elapsed += SCOPE_POLL_INTERVAL_MSEC) {
+                if (readFile(cgroupPath) != originalCgroup) {
+                    return;
+                }
+
+                QThread::msleep(SCOPE_POLL_INTERVAL_MSEC);
+            }
+
+            qCWarning(zygoteCat) << "Timeout while waiting for process" << pid << "to be moved into its scope";
+        }
+
+        static QByteArray readFile(const QString& path) {
+            QFile file(path);
+
+            if (!file.open(QIODevice::ReadOnly)) {
+                return {};
+            }
+
+            return file.readAll();
+        }
+
+        // earlier versions set KillMode=process with a drop-in while the zygote was running, which isn't needed any
+        // more, and must not stay around
+        static void removeObsoleteServiceDropIn() {
+            const auto dropInPath = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) +
+                                    "/systemd/user/appimagelauncherd.service.d/zygote.conf";
+
+            if (!QFile::exists(dropInPath) || readFile(dropInPath) != "[Service]\nKillMode=process\n") {
+                return;
+            }
+
+            if (!QFile::remove(dropInPath)) {
+                qCWarning(zygoteCat) << "Failed to remove obsolete drop-in" << dropInPath;
+                return;
+            }
+
+            QDir().rmdir(QFileInfo(dropInPath).path());
+
+            // systemd picks up the change only once it reloads the unit files
+            QDBusConnection::sessionBus().send(QDBusMessage::createMethodCall(
+                "org.freedesktop.systemd1", "/org/freedesktop/systemd1", "org.freedesktop.systemd1.Manager", "Reload"
+            ));
+        }
+
+        // must be called with the index mutex locked
+        const IntegrationIndex* currentIndex() {
+            struct stat st{};
+
+            if (indexPath.empty() || stat(indexPath.c_str(), &st) != 0) {
+                index.reset();
+                return nullptr;
+            }
+
+            if (index == nullptr || st.st_ino != indexInode || st.st_mtim.tv_sec != indexMTime.tv_sec ||
+                st.st_mtim.tv_nsec != indexMTime.tv_nsec) {
+                qCDebug(zygoteCat) << "(Re-)loading integration index";
+
+                index = std::make_unique<IntegrationIndex>(indexPath);
+                indexInode = st.st_ino;
+                indexMTime = st.st_mtim;
+            }
+
+            return index.get();
+        }
+
+        // same decision the binfmt interpreter makes: only AppImages which AppImageLauncher would launch without asking
+        // any questions may be launched by the zygote
+        bool shallLaunch(const ZygoteRequest& request) {
+            const auto absolutePath = QDir(QString::fromStdString(request.cwd))
+                .absoluteFilePath(QString::fromStdString(request.appimage_path)).toStdString();
+
+            std::unique_ptr<char, decltype(&free)> canonicalPath(realpath(absolutePath.c_str(), nullptr), &free);
+
+            if (canonicalPath == nullptr) {
+                return false;
+            }
+
+            struct stat launcherStat{};
+
+            if (stat(launcherPath.c_str(), &launcherStat) != 0) {
+                return false;
+            }
+
+            QMutexLocker lock(&indexMutex);
+
+            // the index also checks whether the config has changed since it has been written
+            const auto* index = currentIndex();
+
+            if (index == nullptr || !index->isValid()) {
+                return false;
+            }
+
+            return index->isIntegratedAndUpToDate(canonicalPath.get(), launcherStat.st_mtim.tv_sec);
+        }
+
+        // only the user running the daemon may use it, and only from within the same PID namespace, as the client
+        // needs to send signals to the launched process, whose process ID is only valid in our namespace
+        static bool isTrustedPeer(int connectionFd) {
+            struct ucred credentials{};
+            socklen_t length = sizeof(credentials);
+
+            if (getsockopt(connectionFd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+                return false;
+            }
+
+            // the kernel reports 0 if the peer's namespace is not a descendant of ours
+            if (credentials.uid != getuid() || credentials.pid <= 0) {
+                return false;
+            }
+
+            // the peer stays connected, so its process ID can't be reused in the meantime
+            const auto peerNamespacePath = "/proc/" + std::to_string(credentials.pid) + "/ns/pid";
+
+            struct stat ownNamespace{};
+            struct stat peerNamespace{};
+
+            if (stat("/proc/self/ns/pid", &ownNamespace) != 0 || stat(peerNamespacePath.c_str(), &peerNamespace) != 0) {
+                return false;
+            }
+
+            return ownNamespace.st_dev == peerNamespace.st_dev && ownNamespace.st_ino == peerNamespace.st_ino;
+        }
+
+        // sends the exit status to the client once the launched process has exited
+        // the connection is closed afterwards
+        static void watchProcess(QObject* parent, pid_t pid, int connectionFd) {
+            auto finish = [pid, connectionFd](const int status) {
+                qCDebug(zygoteCat) << "Process" << pid << "exited with status" << status;
+
+                // the client may have gone away in the meantime, which is fine
+                zygote_send_reply(connectionFd, ZYGOTE_REPLY_EXITED, status);
+                close(connectionFd);
+            };
+
+            // a pidfd becomes readable once the process terminates
+            int pidfd = -1;
+
+#ifdef SYS_pidfd_open
+            pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+
+            if (pidfd >= 0) {
+                auto* notifier = new QSocketNotifier(pidfd, QSocketNotifier::Read, parent);
+
+                QObject::connect(notifier, &QSocketNotifier::activated, parent, [notifier, pidfd, pid, finish]() {
+                    notifier->setEnabled(false);
+                    notifier->deleteLater();
+                    close(pidfd);
+
+                    int status = -1;
+
+                    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+                    finish(status);
+                });
+
+                return;
+            }
+
+            // older kernels (< 5.3) don't support pidfds, then we have to poll
+            auto* timer = new QTimer(parent);
+            timer->setInterval(100);
+
+            QObject::connect(timer, &QTimer::timeout, parent, [timer, pid, finish]() {
+                int status = -1;
+                const auto rv = waitpid(pid, &status, WNOHANG);
+
+                if (rv == 0 || (rv < 0 && errno == EINTR)) {
+                    return;
+                }
+
+                timer->stop();
+                timer->deleteLater();
+
+                finish(rv == pid ? status : -1);
+            });
+
+            timer->start();
+        }
+    };
+
+    // receives a launch request, and launches the AppImage if possible
+    class LaunchZygote::PrivateData::ConnectionTask : public QRunnable {
+    private:
+        LaunchZygote* zygote;
+        PrivateData* d;
+        int connectionFd;
+
+    public:
+        ConnectionTask(LaunchZygote* zygote, PrivateData* d, int connectionFd)
+            : zygote(zygote), d(d), connectionFd(connectionFd) {}
+
+        void run() override {
+            // the client sends the entire request right after connecting, so a short timeout suffices to protect the
+            // thread pool from misbehaving clients
+            const struct timeval timeout{1, 0};
+            setsockopt(connectionFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            ZygoteRequest request;
+
+            if (!zygote_receive_request(connectionFd, request)) {
+                qCWarning(zygoteCat) << "Failed to receive launch request";
+                close(connectionFd);
+                return;
+            }
+
+            if (!d->shallLaunch(request)) {
+                qCDebug(zygoteCat) << "Declining to launch" << QString::fromStdString(request.appimage_path);
+                zygote_send_reply(connectionFd, ZYGOTE_REPLY_DECLINED, 0);
+                close(connectionFd);
+                return;
+            }
+
+            const auto pid = zygote_spawn(request, [&request](const pid_t pid) {
+                PrivateData::moveIntoScope(pid, request.appimage_path);
+            });
+
+            if (pid < 0) {
+                zygote_send_reply(connectionFd, ZYGOTE_REPLY_DECLINED, 0);
+                close(connectionFd);
+                return;
+            }
+
+            qCDebug(zygoteCat) << "Launched" << QString::fromStdString(request.appimage_path) << "as process" << pid;
+
+            if (!zygote_send_reply(connectionFd, ZYGOTE_REPLY_STARTED, pid)) {
+                qCWarning(zygoteCat) << "Client went away before launch completed";
+            }
+
+            // the notifiers watching the process belong to the main thread
+            const auto fd = connectionFd;
+
+            QMetaObject::invokeMethod(zygote, [zygote = zygote, pid, fd]() {
+                PrivateData::watchProcess(zygote, pid, fd);
+            }, Qt::QueuedConnection);
+        }
+    };
+
+    LaunchZygote::LaunchZygote(QObject* parent) : QObject(parent), d(std::make_shared<PrivateData>()) {
+        PrivateData::removeObsoleteServiceDropIn();
+    }
+
+    bool LaunchZygote::start() {
+        if (isRunning()) {
+            return true;
+        }
+
+        const auto socketPath = zygote_socket_path();
+
+        if (socketPath.empty()) {
+            qCCritical(zygoteCat) << "Could not determine zygote socket path, $XDG_RUNTIME_DIR not set?";
+            return false;
+        }
+
+        d->socketFd = zygote_create_socket(socketPath);
+        d->socketPath = socketPath;
+
+        if (d->socketFd < 0) {
+            qCCritical(zygoteCat) << "Could not create zygote socket" << QString::fromStdString(socketPath);
+            return false;
+        }
+
+        // make sure the index is loaded before the first launch
+        {
+            QMutexLocker lock(&d->indexMutex);
+            d->currentIndex();
+        }
+
+        d->notifier = new QSocketNotifier(d->socketFd, QSocketNotifier::Read, this);
+        connect(d->notifier, &QSocketNotifier::activated, this, &LaunchZygote::handleConnection);
+
+        qCInfo(zygoteCat) << "Zygote listening on" << QString::fromStdString(socketPath);
+
+        return true;
+    }
+
+    void LaunchZygote::stop() {
+        if (!isRunning()) {
+            return;
+        }
+
+        delete d->notifier;
+        d->notifier = nullptr;
+
+        d->closeSocket();
+
+        qCInfo(zygoteCat) << "Zygote stopped";
+    }
+
+    bool LaunchZygote::isRunning() const {
+        return d->socketFd >= 0;
+    }
+
+    void LaunchZygote::handleConnection() {
+        const int connectionFd = accept4(d->socketFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (connectionFd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                qCWarning(zygoteCat) << "accept failed:" << strerror(errno);
+            }
+
+            return;
+        }
+
+        if (!PrivateData::isTrustedPeer(connectionFd)) {
+            qCWarning(zygoteCat) << "Rejecting connection from untrusted peer";
+            close(connectionFd);
+            return;
+        }
+
+        d->threadPool.start(new PrivateData::ConnectionTask(this, d.get(), connectionFd));
+    }
+
+}
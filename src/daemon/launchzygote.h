@@ -0,0 +1,46 @@
+// system includes
+#include <memory>
+
+// library includes
+#include <QObject>
+#include <QLoggingCategory>
+
+#pragma once
+
+namespace appimagelauncher::daemon {
+
+    Q_DECLARE_LOGGING_CATEGORY(zygoteCat)
+
+    /**
+     * Launches integrated AppImages on behalf of the binfmt_misc interpreter, see zygote.h in binfmt-bypass.
+     * The daemon keeps the integration index loaded, so the launch decision doesn't require any file system access
+     * besides checking the AppImage and the launcher binary.
+     */
+    class LaunchZygote : public QObject {
+        Q_OBJECT
+
+    private:
+        class PrivateData;
+        std::shared_ptr<PrivateData> d = nullptr;
+
+    public:
+        explicit LaunchZygote(QObject* parent = nullptr);
+
+        /**
+         * Start listening for launch requests.
+         * @return true on success, false otherwise
+         */
+        bool start();
+
+        /**
+         * Stop listening for launch requests. Processes launched before are still watched until they exit.
+         */
+        void stop();
+
+        bool isRunning() const;
+
+    private slots:
+        void handleConnection();
+    };
+
+}
@@ -15,6 +15,10 @@
 // local includes
 #include "shared.h"
 #include "daemon.h"
+#include "metrics.h"
+#ifndef BUILD_LITE
+#include "launchzygote.h"
+#endif
 
 using namespace appimagelauncher::daemon;
 
@@ -132,6 +136,36 @@ int main(int argc, char* argv[]) {
 
     QCoreApplication::connect(&app, &QCoreApplication::aboutToQuit, daemon, &Daemon::slotStopWatching);
 
+    // the daemon works fine without it, clients fall back to doing the work themselves
+    if (!daemon->exportDBusInterface()) {
+        std::cerr << "Could not export D-Bus interface" << std::endl;
+    }
+
+    // config changes are applied live, so the daemon doesn't have to be restarted
+    ConfigWatcher::instance()->startWatching();
+
+    // opt-in: write metrics to a file periodically, e.g., for node exporter's textfile collector
+    auto* metricsFileWriter = new MetricsFileWriter(&app);
+    metricsFileWriter->applyConfig();
+    QObject::connect(ConfigWatcher::instance(), &ConfigWatcher::configChanged, metricsFileWriter,
+                     &MetricsFileWriter::applyConfig);
+
+#ifndef BUILD_LITE
+    // opt-in: launch integrated AppImages on behalf of the binfmt_misc interpreter, saving the latter a few execs
+    auto* zygote = new LaunchZygote(&app);
+
+    auto applyZygoteConfig = [zygote]() {
+        if (!shallEnableLaunchZygote(*currentConfig())) {
+            zygote->stop();
+        } else if (!zygote->start()) {
+            std::cerr << "Could not start launch zygote, interpreter will launch AppImages on its own" << std::endl;
+        }
+    };
+
+    applyZygoteConfig();
+    QObject::connect(ConfigWatcher::instance(), &ConfigWatcher::configChanged, zygote, applyZygoteConfig);
+#endif
+
     auto* binaryUpdatesMonitor = setupBinaryUpdatesMonitor(argv);
     binaryUpdatesMonitor->start();
 
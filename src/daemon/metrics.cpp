@@ -0,0 +1,258 @@
+// system includes
+#include <fstream>
+#include <unistd.h>
+
+// library includes
+#include <QSaveFile>
+#include <QTextStream>
+#include <QVariantList>
+
+// local includes
+#include "metrics.h"
+#include "shared.h"
+
+namespace appimagelauncher::daemon {
+
+    Q_LOGGING_CATEGORY(metricsCat, "appimagelauncher.daemon.metrics")
+
+    namespace {
+        // names used in both the D-Bus properties and the Prometheus labels
+        const char* stageName(const Metrics::Stage stage) {
+            switch (stage) {
+                case Metrics::SNIFF:
+                    return "sniff";
+                case Metrics::DESKTOP_INSTALL:
+                    return "desktop_install";
+                case Metrics::INDEX_UPDATE:
+                    return "index_update";
+                case Metrics::CACHE_REFRESH:
+                    return "cache_refresh";
+                case Metrics::CLEANUP:
+                    return "cleanup";
+                default:
+                    return "unknown";
+            }
+        }
+
+        QVariantMap histogramToVariantMap(const Histogram& histogram) {
+            const auto snapshot = histogram.snapshot();
+
+            QVariantList upperBounds;
+            QVariantList buckets;
+
+            for (size_t i = 0; i < Histogram::BUCKETS.size(); ++i) {
+                upperBounds << Histogram::BUCKETS[i];
+                buckets << static_cast<qulonglong>(snapshot.buckets[i]);
+            }
+
+            QVariantMap result;
+            result.insert("count", static_cast<qulonglong>(snapshot.count));
+            result.insert("sumSeconds", snapshot.sumSeconds);
+            result.insert("upperBounds", upperBounds);
+            result.insert("buckets", buckets);
+            return result;
+        }
+
+        void writePrometheusHistogram(QTextStream& out, const QString& name, const QString& labels,
+                                      const Histogram& histogram) {
+            const auto snapshot = histogram.snapshot();
+            const auto labelPrefix = labels.isEmpty() ? QString() : labels + ",";
+            const auto labelSet = labels.isEmpty() ? QString() : "{" + labels + "}";
+
+            for (size_t i = 0; i < Histogram::BUCKETS.size(); ++i) {
+                out << name << "_bucket{" << labelPrefix << "le=\"" << Histogram::BUCKETS[i] << "\"} "
+                    << snapshot.buckets[i] << "\n";
+            }
+
+            out << name << "_bucket{" << labelPrefix << "le=\"+Inf\"} " << snapshot.buckets.back() << "\n";
+            out << name << "_sum" << labelSet << " " << snapshot.sumSeconds << "\n";
+            out << name << "_count" << labelSet << " " << snapshot.count << "\n";
+        }
+
+        void writePrometheusValue(QTextStream& out, const QString& name, const QString& type, const QString& help,
+                                  qint64 value) {
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " " << type << "\n";
+            out << name << " " << value << "\n";
+        }
+    }
+
+    void Histogram::observe(const std::chrono::nanoseconds duration) {
+        const auto seconds = std::chrono::duration<double>(duration).count();
+
+        // the buckets are cumulative, so the observation is added to all buckets it fits into
+        for (size_t i = 0; i < BUCKETS.size(); ++i) {
+            if (seconds <= BUCKETS[i]) {
+                _buckets[i].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        _buckets.back().fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sumNanoseconds.fetch_add(static_cast<uint64_t>(duration.count()), std::memory_order_relaxed);
+    }
+
+    Histogram::Snapshot Histogram::snapshot() const {
+        Snapshot snapshot;
+
+        for (size_t i = 0; i < _buckets.size(); ++i) {
+            snapshot.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+        }
+
+        snapshot.count = _count.load(std::memory_order_relaxed);
+        snapshot.sumSeconds = static_cast<double>(_sumNanoseconds.load(std::memory_order_relaxed)) / 1e9;
+
+        return snapshot;
+    }
+
+    ScopedTimer::ScopedTimer(Histogram& histogram) : _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer::~ScopedTimer() {
+        _histogram.observe(std::chrono::steady_clock::now() - _start);
+    }
+
+    Metrics& Metrics::instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    uint64_t Metrics::residentMemoryBytes() {
+        // the second field is the resident set size in pages
+        std::ifstream statm("/proc/self/statm");
+
+        uint64_t totalPages = 0;
+        uint64_t residentPages = 0;
+
+        if (!(statm >> totalPages >> residentPages)) {
+            return 0;
+        }
+
+        return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    QVariantMap Metrics::toVariantMap() const {
+        QVariantMap result;
+
+        result.insert("inotifyEventsReceived", static_cast<qulonglong>(inotifyEventsReceived.value()));
+        result.insert("inotifyEventsCoalesced", static_cast<qulonglong>(inotifyEventsCoalesced.value()));
+        result.insert("integrations", static_cast<qulonglong>(integrations.value()));
+        result.insert("unintegrations", static_cast<qulonglong>(unintegrations.value()));
+        result.insert("failedOperations", static_cast<qulonglong>(failedOperations.value()));
+        result.insert("cleanupSweeps", static_cast<qulonglong>(cleanupSweeps.value()));
+        result.insert("queueDepth", static_cast<qlonglong>(queueDepth.value()));
+        result.insert("residentMemoryBytes", static_cast<qulonglong>(residentMemoryBytes()));
+
+        QVariantMap stages;
+
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            stages.insert(stageName(static_cast<Stage>(i)), histogramToVariantMap(stageDurations[i]));
+        }
+
+        result.insert("stageDurations", stages);
+        result.insert("batchDurations", histogramToVariantMap(batchDurations));
+
+        return result;
+    }
+
+    QString Metrics::toPrometheusText() const {
+        QString text;
+        QTextStream out(&text);
+        // the default precision would round the sums off too much
+        out.setRealNumberPrecision(15);
+
+        constexpr auto prefix = "appimagelauncherd_";
+
+        writePrometheusValue(out, QString(prefix) + "inotify_events_total", "counter",
+                             "File system events reported by the watcher", inotifyEventsReceived.value());
+        writePrometheusValue(out, QString(prefix) + "inotify_events_coalesced_total", "counter",
+                             "Events merged into an operation pending already", inotifyEventsCoalesced.value());
+        writePrometheusValue(out, QString(prefix) + "integrations_total", "counter",
+                             "AppImages integrated successfully", integrations.value());
+        writePrometheusValue(out, QString(prefix) + "unintegrations_total", "counter",
+                             "AppImages unintegrated successfully", unintegrations.value());
+        writePrometheusValue(out, QString(prefix) + "failed_operations_total", "counter",
+                             "Operations which failed", failedOperations.value());
+        writePrometheusValue(out, QString(prefix) + "cleanup_sweeps_total", "counter",
+                             "Sweeps for desktop integration resources of AppImages which are gone",
+                             cleanupSweeps.value());
+        writePrometheusValue(out, QString(prefix) + "queue_depth", "gauge",
+                             "Operations waiting for the next batch, or for their batch to finish", queueDepth.value());
+        writePrometheusValue(out, QString(prefix) + "resident_memory_bytes", "gauge",
+                             "Resident set size of the daemon", static_cast<qint64>(residentMemoryBytes()));
+
+        {
+            const auto name = QString(prefix) + "stage_duration_seconds";
+            out << "# HELP " << name << " Time spent in the stages of integrating AppImages and housekeeping\n";
+            out << "# TYPE " << name << " histogram\n";
+
+            for (int i = 0; i < STAGE_COUNT; ++i) {
+                const auto labels = QString("stage=\"%1\"").arg(stageName(static_cast<Stage>(i)));
+                writePrometheusHistogram(out, name, labels, stageDurations[i]);
+            }
+        }
+
+        {
+            const auto name = QString(prefix) + "batch_duration_seconds";
+            out << "# HELP " << name << " Time spent executing a batch of deferred operations\n";
+            out << "# TYPE " << name << " histogram\n";
+            writePrometheusHistogram(out, name, QString(), batchDurations);
+        }
+
+        out.flush();
+        return text;
+    }
+
+    MetricsFileWriter::MetricsFileWriter(QObject* parent) : QObject(parent) {
+        connect(&_timer, &QTimer::timeout, this, &MetricsFileWriter::write);
+    }
+
+    void MetricsFileWriter::applyConfig() {
+        const auto config = currentConfig();
+        const auto path = daemonMetricsFilePath(*config);
+        const auto interval = daemonMetricsWriteInterval(*config);
+
+        if (path.isEmpty()) {
+            if (_timer.isActive()) {
+                qCInfo(metricsCat) << "Metrics file disabled";
+            }
+
+            _timer.stop();
+            _path.clear();
+            return;
+        }
+
+        if (path != _path || interval != _timer.intervalAsDuration()) {
+            qCInfo(metricsCat) << "Writing metrics to" << path << "every" << interval.count() << "ms";
+        }
+
+        _path = path;
+        _timer.start(interval);
+
+        // don't make the reader wait for the first interval to pass
+        write();
+    }
+
+    bool MetricsFileWriter::write() {
+        if (_path.isEmpty()) {
+            return false;
+        }
+
+        // QSaveFile writes into a temporary file, which is renamed on commit
+        QSaveFile file(_path);
+
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCWarning(metricsCat) << "Failed to open metrics file" << _path << file.errorString();
+            return false;
+        }
+
+        file.write(Metrics::instance().toPrometheusText().toUtf8());
+
+        if (!file.commit()) {
+            qCWarning(metricsCat) << "Failed to write metrics file" << _path << file.errorString();
+            return false;
+        }
+
+        return true;
+    }
+
+}
@@ -0,0 +1,174 @@
+// system includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// library includes
+#include <QLoggingCategory>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVariantMap>
+
+#pragma once
+
+namespace appimagelauncher::daemon {
+
+    Q_DECLARE_LOGGING_CATEGORY(metricsCat)
+
+    // monotonically increasing value
+    class Counter {
+    public:
+        void increment(uint64_t n = 1) {
+            _value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const {
+            return _value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> _value{0};
+    };
+
+    // value which may go up and down
+    class Gauge {
+    public:
+        void set(int64_t value) {
+            _value.store(value, std::memory_order_relaxed);
+        }
+
+        int64_t value() const {
+            return _value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t> _value{0};
+    };
+
+    /**
+     * Latency histogram with fixed buckets, modeled after Prometheus' histograms.
+     *
+     * Observations may be recorded from any thread without locking. A snapshot taken while observations are recorded
+     * may be off by the observations in flight, which is fine for monitoring purposes.
+     */
+    class Histogram {
+    public:
+        // upper bounds of the buckets in seconds, the implicit last bucket is +Inf
+        static constexpr std::array<double, 14> BUCKETS = {
+            0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+        };
+
+        struct Snapshot {
+            // cumulative, i.e., every bucket contains the observations of the previous ones, the last one is +Inf
+            std::array<uint64_t, BUCKETS.size() + 1> buckets{};
+            uint64_t count = 0;
+            double sumSeconds = 0;
+        };
+
+    public:
+        void observe(std::chrono::nanoseconds duration);
+
+        Snapshot snapshot() const;
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS.size() + 1> _buckets{};
+        std::atomic<uint64_t> _count{0};
+        std::atomic<uint64_t> _sumNanoseconds{0};
+    };
+
+    // records the time until it goes out of scope in a histogram
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Histogram& histogram);
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Histogram& _histogram;
+        const std::chrono::steady_clock::time_point _start;
+    };
+
+    /**
+     * Live counters and latency histograms of the daemon, so its behavior can be monitored without having to parse
+     * its log output.
+     *
+     * The metrics are exposed as D-Bus properties (see dbusinterface.h) and can be written to a file in Prometheus'
+     * text format periodically (see MetricsFileWriter).
+     */
+    class Metrics {
+    public:
+        // steps of integrating a single AppImage, and the daemon's housekeeping
+        enum Stage {
+            SNIFF = 0,
+            DESKTOP_INSTALL,
+            INDEX_UPDATE,
+            CACHE_REFRESH,
+            CLEANUP,
+            STAGE_COUNT,
+        };
+
+    public:
+        static Metrics& instance();
+
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+    public:
+        // file system events reported by the watcher
+        Counter inotifyEventsReceived;
+        // events which were merged into an operation pending already
+        Counter inotifyEventsCoalesced;
+
+        Counter integrations;
+        Counter unintegrations;
+        Counter failedOperations;
+        Counter cleanupSweeps;
+
+        // operations waiting for the next batch, or for their batch to finish
+        Gauge queueDepth;
+
+        std::array<Histogram, STAGE_COUNT> stageDurations;
+        Histogram batchDurations;
+
+    public:
+        Histogram& stage(Stage stage) {
+            return stageDurations[stage];
+        }
+
+        // resident set size of the daemon process in bytes, 0 if it can't be determined
+        static uint64_t residentMemoryBytes();
+
+        QVariantMap toVariantMap() const;
+
+        QString toPrometheusText() const;
+
+    private:
+        Metrics() = default;
+    };
+
+    /**
+     * Writes the metrics to the file configured in the config file periodically. Meant to be picked up by e.g., node
+     * exporter's textfile collector. The file is replaced atomically, so readers never see a partially written file.
+     */
+    class MetricsFileWriter : public QObject {
+        Q_OBJECT
+
+    public:
+        explicit MetricsFileWriter(QObject* parent = nullptr);
+
+    public slots:
+        // (re-)reads the path and the interval from the config file, and (re)starts or stops writing accordingly
+        void applyConfig();
+
+        bool write();
+
+    private:
+        QTimer _timer;
+        QString _path;
+    };
+
+}
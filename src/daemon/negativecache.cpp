@@ -0,0 +1,181 @@
+// system includes
+#include <utility>
+#include <sys/stat.h>
+
+// library includes
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// local includes
+#include "negativecache.h"
+
+namespace {
+    // must be bumped whenever the file format changes
+    constexpr quint32 NEGATIVE_CACHE_MAGIC = 0x41494c4e; // "AILN"
+    constexpr quint32 NEGATIVE_CACHE_VERSION = 1;
+
+    // the cache is only an optimization, we don't need to keep entries of an unlimited number of files
+    constexpr size_t NEGATIVE_CACHE_MAX_ENTRIES = 65536;
+}
+
+namespace appimagelauncher::daemon {
+
+    NegativeCache::NegativeCache(QString path) : _path(std::move(path)) {
+        load();
+    }
+
+    QString NegativeCache::defaultPath() {
+        return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+               "/appimagelauncher/daemon-negative-cache";
+    }
+
+    bool NegativeCache::contains(const QString& path) const {
+        struct stat st{};
+
+        if (stat(path.toStdString().c_str(), &st) != 0) {
+            return false;
+        }
+
+        QMutexLocker locker(&_mutex);
+
+        const auto it = _entries.find({static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)});
+
+        if (it == _entries.end()) {
+            return false;
+        }
+
+        const auto& entry = it->second;
+
+        return entry.size == static_cast<uint64_t>(st.st_size) && entry.mtimeSec == st.st_mtim.tv_sec &&
+               entry.mtimeNsec == st.st_mtim.tv_nsec;
+    }
+
+    void NegativeCache::insert(const QString& path) {
+        struct stat st{};
+
+        if (stat(path.toStdString().c_str(), &st) != 0) {
+            return;
+        }
+
+        const FileId id{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)};
+
+        QMutexLocker locker(&_mutex);
+
+        if (_entries.size() >= NEGATIVE_CACHE_MAX_ENTRIES && _entries.find(id) == _entries.end()) {
+            return;
+        }
+
+        _entries[id] = {
+            path,
+            static_cast<uint64_t>(st.st_size),
+            st.st_mtim.tv_sec,
+            st.st_mtim.tv_nsec,
+        };
+
+        _dirty = true;
+    }
+
+    void NegativeCache::remove(const QString& path) {
+        struct stat st{};
+
+        if (stat(path.toStdString().c_str(), &st) != 0) {
+            return;
+        }
+
+        const FileId id{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)};
+
+        QMutexLocker locker(&_mutex);
+
+        if (_entries.erase(id) > 0) {
+            _dirty = true;
+        }
+    }
+
+    bool NegativeCache::save() {
+        QMutexLocker locker(&_mutex);
+
+        if (!_dirty) {
+            return true;
+        }
+
+        QDir().mkpath(QFileInfo(_path).path());
+
+        // readers must never see a partially written file
+        QSaveFile file(_path);
+
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to open negative cache file for writing:" << file.errorString();
+            return false;
+        }
+
+        QDataStream stream(&file);
+        stream << NEGATIVE_CACHE_MAGIC << NEGATIVE_CACHE_VERSION << static_cast<quint32>(_entries.size());
+
+        for (const auto& pair : _entries) {
+            const auto& id = pair.first;
+            const auto& entry = pair.second;
+
+            stream << static_cast<quint64>(id.device) << static_cast<quint64>(id.inode) << entry.path
+                   << static_cast<quint64>(entry.size) << static_cast<qint64>(entry.mtimeSec)
+                   << static_cast<qint64>(entry.mtimeNsec);
+        }
+
+        if (stream.status() != QDataStream::Ok || !file.commit()) {
+            qWarning() << "Failed to write negative cache file:" << file.errorString();
+            return false;
+        }
+
+        _dirty = false;
+        return true;
+    }
+
+    void NegativeCache::load() {
+        QFile file(_path);
+
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+
+        QDataStream stream(&file);
+
+        quint32 magic = 0, version = 0, count = 0;
+        stream >> magic >> version >> count;
+
+        if (stream.status() != QDataStream::Ok || magic != NEGATIVE_CACHE_MAGIC || version != NEGATIVE_CACHE_VERSION) {
+            qDebug() << "Ignoring invalid or outdated negative cache file";
+            return;
+        }
+
+        for (quint32 i = 0; i < count && i < NEGATIVE_CACHE_MAX_ENTRIES; ++i) {
+            quint64 device, inode, size;
+            qint64 mtimeSec, mtimeNsec;
+            QString path;
+
+            stream >> device >> inode >> path >> size >> mtimeSec >> mtimeNsec;
+
+            if (stream.status() != QDataStream::Ok) {
+                qDebug() << "Negative cache file truncated";
+                break;
+            }
+
+            // entries of files which have been removed or changed in the meantime are dropped right away, so the cache
+            // doesn't grow forever
+            struct stat st{};
+
+            if (stat(path.toStdString().c_str(), &st) != 0 || static_cast<quint64>(st.st_dev) != device ||
+                static_cast<quint64>(st.st_ino) != inode) {
+                _dirty = true;
+                continue;
+            }
+
+            _entries[{device, inode}] = {path, size, mtimeSec, mtimeNsec};
+        }
+    }
+
+}
@@ -0,0 +1,79 @@
+// system includes
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// library includes
+#include <QMutex>
+#include <QString>
+
+#pragma once
+
+namespace appimagelauncher::daemon {
+
+    /**
+     * Remembers files in watched directories which have been found not to be AppImages, or which shall not be
+     * integrated (X-AppImage-Integrate=false). These files can then be skipped without asking libappimage again until
+     * they change.
+     *
+     * Files are identified by their device and inode numbers, and are considered unchanged as long as their size and
+     * modification time remain the same. The cache is persisted in the user's cache directory, so it survives daemon
+     * restarts.
+     *
+     * All methods are thread-safe, as the worker inspects files in a thread pool.
+     */
+    class NegativeCache {
+    public:
+        explicit NegativeCache(QString path = defaultPath());
+
+        NegativeCache(const NegativeCache&) = delete;
+        NegativeCache& operator=(const NegativeCache&) = delete;
+
+    public:
+        // path to the cache file within $XDG_CACHE_HOME
+        static QString defaultPath();
+
+        // checks whether the file is known not to need integration, and hasn't changed since
+        bool contains(const QString& path) const;
+
+        // records that the file doesn't need to be integrated
+        void insert(const QString& path);
+
+        // forgets about the file, so it's inspected again the next time
+        void remove(const QString& path);
+
+        // writes the cache to disk, if it has been modified since it was loaded
+        bool save();
+
+    private:
+        struct FileId {
+            uint64_t device;
+            uint64_t inode;
+
+            bool operator==(const FileId& other) const {
+                return device == other.device && inode == other.inode;
+            }
+        };
+
+        struct FileIdHash {
+            size_t operator()(const FileId& id) const {
+                return std::hash<uint64_t>()(id.device * 0x9e3779b97f4a7c15ULL ^ id.inode);
+            }
+        };
+
+        struct Entry {
+            QString path;
+            uint64_t size;
+            int64_t mtimeSec;
+            int64_t mtimeNsec;
+        };
+
+        void load();
+
+        const QString _path;
+        mutable QMutex _mutex;
+        std::unordered_map<FileId, Entry, FileIdHash> _entries;
+        bool _dirty = false;
+    };
+
+}
@@ -1,21 +1,31 @@
 // system includes
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <deque>
+#include <functional>
+#include <utility>
 
 // library includes
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
 #include <QObject>
 #include <QSysInfo>
 #include <QTimer>
 #include <QThreadPool>
+#include <QMap>
 #include <QMutexLocker>
+#include <QSet>
+#include <QStringList>
 #include <appimage/appimage.h>
 
 // local includes
 #include "worker.h"
+#include "metrics.h"
 #include "shared.h"
+#include "appimagesniffer.h"
+#include "integrationengine.h"
 
 namespace {
 
@@ -30,6 +40,11 @@ namespace {
 
 namespace appimagelauncher::daemon {
 
+    using appimagelauncher::DesktopFileBatch;
+    using appimagelauncher::IntegrationContext;
+    using appimagelauncher::IntegrationEngine;
+    using appimagelauncher::IntegrationResult;
+
     Q_LOGGING_CATEGORY(workerCat, "appimagelauncher.daemon.worker")
 
     class Worker::PrivateData {
@@ -41,60 +56,275 @@ namespace appimagelauncher::daemon {
         // std::set is unordered, therefore using std::deque to keep the order of the operations
         std::deque<Operation> deferredOperations;
 
+        // files which turned out not to need integration are skipped until they change
+        std::shared_ptr<NegativeCache> negativeCache;
+
+        // files whose unintegration has been requested explicitly via executeNow(...) rather than by file system
+        // events, these are unintegrated even if they are missing from the integration index
+        QSet<QString> requestedUnintegrations;
+
+        // operations which have been taken from the queue, but whose batches haven't finished yet
+        // only accessed from the worker's thread
+        int64_t operationsInBatches = 0;
+
+        // state shared by the tasks of a batch of operations
+        class Batch {
+        public:
+            QMutex mutex;
+
+            // the context is created in the main thread, and shared read-only by all tasks
+            const IntegrationContext context = IntegrationContext::fromApplication();
+
+            // one engine per batch, so the names reserved for the AppImages in this batch don't collide with each
+            // other
+            IntegrationEngine engine;
+
+            // the desktop files are moved into place all at once, so desktop environments reload their menus only once
+            DesktopFileBatch desktopFileBatch;
+
+            // likewise, the resource index is updated once per batch
+            DesktopResourceIndexBatch resourceIndexBatch;
+
+            std::atomic<int> integratedCount{0};
+
+            // error messages of the operations which failed, keyed by the files' paths
+            // guarded by the mutex
+            QMap<QString, QString> failures;
+
+        public:
+            // must be called with the mutex locked
+            void fail(const QString& path, const QString& message) {
+                Metrics::instance().failedOperations.increment();
+                std::cout << "ERROR: " << message.toStdString() << std::endl;
+                failures.insert(path, message);
+            }
+        };
+
         class OperationTask : public QRunnable {
         private:
             Operation operation;
-            QMutex* mutex;
+            NegativeCache* negativeCache;
+            Batch* batch;
 
         public:
-            OperationTask(const Operation& operation, QMutex* mutex) : operation(operation), mutex(mutex) {}
+            OperationTask(const Operation& operation, NegativeCache* negativeCache, Batch* batch)
+                : operation(operation), negativeCache(negativeCache), batch(batch) {}
 
             void run() override {
                 const auto& path = operation.first;
                 const auto& type = operation.second;
 
-                const auto exists = QFile::exists(path);
-                const auto appImageType = appimage_get_type(path.toStdString().c_str(), false);
-                const auto isAppImage = 0 < appImageType && appImageType <= 2;
+                auto* mutex = &batch->mutex;
+
+                if (type == INTEGRATE && negativeCache->contains(path)) {
+                    QMutexLocker mutexLocker(mutex);
+                    std::cout << "Skipping unchanged file which doesn't need to be integrated: " << path.toStdString()
+                              << std::endl;
+                    batch->failures.insert(path, "not an AppImage, or AppImage shall not be integrated");
+                    return;
+                }
 
-                if (type == INTEGRATE) {
-                    {   // Scope for Output Mutex Locker
-                        QMutexLocker mutexLocker(mutex);
-                        std::cout << "Integrating: " << path.toStdString() << std::endl;
+                if (type == UNINTEGRATE) {
+                    // also takes care of AppImages which don't exist any more
+                    const auto success = unregisterAppImage(path);
 
-                        if (!exists) {
-                            std::cout << "ERROR: file does not exist, cannot integrate" << std::endl;
-                            return;
-                        }
+                    QMutexLocker mutexLocker(mutex);
+                    std::cout << "Unintegrating: " << path.toStdString() << std::endl;
 
-                        if (!isAppImage) {
-                            std::cout << "ERROR: not an AppImage, skipping" << std::endl;
-                            return;
-                        }
+                    if (!success) {
+                        batch->fail(path, "failed to unregister AppImage");
+                    } else {
+                        Metrics::instance().unintegrations.increment();
                     }
 
-                    // check for X-AppImage-Integrate=false
-                    if (appimage_shall_not_be_integrated(path.toStdString().c_str())) {
-                        QMutexLocker mutexLocker(mutex);
-                        std::cout << "WARNING: AppImage shall not be integrated, skipping" << std::endl;
+                    return;
+                }
+
+                bool exists;
+                bool isAppImage;
+
+                {
+                    ScopedTimer timer(Metrics::instance().stage(Metrics::SNIFF));
+
+                    exists = QFile::exists(path);
+                    // most files which aren't AppImages can be ruled out without asking libappimage
+                    const auto appImageType = exists && sniffAppImageType(path) > 0 ?
+                        appimage_get_type(path.toStdString().c_str(), false) : -1;
+                    isAppImage = 0 < appImageType && appImageType <= 2;
+                }
+
+                {   // Scope for Output Mutex Locker
+                    QMutexLocker mutexLocker(mutex);
+                    std::cout << "Integrating: " << path.toStdString() << std::endl;
+
+                    if (!exists) {
+                        batch->fail(path, "file does not exist, cannot integrate");
                         return;
                     }
 
-                    if (!installDesktopFileAndIcons(path)) {
-                        QMutexLocker mutexLocker(mutex);
-                        std::cout << "ERROR: Failed to register AppImage in system" << std::endl;
+                    if (!isAppImage) {
+                        batch->fail(path, "not an AppImage, skipping");
+                        negativeCache->insert(path);
                         return;
                     }
-                } else if (type == UNINTEGRATE) {
-                    // nothing to do
+                }
+
+                // check for X-AppImage-Integrate=false
+                if (appimage_shall_not_be_integrated(path.toStdString().c_str())) {
+                    negativeCache->insert(path);
+                    QMutexLocker mutexLocker(mutex);
+                    std::cout << "WARNING: AppImage shall not be integrated, skipping" << std::endl;
+                    batch->failures.insert(path, "AppImage shall not be integrated");
+                    return;
+                }
+
+                // the engine doesn't display any dialogs, which we must not do from a worker thread anyway
+                IntegrationResult result;
+
+                {
+                    ScopedTimer timer(Metrics::instance().stage(Metrics::DESKTOP_INSTALL));
+                    result = batch->engine.installDesktopFileAndIcons(
+                        path, batch->context, &batch->desktopFileBatch, &batch->resourceIndexBatch
+                    );
+                }
+
+                {
+                    QMutexLocker mutexLocker(mutex);
+
+                    for (const auto& warning : result.warnings) {
+                        std::cout << "WARNING: " << warning.toStdString() << std::endl;
+                    }
+
+                    if (!result.success()) {
+                        batch->fail(path, "Failed to register AppImage in system: " + result.errorMessage);
+                        return;
+                    }
+                }
+
+                ++batch->integratedCount;
+                Metrics::instance().integrations.increment();
+
+                // AppImages in watched directories can be launched without any questions, therefore the binfmt
+                // interpreter may launch them directly
+                bool addedToIndex;
+
+                {
+                    ScopedTimer timer(Metrics::instance().stage(Metrics::INDEX_UPDATE));
+                    addedToIndex = addToIntegrationIndex(path);
+                }
+
+                if (!addedToIndex) {
+                    QMutexLocker mutexLocker(mutex);
+                    std::cout << "WARNING: Failed to add AppImage to integration index" << std::endl;
                 }
             }
         };
 
+        // runs a batch of operations, then commits the results and refreshes the caches
+        // this takes a while, so it runs in the background, and the main thread keeps serving D-Bus requests and
+        // collecting file system events in the meantime
+        class BatchTask : public QRunnable {
+        private:
+            std::shared_ptr<Batch> batch;
+            std::deque<Operation> operations;
+            QSet<QString> requestedUnintegrations;
+            std::shared_ptr<NegativeCache> negativeCache;
+            std::function<void(const QMap<QString, QString>&)> finished;
+
+        public:
+            BatchTask(std::shared_ptr<Batch> batch, std::deque<Operation> operations,
+                      QSet<QString> requestedUnintegrations, std::shared_ptr<NegativeCache> negativeCache,
+                      std::function<void(const QMap<QString, QString>&)> finished)
+                : batch(std::move(batch)), operations(std::move(operations)),
+                  requestedUnintegrations(std::move(requestedUnintegrations)),
+                  negativeCache(std::move(negativeCache)), finished(std::move(finished)) {}
+
+            void run() override {
+                auto& metrics = Metrics::instance();
+                ScopedTimer batchTimer(metrics.batchDurations);
+
+                // unregistering an AppImage involves scanning all desktop files, which is a waste of time for files
+                // which have never been integrated (e.g., when a directory full of other files is deleted)
+                // stale resources of AppImages which are missing from the indexes are removed by the cleanup below
+                // anyway
+                // explicit requests are always executed, the AppImage may have been integrated by someone else, e.g.,
+                // outside the watched directories
+                QSet<QString> indexedAppImagePaths;
+
+                if (std::any_of(operations.begin(), operations.end(), [this](const Operation& operation) {
+                    return operation.second == UNINTEGRATE && !requestedUnintegrations.contains(operation.first);
+                })) {
+                    indexedAppImagePaths = getIndexedAppImagePaths();
+                }
+
+                for (const auto& operation : operations) {
+                    if (operation.second == UNINTEGRATE && !requestedUnintegrations.contains(operation.first) &&
+                        !isIndexed(operation.first, indexedAppImagePaths)) {
+                        std::cout << "Not integrated, nothing to unintegrate: " << operation.first.toStdString()
+                                  << std::endl;
+                        continue;
+                    }
+
+                    auto* task = new OperationTask(operation, negativeCache.get(), batch.get());
+                    QThreadPool::globalInstance()->start(task);
+                }
+
+                // wait until all AppImages have been integrated
+                // only one batch runs at a time, so all the tasks in the global pool belong to this batch
+                QThreadPool::globalInstance()->waitForDone();
+
+                if (!batch->desktopFileBatch.commit()) {
+                    std::cout << "Failed to commit some of the desktop files" << std::endl;
+                }
+
+                if (!batch->resourceIndexBatch.commit()) {
+                    std::cout << "Failed to record desktop integration resources" << std::endl;
+                }
+
+                if (batch->integratedCount > 0) {
+                    IntegrationEngine::notifyIconsChanged();
+                }
+
+                if (!negativeCache->save()) {
+                    std::cout << "Failed to save negative cache" << std::endl;
+                }
+
+                std::cout << "Cleaning up old desktop integration files" << std::endl;
+                {
+                    ScopedTimer timer(metrics.stage(Metrics::CLEANUP));
+                    metrics.cleanupSweeps.increment();
+
+                    if (!cleanUpOldDesktopIntegrationResources(true)) {
+                        std::cout << "Failed to clean up old desktop integration files" << std::endl;
+                    }
+                }
+
+                // make sure the icons in the launcher are refreshed
+                std::cout << "Updating desktop database and icon caches" << std::endl;
+                {
+                    ScopedTimer timer(metrics.stage(Metrics::CACHE_REFRESH));
+
+                    if (!updateDesktopDatabaseAndIconCaches())
+                        std::cout << "Failed to update desktop database and icon caches" << std::endl;
+                }
+
+                std::cout << "Done" << std::endl;
+
+                // all the tasks have finished, so the failures can be read without locking the mutex
+                finished(batch->failures);
+            }
+        };
+
+    public:
+        // batches run one after another, as they share the global thread pool and the caches
+        QThreadPool batchThreadPool;
+
     public:
-        PrivateData() {
+        explicit PrivateData(std::shared_ptr<NegativeCache> negativeCache) : negativeCache(std::move(negativeCache)) {
             deferredOperationsTimer.setSingleShot(true);
             deferredOperationsTimer.setInterval(TIMEOUT);
+
+            batchThreadPool.setMaxThreadCount(1);
         }
 
     public:
@@ -114,45 +344,126 @@ namespace appimagelauncher::daemon {
 
             return false;
         }
+
+        // takes the deferred operations, keeping only the last operation for every file
+        // the tasks of a batch run concurrently, therefore multiple operations for the same file would race against
+        // each other; for instance, a file which has been deleted and recreated must end up being integrated
+        std::deque<Operation> takeCollapsedOperations() {
+            std::deque<Operation> operations;
+            QSet<QString> seenPaths;
+
+            for (auto it = deferredOperations.rbegin(); it != deferredOperations.rend(); ++it) {
+                if (seenPaths.contains(it->first)) {
+                    Metrics::instance().inotifyEventsCoalesced.increment();
+                    continue;
+                }
+
+                seenPaths.insert(it->first);
+                operations.push_front(*it);
+            }
+
+            deferredOperations.clear();
+            return operations;
+        }
+
+        // the operations count as queued until their batch has finished
+        void updateQueueDepth() {
+            Metrics::instance().queueDepth.set(static_cast<int64_t>(deferredOperations.size()) + operationsInBatches);
+        }
+
+        // the index stores absolute paths as well as canonical ones
+        static bool isIndexed(const QString& path, const QSet<QString>& indexedAppImagePaths) {
+            const QFileInfo fileInfo(path);
+            const auto canonicalPath = fileInfo.canonicalFilePath();
+
+            return indexedAppImagePaths.contains(fileInfo.absoluteFilePath()) ||
+                   (!canonicalPath.isEmpty() && indexedAppImagePaths.contains(canonicalPath));
+        }
     };
 
-    Worker::Worker(QObject* parent) : QObject(parent) {
-        d = std::make_shared<PrivateData>();
+    Worker::Worker(std::shared_ptr<NegativeCache> negativeCache, QObject* parent) : QObject(parent) {
+        d = std::make_shared<PrivateData>(std::move(negativeCache));
 
         connect(this, &Worker::startTimer, this, &Worker::startTimerIfNecessary, Qt::QueuedConnection);
         connect(&d->deferredOperationsTimer, &QTimer::timeout, this, &Worker::executeDeferredOperations);
     }
 
     void Worker::executeDeferredOperations() {
+        runBatch([](const QMap<QString, QString>&) {});
+    }
+
+    void Worker::runBatch(ResultCallback callback) {
         if (d->deferredOperations.empty()) {
             qCDebug(workerCat) << "No deferred operations to execute";
+            callback({});
             return;
         }
 
         std::cout << "Executing deferred operations" << std::endl;
 
-        QMutex outputMutex;
+        // the context reads the application's state, so the batch has to be created in the main thread
+        auto batch = std::make_shared<PrivateData::Batch>();
 
-        while (!d->deferredOperations.empty()) {
-            auto operation = d->deferredOperations.front();
-            d->deferredOperations.pop_front();
-            QThreadPool::globalInstance()->start(new PrivateData::OperationTask(operation, &outputMutex));
+        for (const auto& warning : batch->context.warnings) {
+            std::cout << "WARNING: " << warning.toStdString() << std::endl;
         }
 
-        // wait until all AppImages have been integrated
-        QThreadPool::globalInstance()->waitForDone();
+        auto operations = d->takeCollapsedOperations();
 
-        std::cout << "Cleaning up old desktop integration files" << std::endl;
-        if (!cleanUpOldDesktopIntegrationResources(true)) {
-            std::cout << "Failed to clean up old desktop integration files" << std::endl;
+        auto requestedUnintegrations = std::move(d->requestedUnintegrations);
+        d->requestedUnintegrations.clear();
+
+        const auto operationCount = static_cast<int64_t>(operations.size());
+        d->operationsInBatches += operationCount;
+        d->updateQueueDepth();
+
+        // the callback is run in the worker's thread
+        // if the worker is destroyed in the meantime, the callback is discarded
+        auto finished = [this, operationCount, callback = std::move(callback)](const QMap<QString, QString>& failures) {
+            QMetaObject::invokeMethod(this, [this, operationCount, callback, failures]() {
+                d->operationsInBatches -= operationCount;
+                d->updateQueueDepth();
+
+                callback(failures);
+            }, Qt::QueuedConnection);
+        };
+
+        d->batchThreadPool.start(new PrivateData::BatchTask(
+            std::move(batch), std::move(operations), std::move(requestedUnintegrations), d->negativeCache,
+            std::move(finished)
+        ));
+    }
+
+    void Worker::executeNow(const QStringList& paths, const bool integrate, ResultCallback callback) {
+        // the requested operations are executed along with all the operations which have been deferred so far
+        // they are the most recent ones, so they take precedence over deferred operations for the same files
+        for (const auto& path : paths) {
+            // an explicit request always overrides the negative cache
+            if (integrate) {
+                d->negativeCache->remove(path);
+                d->requestedUnintegrations.remove(path);
+            } else {
+                d->requestedUnintegrations.insert(path);
+            }
+
+            d->deferredOperations.emplace_back(path, integrate ? INTEGRATE : UNINTEGRATE);
         }
 
-        // make sure the icons in the launcher are refreshed
-        std::cout << "Updating desktop database and icon caches" << std::endl;
-        if (!updateDesktopDatabaseAndIconCaches())
-            std::cout << "Failed to update desktop database and icon caches" << std::endl;
+        d->updateQueueDepth();
+        d->deferredOperationsTimer.stop();
+
+        runBatch([paths, callback = std::move(callback)](const QMap<QString, QString>& failures) {
+            // the caller is only interested in the files it asked for
+            QMap<QString, QString> requestedFailures;
+
+            for (const auto& path : paths) {
+                if (failures.contains(path)) {
+                    requestedFailures.insert(path, failures.value(path));
+                }
+            }
 
-        std::cout << "Done" << std::endl;
+            callback(requestedFailures);
+        });
     }
 
     void Worker::scheduleForIntegration(const QString& path) {
@@ -160,7 +471,10 @@ namespace appimagelauncher::daemon {
         if (!d->isDuplicate(operation)) {
             std::cout << "Scheduling for (re-)integration: " << path.toStdString() << std::endl;
             d->deferredOperations.push_back(operation);
+            d->updateQueueDepth();
             emit startTimer();
+        } else {
+            Metrics::instance().inotifyEventsCoalesced.increment();
         }
 
     }
@@ -170,7 +484,10 @@ namespace appimagelauncher::daemon {
         if (!d->isDuplicate(operation)) {
             std::cout << "Scheduling for unintegration: " << path.toStdString() << std::endl;
             d->deferredOperations.push_back(operation);
+            d->updateQueueDepth();
             emit startTimer();
+        } else {
+            Metrics::instance().inotifyEventsCoalesced.increment();
         }
     }
 
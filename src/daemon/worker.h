@@ -1,12 +1,18 @@
 // system includes
+#include <functional>
 #include <memory>
 
 // library includes
+#include <QMap>
 #include <QObject>
 #include <QLoggingCategory>
+#include <QStringList>
 
 #pragma once
 
+// local includes
+#include "negativecache.h"
+
 namespace appimagelauncher::daemon {
 
     Q_DECLARE_LOGGING_CATEGORY(workerCat)
@@ -19,7 +25,7 @@ namespace appimagelauncher::daemon {
         std::shared_ptr<PrivateData> d = nullptr;
 
     public:
-        explicit Worker(QObject* parent = nullptr);
+        explicit Worker(std::shared_ptr<NegativeCache> negativeCache, QObject* parent = nullptr);
 
     signals:
         void startTimer();
@@ -28,9 +34,22 @@ namespace appimagelauncher::daemon {
         void scheduleForIntegration(const QString& path);
         void scheduleForUnintegration(const QString& path);
 
+    public:
+        // receives the error messages of the operations which failed, keyed by the files' paths
+        typedef std::function<void(const QMap<QString, QString>& failures)> ResultCallback;
+
     public slots:
+        // starts a batch with the operations deferred so far, which runs in the background
         void executeDeferredOperations();
 
+    public:
+        // (un)integrates the given files right away, rather than waiting for the next batch
+        // the callback is called in the worker's thread once the batch has finished
+        void executeNow(const QStringList& paths, bool integrate, ResultCallback callback);
+
+    private:
+        void runBatch(ResultCallback callback);
+
     private slots:
         void startTimerIfNecessary();
     };
@@ -0,0 +1,381 @@
+// system headers
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// own headers
+#include "integrationindex.h"
+
+namespace appimagelauncher {
+
+    namespace {
+
+        // the index is a per-host, per-user cache file, so we can just use the native byte order
+        // the version must be bumped whenever the layout changes; readers ignore files with an unknown version
+        constexpr char indexMagic[8] = {'A', 'I', 'L', 'I', 'D', 'X', '\0', '\0'};
+        constexpr uint32_t indexVersion = 1;
+
+        struct RawHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t entryCount;
+            int64_t configMTimeSec;
+            int64_t configMTimeNsec;
+            uint64_t stringTableOffset;
+            uint64_t stringTableSize;
+        };
+
+        // entries are sorted by AppImage path, which allows for binary searches
+        struct RawEntry {
+            uint64_t device;
+            uint64_t inode;
+            uint64_t size;
+            int64_t mtimeSec;
+            int64_t mtimeNsec;
+            uint32_t appImagePathOffset;
+            uint32_t appImagePathLength;
+            uint32_t desktopFilePathOffset;
+            uint32_t desktopFilePathLength;
+        };
+
+        // returns the value of an XDG base directory variable, or the fallback within $HOME
+        // like QStandardPaths, we ignore relative paths
+        std::string xdgDirectory(const char* variableName, const char* fallbackSubdir) {
+            const char* value = getenv(variableName);
+
+            if (value != nullptr && value[0] == '/') {
+                return value;
+            }
+
+            const char* home = getenv("HOME");
+
+            if (home == nullptr || home[0] != '/') {
+                return "";
+            }
+
+            return std::string(home) + "/" + fallbackSubdir;
+        }
+
+        // returns the modification time of the config file, or zeroes if it does not exist
+        void configFileMTime(int64_t& sec, int64_t& nsec) {
+            sec = 0;
+            nsec = 0;
+
+            const auto configFilePath = defaultConfigFilePath();
+
+            struct stat st{};
+            if (configFilePath.empty() || stat(configFilePath.c_str(), &st) != 0) {
+                return;
+            }
+
+            sec = st.st_mtim.tv_sec;
+            nsec = st.st_mtim.tv_nsec;
+        }
+
+        bool sameFile(const RawEntry& entry, const struct stat& st) {
+            return entry.device == static_cast<uint64_t>(st.st_dev) &&
+                   entry.inode == static_cast<uint64_t>(st.st_ino) &&
+                   entry.size == static_cast<uint64_t>(st.st_size) &&
+                   entry.mtimeSec == st.st_mtim.tv_sec &&
+                   entry.mtimeNsec == st.st_mtim.tv_nsec;
+        }
+    }
+
+    std::string defaultIntegrationIndexPath() {
+        const auto cacheDir = xdgDirectory("XDG_CACHE_HOME", ".cache");
+
+        if (cacheDir.empty()) {
+            return "";
+        }
+
+        return cacheDir + "/appimagelauncher/integration-index";
+    }
+
+    std::string defaultConfigFilePath() {
+        const auto configDir = xdgDirectory("XDG_CONFIG_HOME", ".config");
+
+        if (configDir.empty()) {
+            return "";
+        }
+
+        return configDir + "/appimagelauncher.cfg";
+    }
+
+    IntegrationIndex::IntegrationIndex(const std::string& path) {
+        if (path.empty()) {
+            return;
+        }
+
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st{};
+
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(RawHeader))) {
+            close(fd);
+            return;
+        }
+
+        auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // the mapping stays valid after closing the file descriptor
+        close(fd);
+
+        if (data == MAP_FAILED) {
+            return;
+        }
+
+        _data = data;
+        _size = st.st_size;
+
+        const auto* header = static_cast<const RawHeader*>(_data);
+
+        if (memcmp(header->magic, indexMagic, sizeof(indexMagic)) != 0 || header->version != indexVersion) {
+            return;
+        }
+
+        // make sure all the offsets are within the mapped area, so we don't have to check that in every lookup
+        const uint64_t entriesEnd = sizeof(RawHeader) + uint64_t(header->entryCount) * sizeof(RawEntry);
+
+        if (entriesEnd > _size || header->stringTableOffset < entriesEnd ||
+            header->stringTableOffset + header->stringTableSize > _size) {
+            return;
+        }
+
+        const auto* rawEntries = reinterpret_cast<const RawEntry*>(header + 1);
+
+        for (uint32_t i = 0; i < header->entryCount; ++i) {
+            const auto& entry = rawEntries[i];
+
+            if (uint64_t(entry.appImagePathOffset) + entry.appImagePathLength > header->stringTableSize ||
+                uint64_t(entry.desktopFilePathOffset) + entry.desktopFilePathLength > header->stringTableSize) {
+                return;
+            }
+        }
+
+        // any change to the config may change the launch decision, e.g., when the integration destination changes
+        int64_t configMTimeSec, configMTimeNsec;
+        configFileMTime(configMTimeSec, configMTimeNsec);
+
+        if (header->configMTimeSec != configMTimeSec || header->configMTimeNsec != configMTimeNsec) {
+            return;
+        }
+
+        _valid = true;
+    }
+
+    IntegrationIndex::~IntegrationIndex() {
+        if (_data != nullptr) {
+            munmap(const_cast<void*>(_data), _size);
+        }
+    }
+
+    bool IntegrationIndex::isValid() const {
+        return _valid;
+    }
+
+    bool IntegrationIndex::isIntegratedAndUpToDate(const std::string& canonicalPath, int64_t launcherMTimeSec) const {
+        if (!_valid) {
+            return false;
+        }
+
+        const auto* header = static_cast<const RawHeader*>(_data);
+        const auto* rawEntries = reinterpret_cast<const RawEntry*>(header + 1);
+        const auto* strings = static_cast<const char*>(_data) + header->stringTableOffset;
+
+        // binary search for the path
+        const auto* end = rawEntries + header->entryCount;
+        const auto* it = std::lower_bound(rawEntries, end, canonicalPath, [strings](const RawEntry& entry, const std::string& path) {
+            return path.compare(0, std::string::npos, strings + entry.appImagePathOffset, entry.appImagePathLength) > 0;
+        });
+
+        if (it == end || canonicalPath.compare(0, std::string::npos, strings + it->appImagePathOffset, it->appImagePathLength) != 0) {
+            return false;
+        }
+
+        struct stat appImageStat{};
+        if (stat(canonicalPath.c_str(), &appImageStat) != 0 || !sameFile(*it, appImageStat)) {
+            return false;
+        }
+
+        // the desktop file must still exist, and must have been updated after the launcher (otherwise, the launcher
+        // would update it)
+        const std::string desktopFilePath(strings + it->desktopFilePathOffset, it->desktopFilePathLength);
+
+        struct stat desktopFileStat{};
+        if (stat(desktopFilePath.c_str(), &desktopFileStat) != 0) {
+            return false;
+        }
+
+        return desktopFileStat.st_mtim.tv_sec > launcherMTimeSec;
+    }
+
+    std::vector<IntegrationIndexEntry> IntegrationIndex::entries() const {
+        std::vector<IntegrationIndexEntry> rv;
+
+        if (!_valid) {
+            return rv;
+        }
+
+        const auto* header = static_cast<const RawHeader*>(_data);
+        const auto* rawEntries = reinterpret_cast<const RawEntry*>(header + 1);
+        const auto* strings = static_cast<const char*>(_data) + header->stringTableOffset;
+
+        rv.reserve(header->entryCount);
+
+        for (uint32_t i = 0; i < header->entryCount; ++i) {
+            const auto& raw = rawEntries[i];
+
+            IntegrationIndexEntry entry;
+            entry.appImagePath.assign(strings + raw.appImagePathOffset, raw.appImagePathLength);
+            entry.desktopFilePath.assign(strings + raw.desktopFilePathOffset, raw.desktopFilePathLength);
+            entry.device = raw.device;
+            entry.inode = raw.inode;
+            entry.size = raw.size;
+            entry.mtimeSec = raw.mtimeSec;
+            entry.mtimeNsec = raw.mtimeNsec;
+
+            rv.emplace_back(std::move(entry));
+        }
+
+        return rv;
+    }
+
+    bool makeIntegrationIndexEntry(const std::string& appImagePath, const std::string& desktopFilePath,
+                                   IntegrationIndexEntry& entry) {
+        struct stat st{};
+
+        if (stat(appImagePath.c_str(), &st) != 0) {
+            return false;
+        }
+
+        entry.appImagePath = appImagePath;
+        entry.desktopFilePath = desktopFilePath;
+        entry.device = st.st_dev;
+        entry.inode = st.st_ino;
+        entry.size = st.st_size;
+        entry.mtimeSec = st.st_mtim.tv_sec;
+        entry.mtimeNsec = st.st_mtim.tv_nsec;
+
+        return true;
+    }
+
+    bool integrationIndexEntryIsCurrent(const IntegrationIndexEntry& entry) {
+        IntegrationIndexEntry current;
+
+        if (!makeIntegrationIndexEntry(entry.appImagePath, entry.desktopFilePath, current)) {
+            return false;
+        }
+
+        if (access(entry.desktopFilePath.c_str(), F_OK) != 0) {
+            return false;
+        }
+
+        return current.device == entry.device && current.inode == entry.inode && current.size == entry.size &&
+               current.mtimeSec == entry.mtimeSec && current.mtimeNsec == entry.mtimeNsec;
+    }
+
+    bool writeIntegrationIndex(const std::string& path, std::vector<IntegrationIndexEntry> entries) {
+        if (path.empty()) {
+            return false;
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const IntegrationIndexEntry& a, const IntegrationIndexEntry& b) {
+            return a.appImagePath < b.appImagePath;
+        });
+
+        // there must not be any duplicates, otherwise the binary search might find the outdated one
+        entries.erase(std::unique(entries.begin(), entries.end(), [](const IntegrationIndexEntry& a, const IntegrationIndexEntry& b) {
+            return a.appImagePath == b.appImagePath;
+        }), entries.end());
+
+        RawHeader header{};
+        memcpy(header.magic, indexMagic, sizeof(indexMagic));
+        header.version = indexVersion;
+        header.entryCount = static_cast<uint32_t>(entries.size());
+        configFileMTime(header.configMTimeSec, header.configMTimeNsec);
+        header.stringTableOffset = sizeof(RawHeader) + entries.size() * sizeof(RawEntry);
+
+        std::vector<RawEntry> rawEntries;
+        rawEntries.reserve(entries.size());
+
+        std::string strings;
+
+        for (const auto& entry : entries) {
+            RawEntry raw{};
+            raw.device = entry.device;
+            raw.inode = entry.inode;
+            raw.size = entry.size;
+            raw.mtimeSec = entry.mtimeSec;
+            raw.mtimeNsec = entry.mtimeNsec;
+
+            raw.appImagePathOffset = static_cast<uint32_t>(strings.size());
+            raw.appImagePathLength = static_cast<uint32_t>(entry.appImagePath.size());
+            strings += entry.appImagePath;
+
+            raw.desktopFilePathOffset = static_cast<uint32_t>(strings.size());
+            raw.desktopFilePathLength = static_cast<uint32_t>(entry.desktopFilePath.size());
+            strings += entry.desktopFilePath;
+
+            rawEntries.emplace_back(raw);
+        }
+
+        header.stringTableSize = strings.size();
+
+        // make sure the cache directory exists (we don't need to create $XDG_CACHE_HOME itself recursively, it
+        // exists on any reasonable system)
+        const auto dirPath = path.substr(0, path.rfind('/'));
+        if (mkdir(dirPath.c_str(), 0700) != 0 && errno != EEXIST) {
+            return false;
+        }
+
+        // write to a temporary file next to the index and rename it afterwards, so readers never see partial data
+        std::string tempPath = path + ".XXXXXX";
+        const int fd = mkostemp(&tempPath[0], O_CLOEXEC);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        auto writeAll = [fd](const void* data, size_t size) {
+            const auto* p = static_cast<const char*>(data);
+
+            while (size > 0) {
+                const auto written = write(fd, p, size);
+
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    return false;
+                }
+
+                p += written;
+                size -= written;
+            }
+
+            return true;
+        };
+
+        const bool success = writeAll(&header, sizeof(header)) &&
+                             writeAll(rawEntries.data(), rawEntries.size() * sizeof(RawEntry)) &&
+                             writeAll(strings.data(), strings.size());
+
+        if (close(fd) != 0 || !success || rename(tempPath.c_str(), path.c_str()) != 0) {
+            unlink(tempPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+}
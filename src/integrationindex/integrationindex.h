@@ -0,0 +1,112 @@
+#pragma once
+
+// system headers
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+ * The integration index is a small binary file which lists the AppImages that have been integrated into the system and
+ * reside in a location where AppImageLauncher does not need to ask any questions before launching them.
+ *
+ * It is written by the Qt based components (AppImageLauncher, appimagelauncherd, ail-cli) and read by the statically
+ * linked binfmt_misc interpreter, which cannot afford to initialize Qt just to find out that there is nothing to do
+ * but launch the AppImage. Therefore, this library must not depend on Qt or any other non-system library.
+ */
+
+namespace appimagelauncher {
+
+    struct IntegrationIndexEntry {
+        // canonical path to the integrated AppImage
+        std::string appImagePath;
+        // desktop file installed for the AppImage
+        std::string desktopFilePath;
+
+        // identity of the AppImage file at the time it was recorded
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtimeSec = 0;
+        int64_t mtimeNsec = 0;
+    };
+
+    /**
+     * Calculate path to the user's integration index file (within $XDG_CACHE_HOME).
+     * @return path to index file, or empty string if no suitable location can be found
+     */
+    std::string defaultIntegrationIndexPath();
+
+    /**
+     * Calculate path to AppImageLauncher's config file (within $XDG_CONFIG_HOME).
+     * The index is invalidated whenever the config file changes, as the config affects the launch decision.
+     * @return path to config file, or empty string if no suitable location can be found
+     */
+    std::string defaultConfigFilePath();
+
+    /**
+     * Read-only view of an integration index file. The file is mapped into memory, lookups do not allocate.
+     */
+    class IntegrationIndex {
+    public:
+        explicit IntegrationIndex(const std::string& path);
+        ~IntegrationIndex();
+
+        IntegrationIndex(const IntegrationIndex&) = delete;
+        IntegrationIndex& operator=(const IntegrationIndex&) = delete;
+
+    public:
+        /**
+         * Check whether the index could be loaded and matches the current config file.
+         * @return true if the index can be used, false otherwise
+         */
+        bool isValid() const;
+
+        /**
+         * Check whether an AppImage is known to be integrated, and whether that integration is up to date.
+         * This is the case if the file listed in the index is still the same file, its desktop file exists and the
+         * desktop file has been updated after the launcher binary.
+         * @param canonicalPath canonical path to the AppImage
+         * @param launcherMTimeSec modification time of the launcher binary
+         * @return true if the AppImage can be launched without asking the user anything, false otherwise
+         */
+        bool isIntegratedAndUpToDate(const std::string& canonicalPath, int64_t launcherMTimeSec) const;
+
+        /**
+         * Copy all entries from the index. Used when updating the index.
+         * @return list of entries
+         */
+        std::vector<IntegrationIndexEntry> entries() const;
+
+    private:
+        const void* _data = nullptr;
+        size_t _size = 0;
+        bool _valid = false;
+    };
+
+    /**
+     * Create a new entry for a file, filling in its identity.
+     * @param appImagePath canonical path to the AppImage
+     * @param desktopFilePath path to the AppImage's desktop file
+     * @param entry entry to fill in
+     * @return true on success, false if the file cannot be stat()ed
+     */
+    bool makeIntegrationIndexEntry(const std::string& appImagePath, const std::string& desktopFilePath,
+                                   IntegrationIndexEntry& entry);
+
+    /**
+     * Check whether an entry still describes the file on disk.
+     * @param entry entry to check
+     * @return true if the AppImage and its desktop file still exist and the AppImage has not been modified
+     */
+    bool integrationIndexEntryIsCurrent(const IntegrationIndexEntry& entry);
+
+    /**
+     * Write an index file atomically, i.e., readers will either see the old or the new index.
+     * @param path path to index file
+     * @param entries entries to store
+     * @return true on success, false otherwise
+     */
+    bool writeIntegrationIndex(const std::string& path, std::vector<IntegrationIndexEntry> entries);
+
+}
@@ -0,0 +1,64 @@
+// system includes
+#include <cerrno>
+#include <cstring>
+extern "C" {
+    #include <fcntl.h>
+    #include <unistd.h>
+}
+
+// local headers
+#include "appimagesniffer.h"
+
+// the magic bytes are read with a single system call, there's no need for any buffering
+static int sniffMagicBytes(const char* path) {
+    // reading the file shouldn't update its access time, the files are scanned quite often
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+
+    // O_NOATIME is only permitted for files owned by the current user
+    if (fd < 0 && errno == EPERM) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    unsigned char header[16];
+    ssize_t bytesRead;
+
+    do {
+        bytesRead = pread(fd, header, sizeof(header), 0);
+    } while (bytesRead < 0 && errno == EINTR);
+
+    close(fd);
+
+    if (bytesRead != sizeof(header)) {
+        return -1;
+    }
+
+    if (memcmp(header, "\x7f" "ELF", 4) != 0 || header[8] != 'A' || header[9] != 'I') {
+        return -1;
+    }
+
+    if (header[10] != 1 && header[10] != 2) {
+        return -1;
+    }
+
+    return header[10];
+}
+
+int sniffAppImageType(const QString& path) {
+    return sniffMagicBytes(path.toUtf8().constData());
+}
+
+QStringList filterPotentialAppImages(const QStringList& paths) {
+    QStringList rv;
+
+    for (const auto& path : paths) {
+        if (sniffAppImageType(path) > 0) {
+            rv << path;
+        }
+    }
+
+    return rv;
+}
@@ -0,0 +1,20 @@
+/*
+ * Fast pre-filter for AppImages
+ *
+ * libappimage opens and inspects every file passed to appimage_get_type(...), which is rather expensive when scanning
+ * directories which contain lots of other files (ISO images, tarballs, partial downloads, ...). The sniffer just reads
+ * the first 16 bytes of a file and checks for the ELF magic and the AppImage magic bytes at offset 8, which is the same
+ * rule the binfmt_misc config uses. Only files which pass this check need to be inspected by libappimage.
+ */
+
+#pragma once
+
+// library headers
+#include <QString>
+#include <QStringList>
+
+// returns the AppImage type announced by the file's magic bytes (1 or 2), or -1 if the file cannot be an AppImage
+int sniffAppImageType(const QString& path);
+
+// returns the paths of the files which may be AppImages, keeping their order
+QStringList filterPotentialAppImages(const QStringList& paths);
@@ -0,0 +1,234 @@
+// system includes
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+extern "C" {
+    #include <sys/inotify.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+// library includes
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QSocketNotifier>
+#include <QTimer>
+
+// local headers
+#include "config.h"
+#include "shared.h"
+#include "tracing.h"
+
+namespace {
+    // keys whose values may start with ~, which is expanded to the user's home directory
+    const char* const KEYS_CONTAINING_PATHS[] = {
+        "AppImageLauncher/destination",
+    };
+
+    // interval in which the config file's metadata is compared if inotify isn't available
+    constexpr int POLL_INTERVAL_MSEC = 5000;
+
+    class ConfigState {
+    public:
+        QMutex mutex;
+
+        QString path;
+        ConfigSnapshotPtr snapshot;
+
+        int inotifyFd = -1;
+
+        // used if no inotify watch can be set up (e.g., because the config directory doesn't exist yet)
+        struct stat lastStat{};
+        bool lastStatValid = false;
+
+        ConfigWatcher* watcher = nullptr;
+
+    public:
+        ConfigState() : path(getConfigFilePath()) {
+            inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+            if (inotifyFd < 0) {
+                return;
+            }
+
+            // the directory is watched rather than the file, as the file may be replaced (e.g., by QSettings)
+            const auto dirPath = QFileInfo(path).path().toStdString();
+            const auto mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+            if (inotify_add_watch(inotifyFd, dirPath.c_str(), mask) < 0) {
+                close(inotifyFd);
+                inotifyFd = -1;
+            }
+        }
+
+        // returns true if the config file might have changed since the last call
+        bool configFileChanged() {
+            if (inotifyFd >= 0) {
+                return drainInotifyEvents();
+            }
+
+            struct stat st{};
+            const bool statValid = stat(path.toStdString().c_str(), &st) == 0;
+
+            const bool changed = statValid != lastStatValid || (statValid && (
+                st.st_ino != lastStat.st_ino || st.st_size != lastStat.st_size ||
+                st.st_mtim.tv_sec != lastStat.st_mtim.tv_sec || st.st_mtim.tv_nsec != lastStat.st_mtim.tv_nsec
+            ));
+
+            lastStat = st;
+            lastStatValid = statValid;
+
+            return changed;
+        }
+
+    private:
+        bool drainInotifyEvents() {
+            const auto fileName = QFileInfo(path).fileName().toStdString();
+
+            bool changed = false;
+
+            alignas(struct inotify_event) char buffer[4096];
+
+            for (;;) {
+                const auto rv = read(inotifyFd, buffer, sizeof(buffer));
+
+                if (rv <= 0) {
+                    // EAGAIN: no more events
+                    break;
+                }
+
+                for (char* p = buffer; p < buffer + rv;) {
+                    const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+
+                    // if events have been lost, we have to assume the file has changed
+                    if ((event->mask & IN_Q_OVERFLOW) != 0 || (event->len > 0 && fileName == event->name)) {
+                        changed = true;
+                    }
+
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+
+            return changed;
+        }
+    };
+
+    ConfigState& configState() {
+        static ConfigState state;
+        return state;
+    }
+}
+
+ConfigSnapshotPtr ConfigSnapshot::fromFile(const QString& path) {
+    appimagelauncher::TraceSpan span("config load");
+
+    auto snapshot = std::make_shared<ConfigSnapshot>();
+
+    if (!QFileInfo(path).isFile()) {
+        return snapshot;
+    }
+
+    const QSettings settings(path, QSettings::IniFormat);
+
+    snapshot->_exists = true;
+
+    for (const auto& key : settings.allKeys()) {
+        snapshot->_values.insert(key, settings.value(key));
+    }
+
+    for (const auto* key : KEYS_CONTAINING_PATHS) {
+        if (snapshot->_values.contains(key)) {
+            snapshot->_values[key] = expandTilde(snapshot->_values[key].toString());
+        }
+    }
+
+    return snapshot;
+}
+
+bool ConfigSnapshot::exists() const {
+    return _exists;
+}
+
+bool ConfigSnapshot::contains(const QString& key) const {
+    return _values.contains(key);
+}
+
+QVariant ConfigSnapshot::value(const QString& key, const QVariant& defaultValue) const {
+    return _values.value(key, defaultValue);
+}
+
+ConfigSnapshotPtr currentConfig() {
+    auto& state = configState();
+
+    ConfigSnapshotPtr snapshot;
+    ConfigWatcher* watcher;
+
+    {
+        QMutexLocker locker(&state.mutex);
+
+        const bool changed = state.configFileChanged();
+
+        if (state.snapshot != nullptr && !changed) {
+            return state.snapshot;
+        }
+
+        const bool isInitialLoad = state.snapshot == nullptr;
+
+        state.snapshot = ConfigSnapshot::fromFile(state.path);
+        snapshot = state.snapshot;
+
+        // nobody can have seen a previous snapshot on the initial load
+        watcher = isInitialLoad ? nullptr : state.watcher;
+    }
+
+    if (watcher != nullptr) {
+        emit watcher->configChanged();
+    }
+
+    return snapshot;
+}
+
+ConfigWatcher::ConfigWatcher(QObject* parent) : QObject(parent) {}
+
+ConfigWatcher* ConfigWatcher::instance() {
+    static auto* instance = [] {
+        auto* watcher = new ConfigWatcher(QCoreApplication::instance());
+
+        auto& state = configState();
+        QMutexLocker locker(&state.mutex);
+        state.watcher = watcher;
+
+        return watcher;
+    }();
+
+    return instance;
+}
+
+void ConfigWatcher::startWatching() {
+    auto& state = configState();
+
+    // make sure the initial snapshot exists, so the first change is reported properly
+    currentConfig();
+
+    if (state.inotifyFd >= 0) {
+        auto* notifier = new QSocketNotifier(state.inotifyFd, QSocketNotifier::Read, this);
+
+        connect(notifier, &QSocketNotifier::activated, this, []() {
+            currentConfig();
+        });
+    } else {
+        std::cerr << "Warning: cannot watch config file with inotify, checking for changes periodically" << std::endl;
+
+        auto* timer = new QTimer(this);
+        timer->setInterval(POLL_INTERVAL_MSEC);
+
+        connect(timer, &QTimer::timeout, this, []() {
+            currentConfig();
+        });
+
+        timer->start();
+    }
+}
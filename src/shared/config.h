@@ -0,0 +1,74 @@
+/*
+ * Config snapshots
+ *
+ * The config file is parsed once into an immutable snapshot, which can be shared freely between threads. Whenever the
+ * file changes, a new snapshot is created and replaces the current one atomically, while users of the old snapshot
+ * can continue to use it safely.
+ *
+ * Changes are detected with a non-blocking inotify watch on the config directory, so checking for changes is just a
+ * single read(...) call that usually returns EAGAIN. If inotify is not available, the file's metadata is compared
+ * instead.
+ */
+
+#pragma once
+
+// system headers
+#include <memory>
+
+// library headers
+#include <QDir>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QVariant>
+
+class ConfigSnapshot {
+public:
+    // snapshot of a config file which doesn't exist
+    ConfigSnapshot() = default;
+
+    // parses the config file
+    static std::shared_ptr<const ConfigSnapshot> fromFile(const QString& path);
+
+public:
+    // whether the config file existed when the snapshot was made
+    bool exists() const;
+
+    bool contains(const QString& key) const;
+
+    // same semantics as QSettings::value(...)
+    QVariant value(const QString& key, const QVariant& defaultValue = QVariant()) const;
+
+private:
+    bool _exists = false;
+    QHash<QString, QVariant> _values;
+};
+
+typedef std::shared_ptr<const ConfigSnapshot> ConfigSnapshotPtr;
+
+// returns the current config snapshot, parsing the config file again only if it has changed
+// cheap enough to be called whenever a config value is needed, and safe to be called from any thread
+ConfigSnapshotPtr currentConfig();
+
+/**
+ * Notifies about config changes. Long-running processes (e.g., the daemon) use this to apply changes without having to
+ * be restarted.
+ */
+class ConfigWatcher : public QObject {
+    Q_OBJECT
+
+public:
+    // must be called from the main thread first
+    static ConfigWatcher* instance();
+
+    // starts monitoring the config file within the event loop, so changes are noticed even if currentConfig() is not
+    // called in the meantime
+    void startWatching();
+
+signals:
+    // emitted whenever a new snapshot has replaced the previous one, possibly from another thread
+    void configChanged();
+
+private:
+    explicit ConfigWatcher(QObject* parent = nullptr);
+};
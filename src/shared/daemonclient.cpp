@@ -0,0 +1,77 @@
+// system includes
+#include <iostream>
+
+// library includes
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusInterface>
+#include <QDBusReply>
+
+// local headers
+#include "daemonclient.h"
+
+namespace {
+    // integrating many AppImages can take a while, and the daemon replies only once it's done
+    constexpr int DAEMON_CALL_TIMEOUT_MSEC = 10 * 60 * 1000;
+
+    template<typename T>
+    std::optional<T> callDaemon(const char* method, const QVariant& argument) {
+        if (!appimagelauncher::DaemonClient::isAvailable()) {
+            return std::nullopt;
+        }
+
+        QDBusInterface interface(
+            appimagelauncher::DAEMON_DBUS_SERVICE,
+            appimagelauncher::DAEMON_DBUS_PATH,
+            appimagelauncher::DAEMON_DBUS_INTERFACE,
+            QDBusConnection::sessionBus()
+        );
+
+        if (!interface.isValid()) {
+            return std::nullopt;
+        }
+
+        interface.setTimeout(DAEMON_CALL_TIMEOUT_MSEC);
+
+        const QDBusReply<T> reply = argument.isValid() ? interface.call(method, argument) : interface.call(method);
+
+        if (!reply.isValid()) {
+            std::cerr << "Calling " << method << " on daemon failed: " << reply.error().message().toStdString()
+                      << std::endl;
+            return std::nullopt;
+        }
+
+        return reply.value();
+    }
+}
+
+namespace appimagelauncher {
+
+    bool DaemonClient::isAvailable() {
+        const auto connection = QDBusConnection::sessionBus();
+
+        if (!connection.isConnected()) {
+            return false;
+        }
+
+        const auto* busInterface = connection.interface();
+        return busInterface != nullptr && busInterface->isServiceRegistered(DAEMON_DBUS_SERVICE);
+    }
+
+    std::optional<QVariantMap> DaemonClient::integrate(const QStringList& paths) {
+        return callDaemon<QVariantMap>("Integrate", paths);
+    }
+
+    std::optional<QVariantMap> DaemonClient::unintegrate(const QStringList& paths) {
+        return callDaemon<QVariantMap>("Unintegrate", paths);
+    }
+
+    std::optional<QVariantMap> DaemonClient::status(const QString& path) {
+        return callDaemon<QVariantMap>("Status", path);
+    }
+
+    std::optional<QStringList> DaemonClient::list() {
+        return callDaemon<QStringList>("List", QVariant());
+    }
+
+}
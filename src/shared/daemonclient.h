@@ -0,0 +1,50 @@
+/*
+ * Client for the daemon's D-Bus interface
+ *
+ * appimagelauncherd exports an interface on the session bus which allows other components to delegate the integration
+ * work to it. The daemon has its config, translations and caches loaded already, and batches the requests with its own
+ * work, so the desktop database and icon caches are updated only once.
+ *
+ * The daemon is optional, therefore all methods report whether the daemon could be reached, and callers are expected
+ * to fall back to doing the work themselves if it couldn't.
+ */
+
+#pragma once
+
+// system headers
+#include <optional>
+
+// library headers
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+namespace appimagelauncher {
+
+    static constexpr auto DAEMON_DBUS_SERVICE = "org.appimagelauncher.Daemon";
+    static constexpr auto DAEMON_DBUS_PATH = "/org/appimagelauncher/Daemon";
+    static constexpr auto DAEMON_DBUS_INTERFACE = "org.appimagelauncher.Daemon";
+
+    class DaemonClient {
+    public:
+        // whether the daemon is running and provides the interface
+        static bool isAvailable();
+
+        // integrates the given AppImages in place, i.e., they must have been moved into the right location already
+        // the paths must be absolute, the daemon rejects relative ones
+        // returns the error messages of the AppImages which couldn't be integrated, keyed by their paths, or nothing
+        // if the daemon couldn't be reached
+        static std::optional<QVariantMap> integrate(const QStringList& paths);
+
+        // same as integrate(...), but removes the integration
+        static std::optional<QVariantMap> unintegrate(const QStringList& paths);
+
+        // integration state of an AppImage
+        // see the daemon's implementation for the keys
+        static std::optional<QVariantMap> status(const QString& path);
+
+        // lists the AppImages in the integration destination and the other watched directories
+        static std::optional<QStringList> list();
+    };
+
+}
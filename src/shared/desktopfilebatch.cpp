@@ -0,0 +1,126 @@
+// system includes
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <set>
+extern "C" {
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+// library includes
+#include <QMutexLocker>
+
+// local headers
+#include "desktopfilebatch.h"
+
+namespace {
+    bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            const auto rv = write(fd, data, size);
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            data += rv;
+            size -= rv;
+        }
+
+        return true;
+    }
+
+    std::string directoryOf(const std::string& path) {
+        const auto slash = path.rfind('/');
+        return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+    }
+}
+
+namespace appimagelauncher {
+
+    DesktopFileBatch::~DesktopFileBatch() {
+        for (const auto& stagedFile : _stagedFiles) {
+            unlink(stagedFile.tempPath.c_str());
+        }
+    }
+
+    bool DesktopFileBatch::stage(const QString& path, const QByteArray& contents, const mode_t mode) {
+        const auto pathStr = path.toStdString();
+        const auto slash = pathStr.rfind('/');
+
+        // hidden, and without the .desktop suffix, so desktop environments ignore it
+        auto tempPath = directoryOf(pathStr) + "/." + pathStr.substr(slash == std::string::npos ? 0 : slash + 1) + ".XXXXXX";
+
+        const int fd = mkostemp(&tempPath[0], O_CLOEXEC);
+
+        if (fd < 0) {
+            std::cerr << "Failed to create temporary file for " << pathStr << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // the permissions must be correct as soon as the file shows up under its final name
+        // the contents must be on disk before the rename is, otherwise a crash could leave an empty file behind
+        // the tasks stage their files concurrently, so these syncs overlap; the directories are synced in commit()
+        const bool success = fchmod(fd, mode) == 0 && writeAll(fd, contents.constData(), contents.size()) &&
+                             fsync(fd) == 0;
+        const auto error = errno;
+
+        if (close(fd) != 0 || !success) {
+            std::cerr << "Failed to write temporary file for " << pathStr << ": " << strerror(success ? errno : error)
+                      << std::endl;
+            unlink(tempPath.c_str());
+            return false;
+        }
+
+        QMutexLocker locker(&_mutex);
+        _stagedFiles.push_back({tempPath, pathStr});
+
+        return true;
+    }
+
+    bool DesktopFileBatch::commit() {
+        QMutexLocker locker(&_mutex);
+
+        bool success = true;
+        std::set<std::string> directories;
+
+        for (const auto& stagedFile : _stagedFiles) {
+            if (rename(stagedFile.tempPath.c_str(), stagedFile.path.c_str()) != 0) {
+                std::cerr << "Failed to move " << stagedFile.tempPath << " into place: " << strerror(errno) << std::endl;
+                unlink(stagedFile.tempPath.c_str());
+                success = false;
+                continue;
+            }
+
+            directories.insert(directoryOf(stagedFile.path));
+        }
+
+        _stagedFiles.clear();
+
+        // makes the renames durable, one sync per directory rather than one per file
+        for (const auto& directory : directories) {
+            const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+            if (fd < 0 || fsync(fd) != 0) {
+                std::cerr << "Failed to sync directory " << directory << ": " << strerror(errno) << std::endl;
+            }
+
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        return success;
+    }
+
+    bool DesktopFileBatch::empty() {
+        QMutexLocker locker(&_mutex);
+        return _stagedFiles.empty();
+    }
+
+}
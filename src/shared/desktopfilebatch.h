@@ -0,0 +1,59 @@
+/*
+ * Atomic, batched desktop file writes
+ *
+ * Desktop environments watch the applications directory and reload their menus whenever something changes in there.
+ * Writing desktop files in place means they may see (and parse) half-written files, and they are notified several
+ * times per file.
+ *
+ * Therefore, desktop files are rendered in memory and staged in hidden temporary files next to their final location,
+ * with the final permissions set and their contents synced already. When the batch is committed, all of them are
+ * renamed into place, which replaces existing files atomically, and each directory involved is synced once. This way,
+ * a batch of integrations (e.g., everything the daemon found in a watched directory) results in one burst of changes.
+ */
+
+#pragma once
+
+// system headers
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// library headers
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+
+namespace appimagelauncher {
+
+    class DesktopFileBatch {
+    public:
+        DesktopFileBatch() = default;
+
+        // removes the temporary files of files which haven't been committed
+        ~DesktopFileBatch();
+
+        DesktopFileBatch(const DesktopFileBatch&) = delete;
+        DesktopFileBatch& operator=(const DesktopFileBatch&) = delete;
+
+    public:
+        // writes the contents to a temporary file next to path, which replaces path on commit()
+        // safe to be called from multiple threads at once
+        bool stage(const QString& path, const QByteArray& contents, mode_t mode);
+
+        // moves all staged files into place and syncs their directories
+        // returns false if any of the files couldn't be committed; the others are committed nevertheless
+        bool commit();
+
+        bool empty();
+
+    private:
+        struct StagedFile {
+            std::string tempPath;
+            std::string path;
+        };
+
+        QMutex _mutex;
+        std::vector<StagedFile> _stagedFiles;
+    };
+
+}
@@ -0,0 +1,394 @@
+// system includes
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+extern "C" {
+    #include <appimage/appimage.h>
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+// library includes
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QStandardPaths>
+#include <QThread>
+
+// local headers
+#include "extractcache.h"
+#include "shared.h"
+
+// default size limit of the cache, in MiB
+static const qint64 DEFAULT_EXTRACT_CACHE_SIZE_MIB = 4096;
+
+// every entry has a lock file next to it
+// the entry is locked exclusively while it's extracted or removed, and shared while it's in use
+// the AppImage keeps the shared lock for its whole lifetime, as the file descriptor is inherited across execv(...)
+// returns the file descriptor holding the lock (with FD_CLOEXEC set), or -1 if the entry couldn't be locked
+static int lockEntry(const QString& appDirPath, const int operation) {
+    const auto lockFilePath = (appDirPath + ".lock").toStdString();
+
+    for (;;) {
+        const int fd = open(lockFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+        if (fd < 0) {
+            return -1;
+        }
+
+        int rv;
+
+        do {
+            rv = flock(fd, operation);
+        } while (rv != 0 && errno == EINTR);
+
+        if (rv != 0) {
+            close(fd);
+            return -1;
+        }
+
+        // the lock file is removed along with its entry, so we might have locked a file which doesn't exist any more
+        struct stat fdStat{}, pathStat{};
+
+        if (fstat(fd, &fdStat) == 0 && stat(lockFilePath.c_str(), &pathStat) == 0 &&
+            fdStat.st_dev == pathStat.st_dev && fdStat.st_ino == pathStat.st_ino) {
+            return fd;
+        }
+
+        close(fd);
+    }
+}
+
+static qint64 lastUsed(const QString& appDirPath) {
+    return QFileInfo(appDirPath).lastModified().toMSecsSinceEpoch();
+}
+
+// calculates the disk space used by a directory tree
+static qint64 diskUsage(const QString& path) {
+    qint64 rv = 0;
+
+    QDirIterator it(path, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+
+    while (it.hasNext()) {
+        struct stat st{};
+
+        if (lstat(it.next().toStdString().c_str(), &st) == 0) {
+            rv += static_cast<qint64>(st.st_blocks) * 512;
+        }
+    }
+
+    return rv;
+}
+
+// the modification time of an entry's directory is used to track when it has been used the last time
+static void markAsUsed(const QString& appDirPath) {
+    utimensat(AT_FDCWD, appDirPath.toStdString().c_str(), nullptr, 0);
+}
+
+// extracts the AppImage's payload into the given directory, which must not exist yet
+// the files are extracted into a temporary directory first, so incomplete entries are never used
+static bool extractAppImage(const QString& pathToAppImage, const QString& appDirPath) {
+    const QString tempDirPath = appDirPath + ".tmp-" + QString::number(QCoreApplication::applicationPid());
+
+    QDir(tempDirPath).removeRecursively();
+
+    if (!QDir().mkpath(tempDirPath)) {
+        std::cerr << "Failed to create temporary directory " << tempDirPath.toStdString() << std::endl;
+        return false;
+    }
+
+    // both unsquashfs and the runtime extract into a subdirectory called squashfs-root
+    const QString extractedPath = tempDirPath + "/squashfs-root";
+
+    auto runProcess = [&tempDirPath](const QString& program, const QStringList& args) {
+        QProcess proc;
+        proc.setProgram(program);
+        proc.setArguments(args);
+        proc.setWorkingDirectory(tempDirPath);
+        proc.setStandardOutputFile(QProcess::nullDevice());
+        proc.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+        proc.start();
+
+        return proc.waitForFinished(-1) && proc.exitStatus() == QProcess::NormalExit && proc.exitCode() == 0;
+    };
+
+    bool success = false;
+
+    // unsquashfs decompresses the data using all available CPU cores, the runtime uses just a single thread
+    // the -o option requires squashfs-tools >= 4.4, we just try it and fall back to the runtime if it fails
+    const auto unsquashfsPath = QStandardPaths::findExecutable("unsquashfs");
+    const auto payloadOffset = appimage_get_payload_offset(pathToAppImage.toStdString().c_str());
+
+    if (!unsquashfsPath.isEmpty() && payloadOffset > 0) {
+        success = runProcess(unsquashfsPath, {
+            "-no-progress",
+            "-processors", QString::number(std::max(1, QThread::idealThreadCount())),
+            "-o", QString::number(payloadOffset),
+            "-d", extractedPath,
+            pathToAppImage,
+        });
+
+        if (!success) {
+            QDir(extractedPath).removeRecursively();
+        }
+    }
+
+#ifndef BUILD_LITE
+    if (!success) {
+        // the runtime is launched via the bypass, as we must not end up in AppImageLauncher again
+        const auto bypassPath = privateLibDirPath("binfmt-bypass") + "/binfmt-bypass";
+        success = runProcess(bypassPath, {pathToAppImage, "--appimage-extract"});
+    }
+#endif
+
+    success = success && QFileInfo(extractedPath + "/AppRun").exists();
+
+    if (success && rename(extractedPath.toStdString().c_str(), appDirPath.toStdString().c_str()) != 0) {
+        // another process might have extracted the same AppImage in the meantime
+        success = QFileInfo(appDirPath + "/AppRun").exists();
+    }
+
+    QDir(tempDirPath).removeRecursively();
+
+    if (!success) {
+        std::cerr << "Failed to extract AppImage " << pathToAppImage.toStdString() << std::endl;
+        return false;
+    }
+
+    // remember the entry's size, so trimming the cache doesn't need to walk all the entries
+    QFile sizeFile(appDirPath + ".size");
+
+    if (sizeFile.open(QIODevice::WriteOnly)) {
+        sizeFile.write(QByteArray::number(diskUsage(appDirPath)));
+    }
+
+    return true;
+}
+
+bool extractAndRunEnabled(const ConfigSnapshot& config) {
+    return config.value("AppImageLauncher/extract_and_run", false).toBool();
+}
+
+qint64 extractCacheBudget(const ConfigSnapshot& config) {
+    const auto sizeMiB = config.value("AppImageLauncher/extract_and_run_cache_size", DEFAULT_EXTRACT_CACHE_SIZE_MIB).toLongLong();
+    return sizeMiB * 1024 * 1024;
+}
+
+QString extractCacheDirPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/appimagelauncher/extracted";
+}
+
+QString getOrCreateExtractedAppDir(const QString& pathToAppImage, const qint64 cacheBudget, int& inUseLockFd) {
+    inUseLockFd = -1;
+
+    const QDir cacheDir(extractCacheDirPath());
+
+    if (!cacheDir.mkpath("by-stat")) {
+        return "";
+    }
+
+    struct stat st{};
+
+    if (stat(pathToAppImage.toStdString().c_str(), &st) != 0) {
+        return "";
+    }
+
+    const auto statKey = QString("%1-%2-%3-%4.%5")
+        .arg(static_cast<qulonglong>(st.st_dev), 0, 16)
+        .arg(static_cast<qulonglong>(st.st_ino), 0, 16)
+        .arg(static_cast<qulonglong>(st.st_size), 0, 16)
+        .arg(static_cast<qulonglong>(st.st_mtim.tv_sec), 0, 16)
+        .arg(static_cast<qulonglong>(st.st_mtim.tv_nsec), 0, 16);
+
+    const auto statLinkPath = cacheDir.filePath("by-stat/" + statKey);
+
+    // fast path: the AppImage hasn't changed since it has been launched the last time
+    {
+        const QFileInfo statLink(statLinkPath);
+
+        if (statLink.isSymLink()) {
+            const auto appDirPath = statLink.symLinkTarget();
+
+            // the lock makes sure the entry isn't removed while it's in use
+            const int fd = lockEntry(appDirPath, LOCK_SH);
+
+            if (fd >= 0 && QFileInfo(appDirPath + "/AppRun").exists()) {
+                markAsUsed(appDirPath);
+                inUseLockFd = fd;
+                return appDirPath;
+            }
+
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    const auto digest = getAppImageDigestMd5(pathToAppImage);
+
+    if (digest.isEmpty()) {
+        return "";
+    }
+
+    const auto appDirPath = cacheDir.filePath(digest);
+
+    // concurrent launches of the same AppImage wait for the first one to finish the extraction
+    const int fd = lockEntry(appDirPath, LOCK_EX);
+
+    if (fd < 0) {
+        std::cerr << "Failed to lock extract-and-run cache entry " << appDirPath.toStdString() << std::endl;
+        return "";
+    }
+
+    if (!QFileInfo(appDirPath + "/AppRun").exists()) {
+        QDir(appDirPath).removeRecursively();
+
+        if (!extractAppImage(pathToAppImage, appDirPath)) {
+            close(fd);
+            return "";
+        }
+
+        trimExtractCache(cacheBudget, appDirPath);
+    }
+
+    QFile::remove(statLinkPath);
+    QFile::link(appDirPath, statLinkPath);
+
+    // converting the lock isn't atomic, so the entry might have been removed in between
+    if (flock(fd, LOCK_SH) != 0 || !QFileInfo(appDirPath + "/AppRun").exists()) {
+        close(fd);
+        return "";
+    }
+
+    markAsUsed(appDirPath);
+    inUseLockFd = fd;
+    return appDirPath;
+}
+
+void trimExtractCache(const qint64 budget, const QString& appDirPathToKeep) {
+    const QDir cacheDir(extractCacheDirPath());
+
+    struct Entry {
+        QString path;
+        qint64 size;
+        qint64 lastUsed;
+    };
+
+    std::vector<Entry> entries;
+    qint64 totalSize = 0;
+
+    // the entries are named after the MD5 digests
+    static const QRegularExpression digestPattern("^[0-9a-f]{32}$");
+
+    for (const auto& fileInfo : cacheDir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (!digestPattern.match(fileInfo.fileName()).hasMatch()) {
+            continue;
+        }
+
+        Entry entry{fileInfo.absoluteFilePath(), -1, lastUsed(fileInfo.absoluteFilePath())};
+
+        QFile sizeFile(entry.path + ".size");
+
+        if (sizeFile.open(QIODevice::ReadOnly)) {
+            bool ok = false;
+            entry.size = sizeFile.readAll().toLongLong(&ok);
+
+            if (!ok) {
+                entry.size = -1;
+            }
+        }
+
+        if (entry.size < 0) {
+            entry.size = diskUsage(entry.path);
+        }
+
+        totalSize += entry.size;
+        entries.emplace_back(std::move(entry));
+    }
+
+    // least recently used entries first
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    for (const auto& entry : entries) {
+        if (totalSize <= budget) {
+            break;
+        }
+
+        if (entry.path == appDirPathToKeep) {
+            continue;
+        }
+
+        // entries which are being extracted or are in use by running AppImages are skipped
+        const int fd = lockEntry(entry.path, LOCK_EX | LOCK_NB);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        std::cerr << "Removing " << entry.path.toStdString() << " from extract-and-run cache" << std::endl;
+
+        QDir(entry.path).removeRecursively();
+        QFile::remove(entry.path + ".size");
+
+        // processes waiting for the lock notice the file has been removed, see lockEntry(...)
+        QFile::remove(entry.path + ".lock");
+        close(fd);
+
+        totalSize -= entry.size;
+    }
+
+    // clean up links pointing to removed entries
+    const QDir byStatDir(cacheDir.filePath("by-stat"));
+
+    for (const auto& fileInfo : byStatDir.entryInfoList(QDir::System | QDir::NoDotAndDotDot)) {
+        if (fileInfo.isSymLink() && !fileInfo.exists()) {
+            QFile::remove(fileInfo.absoluteFilePath());
+        }
+    }
+}
+
+int runExtractedAppImage(const QString& pathToAppImage, const QString& appDirPath, const int inUseLockFd,
+                         unsigned long argc, char** argv) {
+    // the lock is inherited by AppRun and the processes it launches, and released once all of them have exited
+    if (fcntl(inUseLockFd, F_SETFD, 0) != 0) {
+        std::cerr << "Failed to keep extract-and-run cache entry locked: " << strerror(errno) << std::endl;
+        close(inUseLockFd);
+        return 1;
+    }
+
+    const auto appRunPath = (appDirPath + "/AppRun").toStdString();
+
+    // the AppImage runtime sets these variables, some AppRun scripts and applications depend on them
+    setenv("APPIMAGE", QFileInfo(pathToAppImage).absoluteFilePath().toStdString().c_str(), true);
+    setenv("APPDIR", appDirPath.toStdString().c_str(), true);
+    setenv("ARGV0", pathToAppImage.toStdString().c_str(), true);
+    setenv("OWD", QDir::currentPath().toStdString().c_str(), true);
+
+    std::vector<char*> args;
+    args.push_back(const_cast<char*>(appRunPath.c_str()));
+
+    for (unsigned long i = 1; i < argc; i++) {
+        args.push_back(argv[i]);
+    }
+
+    // args need to be null terminated
+    args.push_back(nullptr);
+
+    execv(appRunPath.c_str(), args.data());
+
+    const auto& error = errno;
+    std::cerr << QObject::tr("execv() failed: %1").arg(strerror(error)).toStdString() << std::endl;
+    close(inUseLockFd);
+    return 1;
+}
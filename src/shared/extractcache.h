@@ -0,0 +1,45 @@
+/*
+ * Extract-and-run cache
+ *
+ * Instead of mounting an AppImage via FUSE (and decompressing its contents on every read), the payload is extracted
+ * once into a per-user cache directory, and AppRun is launched from there directly. This is opt-in, as the extracted
+ * files can take up quite some space.
+ *
+ * Entries are keyed by the AppImage's MD5 digest, so a changed AppImage is extracted again. To avoid calculating the
+ * digest on every launch, a symlink named after the AppImage's identity (device, inode, size and modification time)
+ * points to the current entry. The cache's total size is limited, the least recently used entries are removed first.
+ */
+
+#pragma once
+
+// library headers
+#include <QString>
+
+// local headers
+#include "config.h"
+
+// checks whether the user enabled the extract-and-run mode in the config file
+bool extractAndRunEnabled(const ConfigSnapshot& config);
+
+// maximum size of the extract-and-run cache in bytes, as configured by the user
+qint64 extractCacheBudget(const ConfigSnapshot& config);
+
+// path to the directory containing the extracted AppImages
+QString extractCacheDirPath();
+
+// returns the path to the extracted AppDir of an AppImage, extracting it first if necessary
+// inUseLockFd receives a file descriptor holding a shared lock on the entry, which protects it from being removed
+// returns an empty string if the AppImage cannot be extracted
+QString getOrCreateExtractedAppDir(const QString& pathToAppImage, qint64 cacheBudget, int& inUseLockFd);
+
+// removes the least recently used entries until the cache fits within the budget
+// the given entry and entries which are in use (i.e., locked) are never removed
+void trimExtractCache(qint64 budget, const QString& appDirPathToKeep = QString());
+
+// replaces the current process with the AppRun of an extracted AppImage, setting up the environment like the
+// AppImage runtime would
+// the lock obtained from getOrCreateExtractedAppDir(...) is kept by the AppImage's processes until they have exited
+// like runAppImage(...), the first of the arguments is skipped
+// only returns in case of errors
+int runExtractedAppImage(const QString& pathToAppImage, const QString& appDirPath, int inUseLockFd,
+                         unsigned long argc, char** argv);
@@ -0,0 +1,282 @@
+// system includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+extern "C" {
+    #include <fcntl.h>
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+// local headers
+#include "filecopy.h"
+
+namespace {
+    // copy_file_range(...) is called in chunks of this size, so progress can be reported and the copy can be canceled
+    constexpr size_t COPY_CHUNK_SIZE = 8 * 1024 * 1024;
+
+    // buffer size for the fallback; larger buffers hardly make a difference
+    constexpr size_t READ_WRITE_BUFFER_SIZE = 1024 * 1024;
+
+    class FileDescriptor {
+    public:
+        explicit FileDescriptor(int fd = -1) : _fd(fd) {}
+
+        ~FileDescriptor() {
+            if (_fd >= 0) {
+                close(_fd);
+            }
+        }
+
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+        int get() const {
+            return _fd;
+        }
+
+        // close(...) may report write errors, e.g., on network file systems
+        int release() {
+            const auto rv = close(_fd);
+            _fd = -1;
+            return rv;
+        }
+
+    private:
+        int _fd;
+    };
+
+    enum class CopyStatus {
+        Done,
+        Failed,
+        Canceled,
+        // the method is not supported for this pair of files, another one has to be tried
+        Unsupported,
+    };
+
+    bool reportProgress(const appimagelauncher::CopyProgressCallback& callback, qint64 copied, qint64 total) {
+        return !callback || callback(copied, total);
+    }
+
+    CopyStatus copyWithCopyFileRange(int sourceFd, int targetFd, qint64 size,
+                                     const appimagelauncher::CopyProgressCallback& callback) {
+        qint64 copied = 0;
+
+        while (copied < size) {
+            const auto chunkSize = std::min(static_cast<size_t>(size - copied), COPY_CHUNK_SIZE);
+            const auto rv = copy_file_range(sourceFd, nullptr, targetFd, nullptr, chunkSize, 0);
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                // older kernels don't support copying between different file systems, some file systems don't support
+                // it at all
+                // the read/write loop starts from the beginning, so we can only switch as long as nothing was copied
+                if (copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                    return CopyStatus::Unsupported;
+                }
+
+                return CopyStatus::Failed;
+            }
+
+            // some pseudo file systems report a size, but don't support copy_file_range(...) properly
+            if (rv == 0) {
+                if (copied == 0) {
+                    return CopyStatus::Unsupported;
+                }
+
+                // the file has been truncated while copying it
+                errno = EIO;
+                return CopyStatus::Failed;
+            }
+
+            copied += rv;
+
+            if (!reportProgress(callback, copied, size)) {
+                return CopyStatus::Canceled;
+            }
+        }
+
+        return CopyStatus::Done;
+    }
+
+    CopyStatus copyWithReadWrite(int sourceFd, int targetFd, qint64 size,
+                                 const appimagelauncher::CopyProgressCallback& callback) {
+        // we read the file only once from start to end
+        posix_fadvise(sourceFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        std::unique_ptr<char[]> buffer(new char[READ_WRITE_BUFFER_SIZE]);
+
+        qint64 copied = 0;
+
+        for (;;) {
+            const auto bytesRead = read(sourceFd, buffer.get(), READ_WRITE_BUFFER_SIZE);
+
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return CopyStatus::Failed;
+            }
+
+            if (bytesRead == 0) {
+                break;
+            }
+
+            for (ssize_t written = 0; written < bytesRead;) {
+                const auto rv = write(targetFd, buffer.get() + written, bytesRead - written);
+
+                if (rv < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    return CopyStatus::Failed;
+                }
+
+                written += rv;
+            }
+
+            copied += bytesRead;
+
+            if (!reportProgress(callback, copied, std::max(copied, size))) {
+                return CopyStatus::Canceled;
+            }
+        }
+
+        // the target has been preallocated to the reported size, a file which has changed its size while copying it
+        // would end up zero-padded or incomplete
+        // files in pseudo file systems which report a size of 0 are the only ones which may differ
+        if (size > 0 && copied != size) {
+            errno = EIO;
+            return CopyStatus::Failed;
+        }
+
+        return CopyStatus::Done;
+    }
+}
+
+namespace appimagelauncher {
+
+    QString CopyResult::errorMessage() const {
+        if (success) {
+            return QString();
+        }
+
+        if (canceled) {
+            return QStringLiteral("Copy canceled");
+        }
+
+        return QString::fromLocal8Bit(strerror(error));
+    }
+
+    CopyResult copyFile(const QString& source, const QString& destination, const CopyProgressCallback& progressCallback) {
+        CopyResult result;
+
+        auto fail = [&result]() {
+            result.error = errno;
+            return result;
+        };
+
+        FileDescriptor sourceFd(open(source.toStdString().c_str(), O_RDONLY | O_CLOEXEC));
+
+        if (sourceFd.get() < 0) {
+            return fail();
+        }
+
+        struct stat sourceStat{};
+
+        if (fstat(sourceFd.get(), &sourceStat) != 0) {
+            return fail();
+        }
+
+        // the temporary file must reside in the same directory, otherwise it couldn't be renamed atomically
+        const auto destinationPath = destination.toStdString();
+        const auto slash = destinationPath.rfind('/');
+        const auto destinationDir = slash == std::string::npos ? std::string(".") : destinationPath.substr(0, slash);
+        const auto destinationName = slash == std::string::npos ? destinationPath : destinationPath.substr(slash + 1);
+
+        // hidden, so it doesn't show up in file managers and isn't picked up by the daemon
+        auto tempPath = destinationDir + "/." + destinationName + ".XXXXXX";
+
+        FileDescriptor targetFd(mkostemp(&tempPath[0], O_CLOEXEC));
+
+        if (targetFd.get() < 0) {
+            return fail();
+        }
+
+        // from here on, the temporary file has to be removed in case of errors
+        auto failAndCleanUp = [&result, &tempPath]() {
+            result.error = errno;
+            unlink(tempPath.c_str());
+            return result;
+        };
+
+        // mkostemp(...) creates the file with mode 0600
+        if (fchmod(targetFd.get(), sourceStat.st_mode & 07777) != 0) {
+            return failAndCleanUp();
+        }
+
+        const qint64 size = sourceStat.st_size;
+
+        if (ioctl(targetFd.get(), FICLONE, sourceFd.get()) == 0) {
+            result.method = CopyMethod::Reflink;
+
+            // the copy is complete already, but callers might rely on the callback being called at least once
+            reportProgress(progressCallback, size, size);
+        } else {
+            // allocating all the space upfront avoids fragmentation, and makes sure we fail early if there isn't
+            // enough space
+            // not every file system supports this, which is fine
+            if (size > 0 && fallocate(targetFd.get(), 0, 0, size) != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+                return failAndCleanUp();
+            }
+
+            // files in pseudo file systems may report a size of 0 even though they have contents, these can only be
+            // copied with read(...)
+            result.method = CopyMethod::CopyFileRange;
+            auto status = size > 0 ?
+                copyWithCopyFileRange(sourceFd.get(), targetFd.get(), size, progressCallback) : CopyStatus::Unsupported;
+
+            if (status == CopyStatus::Unsupported) {
+                result.method = CopyMethod::ReadWrite;
+                status = copyWithReadWrite(sourceFd.get(), targetFd.get(), size, progressCallback);
+            }
+
+            if (status == CopyStatus::Canceled) {
+                result.canceled = true;
+                errno = ECANCELED;
+                return failAndCleanUp();
+            }
+
+            if (status != CopyStatus::Done) {
+                return failAndCleanUp();
+            }
+        }
+
+        // the file must be on disk before it replaces the destination, otherwise a crash could leave behind an empty
+        // or partial file under the final name
+        if (fdatasync(targetFd.get()) != 0) {
+            return failAndCleanUp();
+        }
+
+        if (targetFd.release() != 0) {
+            return failAndCleanUp();
+        }
+
+        if (rename(tempPath.c_str(), destinationPath.c_str()) != 0) {
+            return failAndCleanUp();
+        }
+
+        result.success = true;
+        return result;
+    }
+
+}
@@ -0,0 +1,55 @@
+/*
+ * Copy engine
+ *
+ * Copies files as efficiently as the file systems involved allow. On file systems supporting it (e.g., Btrfs, XFS), the
+ * copy is a reflink which shares the data with the original and completes instantly. Otherwise, copy_file_range(...) is
+ * used, which keeps the data within the kernel and may be offloaded to the storage (e.g., NFS server side copy). If
+ * neither works, the data is copied with a large buffer.
+ *
+ * The copy is written to a temporary file next to the destination, which is renamed once the copy is complete, so
+ * there's never a partially copied file at the destination. The space required is allocated upfront, so the copy fails
+ * right away rather than after minutes if there is not enough space.
+ */
+
+#pragma once
+
+// system headers
+#include <functional>
+
+// library headers
+#include <QString>
+
+namespace appimagelauncher {
+
+    enum class CopyMethod {
+        Reflink,
+        CopyFileRange,
+        ReadWrite,
+    };
+
+    struct CopyResult {
+        bool success = false;
+
+        // set to true if the copy was aborted by the progress callback
+        bool canceled = false;
+
+        // errno of the operation which failed, 0 on success
+        int error = 0;
+
+        // method used to copy the data, useful for debugging
+        CopyMethod method = CopyMethod::ReadWrite;
+
+        // human readable description of the error, empty on success
+        QString errorMessage() const;
+    };
+
+    // called with the number of bytes copied so far and the total size of the file
+    // the copy is canceled as soon as the callback returns false
+    typedef std::function<bool(qint64 bytesCopied, qint64 bytesTotal)> CopyProgressCallback;
+
+    // copies source to destination, replacing destination if it exists already
+    // the file mode is copied as well
+    CopyResult copyFile(const QString& source, const QString& destination,
+                        const CopyProgressCallback& progressCallback = CopyProgressCallback());
+
+}
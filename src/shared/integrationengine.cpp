@@ -0,0 +1,494 @@
+// system includes
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+extern "C" {
+    #include <appimage/appimage.h>
+    #include <glib.h>
+    #include <sys/stat.h>
+}
+
+// library includes
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QMapIterator>
+#include <QMutexLocker>
+#include <QObject>
+#include <QRegularExpression>
+#include <QStandardPaths>
+#include <QtDBus>
+#ifdef ENABLE_UPDATE_HELPER
+#include <appimage/update.h>
+#endif
+
+// local headers
+#include "integrationengine.h"
+#include "resourceindex.h"
+#include "shared.h"
+#include "tracing.h"
+#include "translationmanager.h"
+
+namespace {
+    void gKeyFileDeleter(GKeyFile* ptr) {
+        if (ptr != nullptr)
+            g_key_file_free(ptr);
+    }
+
+    // collisions are resolved like in the filesystem: a monotonically increasing number in brackets is appended to the
+    // Name
+    // in order to keep the number monotonically increasing, we look for the highest number in brackets in the existing
+    // entries and add 1 to it
+    unsigned int calculateCollisionNumber(const std::map<std::string, std::string>& collisions) {
+        if (collisions.empty()) {
+            return 0;
+        }
+
+        unsigned int currentNumber = 1;
+
+        static const QRegularExpression regex(R"(^.*\(([0-9]+)\)$)");
+
+        for (const auto& collision : collisions) {
+            const auto& currentNameEntry = collision.second;
+
+            auto match = regex.match(QString::fromStdString(currentNameEntry));
+
+            if (match.hasMatch()) {
+                // 0 = entire string
+                // 1 = first group
+                const QString numString = match.captured(1);
+                const unsigned int num = numString.toUInt();
+
+                // monotonic counting, i.e., never try to "be smart" by e.g., filling in the gaps between
+                // previous numbers
+                if (num >= currentNumber) {
+                    currentNumber = num + 1;
+                }
+            }
+        }
+
+        return currentNumber;
+    }
+
+#ifdef ENABLE_UPDATE_HELPER
+    // load translations from JSON file(s)
+    void loadDesktopActionTranslations(appimagelauncher::IntegrationContext& context) {
+        QDirIterator i18nDirIterator(TranslationManager::getTranslationDir());
+
+        while(i18nDirIterator.hasNext()) {
+            const auto& filePath = i18nDirIterator.next();
+            const auto& fileName = QFileInfo(filePath).fileName();
+
+            if (!QFileInfo(filePath).isFile() || !(fileName.startsWith("desktopfiles.") && fileName.endsWith(".json")))
+                continue;
+
+            // check whether filename's format is alright, otherwise parsing the locale might try to access a
+            // non-existing (or the wrong) member
+            auto splitFilename = fileName.split(".");
+
+            if (splitFilename.size() != 3)
+                continue;
+
+            // parse locale from filename
+            auto locale = splitFilename[1];
+
+            QFile jsonFile(filePath);
+
+            if (!jsonFile.open(QIODevice::ReadOnly)) {
+                context.warnings << QObject::tr("Could not parse desktop file translations:\nCould not open file for reading:\n\n%1").arg(fileName);
+                continue;
+            }
+
+            // TODO: need to make sure that this doesn't try to read huge files at once
+            auto data = jsonFile.readAll();
+
+            QJsonParseError parseError{};
+            auto jsonDoc = QJsonDocument::fromJson(data, &parseError);
+
+            // show warning on syntax errors and continue
+            if (parseError.error != QJsonParseError::NoError || jsonDoc.isNull() || !jsonDoc.isObject()) {
+                context.warnings << QObject::tr("Could not parse desktop file translations:\nInvalid syntax:\n\n%1").arg(parseError.errorString());
+                continue;
+            }
+
+            auto jsonObj = jsonDoc.object();
+
+            for (const auto& key : jsonObj.keys()) {
+                auto value = jsonObj[key].toString();
+
+                if (key.startsWith("Desktop Action update")) {
+                    qDebug() << "update: adding" << value << "for locale" << locale;
+                    context.updateActionNameTranslations[locale] = value;
+                } else if (key.startsWith("Desktop Action remove")) {
+                    qDebug() << "remove: adding" << value << "for locale" << locale;
+                    context.removeActionNameTranslations[locale] = value;
+                }
+            }
+        }
+    }
+#endif
+}
+
+namespace appimagelauncher {
+
+    std::map<std::string, std::string> findCollisions(const QString& currentNameEntry) {
+        std::map<std::string, std::string> collisions{};
+
+        // default locations of desktop files on systems
+        const auto directories = {
+            QString("/usr/share/applications/"),
+            QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/applications/"
+        };
+
+        for (const auto& directory : directories) {
+            QDirIterator iterator(directory, QDirIterator::FollowSymlinks);
+
+            while (iterator.hasNext()) {
+                const auto filename = iterator.next();
+
+                if (!QFileInfo(filename).isFile() || !filename.endsWith(".desktop"))
+                    continue;
+
+                std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), gKeyFileDeleter);
+
+                // if the key file parser can't load the file, it's most likely not a valid desktop file, so we just skip this file
+                if (!g_key_file_load_from_file(desktopFile.get(), filename.toStdString().c_str(), G_KEY_FILE_KEEP_TRANSLATIONS, nullptr))
+                    continue;
+
+                auto* nameEntry = g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, nullptr);
+
+                // invalid desktop file, needs to be skipped
+                if (nameEntry == nullptr)
+                    continue;
+
+                if (QString(nameEntry).trimmed().startsWith(currentNameEntry.trimmed())) {
+                    collisions[filename.toStdString()] = nameEntry;
+                }
+
+                g_free(nameEntry);
+            }
+        }
+
+        return collisions;
+    }
+
+    IntegrationContext IntegrationContext::fromApplication() {
+        IntegrationContext context;
+
+        context.applicationVersion = QCoreApplication::applicationVersion().replace("version ", "");
+
+#ifndef BUILD_LITE
+        context.privateLibDir = privateLibDirPath("ui");
+#endif
+
+#ifdef ENABLE_UPDATE_HELPER
+        loadDesktopActionTranslations(context);
+#endif
+
+        return context;
+    }
+
+    bool IntegrationResult::success() const {
+        return error == IntegrationError::None;
+    }
+
+    unsigned int IntegrationEngine::reserveCollisionNumber(const QString& nameEntry, const QString& desktopFilePath,
+                                                           const unsigned int numberFromDisk) {
+        const auto key = nameEntry.trimmed();
+
+        auto& shard = _shards[qHash(key) % SHARD_COUNT];
+        QMutexLocker locker(&shard.mutex);
+
+        auto& reservation = shard.reservations[key];
+
+        {
+            const auto it = reservation.numbersByDesktopFile.constFind(desktopFilePath);
+
+            if (it != reservation.numbersByDesktopFile.constEnd()) {
+                return it.value();
+            }
+        }
+
+        // desktop files written by concurrent integrations may not be visible on disk yet, so the number calculated
+        // from the existing entries could have been handed out already
+        const auto number = std::max(numberFromDisk, reservation.nextNumber);
+
+        reservation.nextNumber = number + 1;
+        reservation.numbersByDesktopFile.insert(desktopFilePath, number);
+
+        return number;
+    }
+
+    IntegrationResult IntegrationEngine::installDesktopFileAndIcons(const QString& pathToAppImage,
+                                                                    const IntegrationContext& context,
+                                                                    DesktopFileBatch* batch,
+                                                                    DesktopResourceIndexBatch* resourceIndexBatch) {
+        TraceSpan span("integration");
+
+        IntegrationResult result;
+
+        auto fail = [&result](IntegrationError error, const QString& message) {
+            result.error = error;
+            result.errorMessage = message;
+            return result;
+        };
+
+        if (appimage_register_in_system(pathToAppImage.toStdString().c_str(), false) != 0) {
+            return fail(IntegrationError::RegistrationFailed,
+                        QObject::tr("Failed to register AppImage in system via libappimage"));
+        }
+
+        std::shared_ptr<char> desktopFilePathPtr(
+            appimage_registered_desktop_file_path(pathToAppImage.toStdString().c_str(), nullptr, false),
+            free
+        );
+
+        // sanity check -- if the file doesn't exist, the function returns NULL
+        if (desktopFilePathPtr == nullptr) {
+            return fail(IntegrationError::DesktopFileNotFound, QObject::tr("Failed to find integrated desktop file"));
+        }
+
+        const auto* desktopFilePath = desktopFilePathPtr.get();
+        result.desktopFilePath = desktopFilePath;
+
+        // check that file exists
+        if (!QFile(desktopFilePath).exists()) {
+            return fail(IntegrationError::DesktopFileNotFound,
+                        QObject::tr("Couldn't find integrated AppImage's desktop file"));
+        }
+
+        /* write AppImageLauncher specific entries to desktop file
+         *
+         * unfortunately, QSettings doesn't work as a desktop file reader/writer, and libqtxdg isn't really meant to be
+         * used by projects via add_subdirectory/ExternalProject
+         * a system dependency is not an option for this project, and we link to glib already anyway, so let's just use
+         * glib, which is known to work
+         */
+
+        std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), gKeyFileDeleter);
+
+        GError* error = nullptr;
+
+        const auto flags = GKeyFileFlags(G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS);
+
+        auto describeError = [&error](const QString& prefix) {
+            std::ostringstream ss;
+            ss << prefix.toStdString() << std::endl << (error != nullptr ? error->message : "");
+            g_clear_error(&error);
+            return QString::fromStdString(ss.str());
+        };
+
+        if (!g_key_file_load_from_file(desktopFile.get(), desktopFilePath, flags, &error)) {
+            return fail(IntegrationError::DesktopFileInvalid, describeError(QObject::tr("Failed to load desktop file:")));
+        }
+
+        std::shared_ptr<gchar> nameEntry(
+            g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, nullptr),
+            g_free
+        );
+
+        if (nameEntry == nullptr) {
+            result.warnings << QObject::tr("AppImage has invalid desktop file");
+        }
+
+        // without a Name entry, there's nothing to compare with
+        if (context.resolveCollisions && nameEntry != nullptr) {
+            // TODO: support multilingual collisions
+            auto collisions = findCollisions(nameEntry.get());
+
+            // make sure to remove own entry
+            collisions.erase(desktopFilePath);
+
+            const auto number = reserveCollisionNumber(nameEntry.get(), desktopFilePath,
+                                                       calculateCollisionNumber(collisions));
+
+            if (number > 0) {
+                auto newName = QString(nameEntry.get()) + " (" + QString::number(number) + ")";
+                g_key_file_set_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, newName.toStdString().c_str());
+            }
+        }
+
+        auto convertToCharPointerList = [](const std::vector<std::string>& stringList) {
+            std::vector<const char*> pointerList;
+
+            // reserve space to increase efficiency
+            pointerList.reserve(stringList.size());
+
+            // convert string list to list of const char pointers
+            for (const auto& action : stringList) {
+                pointerList.push_back(action.c_str());
+            }
+
+            return pointerList;
+        };
+
+        std::vector<std::string> desktopActions;
+
+        // we may not just overwrite the existing actions key, as then the actions cannot be used any more from the context menu
+        {
+            std::shared_ptr<gchar> actionsEntry(
+                g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_ACTIONS, nullptr),
+                g_free
+            );
+
+            for (const QString& action : QString(actionsEntry.get()).split(";")) {
+                if (action.isEmpty()) {
+                    continue;
+                }
+
+                desktopActions.emplace_back(action.toStdString());
+            }
+        }
+
+        // use a "vendor prefix" to avoid collisions with existing actions, as "Update" and "Remove" are generic terms
+        static const std::string removeActionKey{"AppImageLauncher-Remove-AppImage"};
+        static const std::string updateActionKey{"AppImageLauncher-Update-AppImage"};
+
+        desktopActions.emplace_back(removeActionKey);
+
+#ifndef BUILD_LITE
+        const auto& privateLibDir = context.privateLibDir;
+
+        const char helperIconName[] = "AppImageLauncher";
+#else
+        const char helperIconName[] = "AppImageLauncher-Lite";
+#endif
+
+        // add Remove action
+        {
+            const auto removeSectionName = "Desktop Action " + removeActionKey;
+
+            g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Name", "Delete this AppImage");
+            g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Icon", helperIconName);
+
+            std::ostringstream removeExecPath;
+
+#ifndef BUILD_LITE
+            removeExecPath << privateLibDir.toStdString() << "/remove";
+#else
+            removeExecPath << getenv("HOME") << "/.local/lib/appimagelauncher-lite/appimagelauncher-lite.AppImage remove";
+#endif
+
+            removeExecPath << " \"" << pathToAppImage.toStdString() << "\"";
+
+            g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Exec", removeExecPath.str().c_str());
+
+            // install translations
+            auto it = QMapIterator<QString, QString>(context.removeActionNameTranslations);
+            while (it.hasNext()) {
+                auto entry = it.next();
+                g_key_file_set_locale_string(desktopFile.get(), removeSectionName.c_str(), "Name", entry.key().toStdString().c_str(), entry.value().toStdString().c_str());
+            }
+        }
+
+#ifdef ENABLE_UPDATE_HELPER
+        // add Update action
+        {
+            appimage::update::Updater updater(pathToAppImage.toStdString());
+
+            // but only if there's update information
+            if (!updater.updateInformation().empty()) {
+                // section needs to be announced in desktop actions list
+                desktopActions.emplace_back(updateActionKey);
+
+                const auto updateSectionName = "Desktop Action " + updateActionKey;
+
+                g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Name", "Update this AppImage");
+                g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Icon", helperIconName);
+
+                std::ostringstream updateExecPath;
+
+#ifndef BUILD_LITE
+                updateExecPath << privateLibDir.toStdString() << "/update";
+#else
+                updateExecPath << getenv("HOME") << "/.local/lib/appimagelauncher-lite/appimagelauncher-lite.AppImage update";
+#endif
+                updateExecPath << " \"" << pathToAppImage.toStdString() << "\"";
+
+                g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Exec", updateExecPath.str().c_str());
+
+                // install translations
+                auto it = QMapIterator<QString, QString>(context.updateActionNameTranslations);
+                while (it.hasNext()) {
+                    auto entry = it.next();
+                    g_key_file_set_locale_string(desktopFile.get(), updateSectionName.c_str(), "Name", entry.key().toStdString().c_str(), entry.value().toStdString().c_str());
+                }
+            }
+        }
+#endif
+
+        // add desktop actions key
+        g_key_file_set_string_list(
+                desktopFile.get(),
+                G_KEY_FILE_DESKTOP_GROUP,
+                G_KEY_FILE_DESKTOP_KEY_ACTIONS,
+                convertToCharPointerList(desktopActions).data(),
+                desktopActions.size()
+        );
+
+        // add version key
+        const auto version = context.applicationVersion.toStdString();
+        g_key_file_set_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, "X-AppImageLauncher-Version", version.c_str());
+
+        // render the desktop file in memory, so it can be written in one go
+        gsize desktopFileSize = 0;
+        std::shared_ptr<gchar> desktopFileData(g_key_file_to_data(desktopFile.get(), &desktopFileSize, &error), g_free);
+
+        if (desktopFileData == nullptr) {
+            return fail(IntegrationError::DesktopFileNotSaved, describeError(QObject::tr("Failed to save desktop file:")));
+        }
+
+        // make desktop file executable ("trustworthy" to some DEs)
+        // TODO: handle this in libappimage
+        mode_t desktopFileMode = 0644;
+        {
+            struct stat desktopFileStat{};
+
+            if (stat(desktopFilePath, &desktopFileStat) == 0) {
+                desktopFileMode = desktopFileStat.st_mode & 07777;
+            }
+        }
+        desktopFileMode |= 0111;
+
+        // the file written by libappimage is replaced atomically, either right away or when the caller commits its
+        // batch
+        {
+            DesktopFileBatch ownBatch;
+            auto& targetBatch = batch != nullptr ? *batch : ownBatch;
+
+            const QByteArray contents(desktopFileData.get(), static_cast<int>(desktopFileSize));
+
+            if (!targetBatch.stage(desktopFilePath, contents, desktopFileMode) ||
+                (batch == nullptr && !ownBatch.commit())) {
+                return fail(IntegrationError::DesktopFileNotSaved, QObject::tr("Failed to save desktop file"));
+            }
+        }
+
+        // remember which resources belong to the AppImage, so they can be cleaned up once it's gone
+        // the index is just a cache, so this isn't worth bothering users with
+        if (resourceIndexBatch != nullptr) {
+            resourceIndexBatch->record(pathToAppImage, desktopFilePath);
+        } else if (!recordDesktopIntegrationResources(pathToAppImage, desktopFilePath)) {
+            std::cerr << "Warning: failed to record desktop integration resources" << std::endl;
+        }
+
+        return result;
+    }
+
+    void IntegrationEngine::notifyIconsChanged() {
+        // notify KDE/Plasma about icon change
+        auto message = QDBusMessage::createSignal(QStringLiteral("/KIconLoader"), QStringLiteral("org.kde.KIconLoader"), QStringLiteral("iconChanged"));
+        message.setArguments({0});
+        QDBusConnection::sessionBus().send(message);
+    }
+
+}
@@ -0,0 +1,136 @@
+/*
+ * Integration engine
+ *
+ * Installs the desktop files and icons of AppImages, including the AppImageLauncher specific modifications. Unlike the
+ * convenience wrappers in shared.h, the engine never interacts with the user, reads global application state or talks
+ * to other processes. Everything it needs is passed in explicitly via an IntegrationContext, and problems are reported
+ * in an IntegrationResult. Therefore, the same engine may be used from many threads at once (e.g., by the daemon's
+ * worker).
+ *
+ * Name collisions with existing desktop entries are resolved like before, by appending a number in brackets. Since
+ * concurrent integrations can't see each other's desktop files before they have been written, the numbers handed out
+ * are additionally reserved within the engine. The reservations are split into shards by name, so integrations of
+ * AppImages with different names don't have to wait for each other.
+ */
+
+#pragma once
+
+// system headers
+#include <array>
+#include <map>
+#include <string>
+
+// library headers
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// local headers
+#include "desktopfilebatch.h"
+#include "resourceindex.h"
+
+namespace appimagelauncher {
+
+    // everything the engine needs to know about its environment
+    // creating a context is somewhat expensive (translations are loaded from disk), so it should be created once and
+    // reused for a batch of integrations
+    struct IntegrationContext {
+        // written into the desktop files, so outdated integrations can be detected
+        QString applicationVersion;
+
+        // set to false in order to leave the Name entries as-is
+        bool resolveCollisions = true;
+
+#ifndef BUILD_LITE
+        // location of the remove and update helpers
+        QString privateLibDir;
+#endif
+
+        // translated names of the desktop actions, keyed by locale
+        QMap<QString, QString> removeActionNameTranslations;
+        QMap<QString, QString> updateActionNameTranslations;
+
+        // problems found while creating the context, which the creator may want to report once
+        QStringList warnings;
+
+        // creates a context from the current application's state
+        // must be called after the application object has been created
+        static IntegrationContext fromApplication();
+    };
+
+    enum class IntegrationError {
+        None = 0,
+        RegistrationFailed,
+        DesktopFileNotFound,
+        DesktopFileInvalid,
+        DesktopFileNotSaved,
+    };
+
+    struct IntegrationResult {
+        IntegrationError error = IntegrationError::None;
+
+        // human readable, translated description of the error, empty on success
+        QString errorMessage;
+
+        // non-fatal problems, the integration succeeded nevertheless
+        QStringList warnings;
+
+        // path to the installed desktop file, empty if the AppImage couldn't be registered
+        QString desktopFilePath;
+
+        bool success() const;
+    };
+
+    // looks for existing desktop files whose Name entries start with the given one
+    // returns the Name entries keyed by the desktop files' paths
+    std::map<std::string, std::string> findCollisions(const QString& currentNameEntry);
+
+    class IntegrationEngine {
+    public:
+        IntegrationEngine() = default;
+
+        // reservations are specific to an engine instance
+        IntegrationEngine(const IntegrationEngine&) = delete;
+        IntegrationEngine& operator=(const IntegrationEngine&) = delete;
+
+    public:
+        // installs desktop file and icons for the given AppImage
+        // if a batch is passed, the final desktop file is only staged, and the caller has to commit the batch
+        // likewise, if a resource index batch is passed, the installed resources are only recorded in there
+        // safe to be called from multiple threads at once
+        IntegrationResult installDesktopFileAndIcons(const QString& pathToAppImage, const IntegrationContext& context,
+                                                     DesktopFileBatch* batch = nullptr,
+                                                     DesktopResourceIndexBatch* resourceIndexBatch = nullptr);
+
+        // notifies desktop environments which cache icons (i.e., KDE/Plasma) about changed icons
+        // uses D-Bus, so it should be called once after a batch of integrations rather than after every one of them
+        static void notifyIconsChanged();
+
+    private:
+        // returns the number to be appended to the given Name entry, or 0 if the Name entry may be used as-is
+        // numberFromDisk is the number calculated from the existing desktop entries, or 0 if there are no collisions
+        unsigned int reserveCollisionNumber(const QString& nameEntry, const QString& desktopFilePath,
+                                            unsigned int numberFromDisk);
+
+    private:
+        struct NameReservation {
+            // the next number to hand out
+            unsigned int nextNumber = 0;
+
+            // integrating the same AppImage again must not result in a new number
+            QHash<QString, unsigned int> numbersByDesktopFile;
+        };
+
+        struct ReservationShard {
+            QMutex mutex;
+            QHash<QString, NameReservation> reservations;
+        };
+
+        static constexpr size_t SHARD_COUNT = 16;
+
+        std::array<ReservationShard, SHARD_COUNT> _shards;
+    };
+
+}
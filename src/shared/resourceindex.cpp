@@ -0,0 +1,204 @@
+// system includes
+#include <utility>
+
+// library includes
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// local headers
+#include "resourceindex.h"
+
+// must be bumped whenever the file format changes
+static constexpr int DESKTOP_RESOURCE_INDEX_VERSION = 1;
+
+// updates are short, waiting longer than this means something is wrong with the lock file
+static constexpr int LOCK_TIMEOUT_MS = 10 * 1000;
+
+// QLockFile is meant to synchronize processes, threads within the same process have to be synchronized separately
+static QMutex indexMutex;
+
+DesktopResourceIndex::DesktopResourceIndex(QString path) : _path(std::move(path)) {}
+
+QString DesktopResourceIndex::defaultPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+           "/appimagelauncher/desktop-resources.json";
+}
+
+QStringList DesktopResourceIndex::findResourcesOwnedBy(const QString& desktopFilePath) {
+    static const QRegularExpression desktopFileNamePattern("^(appimagekit_[0-9a-f]{32})");
+
+    const auto match = desktopFileNamePattern.match(QFileInfo(desktopFilePath).fileName());
+
+    if (!match.hasMatch()) {
+        return {};
+    }
+
+    const QStringList nameFilters{match.captured(1) + "*"};
+
+    const auto dataLocation = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+
+    QStringList resources;
+
+    auto collect = [&resources, &nameFilters](const QDir& dir) {
+        for (const auto& fileName : dir.entryList(nameFilters, QDir::Files | QDir::System | QDir::Hidden)) {
+            resources << dir.absoluteFilePath(fileName);
+        }
+    };
+
+    // libappimage installs icons only into the hicolor theme, so we just need to check its size directories rather
+    // than walking the entire icons tree
+    const QDir hicolorDir(dataLocation + "/icons/hicolor");
+
+    for (const auto& sizeDirName : hicolorDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        for (const auto* subdirName : {"apps", "mimetypes"}) {
+            const QDir dir(hicolorDir.filePath(sizeDirName + "/" + subdirName));
+
+            if (dir.exists()) {
+                collect(dir);
+            }
+        }
+    }
+
+    collect(QDir(dataLocation + "/mime/packages"));
+
+    return resources;
+}
+
+bool DesktopResourceIndex::lock() {
+    if (_fileLock != nullptr) {
+        return true;
+    }
+
+    _threadLock = std::make_unique<QMutexLocker>(&indexMutex);
+
+    QDir().mkpath(QFileInfo(_path).path());
+
+    auto fileLock = std::make_unique<QLockFile>(_path + ".lock");
+
+    if (!fileLock->tryLock(LOCK_TIMEOUT_MS)) {
+        _threadLock.reset();
+        return false;
+    }
+
+    _fileLock = std::move(fileLock);
+    return true;
+}
+
+bool DesktopResourceIndex::load() {
+    _entries.clear();
+
+    QFile file(_path);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const auto document = QJsonDocument::fromJson(file.readAll());
+
+    if (!document.isObject() || document.object()["version"].toInt() != DESKTOP_RESOURCE_INDEX_VERSION) {
+        return false;
+    }
+
+    const auto entries = document.object()["entries"].toObject();
+
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        const auto entryObject = it.value().toObject();
+
+        DesktopResourceIndexEntry entry;
+        entry.appImagePath = entryObject["appimage"].toString();
+
+        for (const auto& resource : entryObject["resources"].toArray()) {
+            entry.resources << resource.toString();
+        }
+
+        if (entry.appImagePath.isEmpty()) {
+            continue;
+        }
+
+        _entries.insert(it.key(), entry);
+    }
+
+    return true;
+}
+
+bool DesktopResourceIndex::save() const {
+    QJsonObject entries;
+
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+        entries.insert(it.key(), QJsonObject{
+            {"appimage", it.value().appImagePath},
+            {"resources", QJsonArray::fromStringList(it.value().resources)},
+        });
+    }
+
+    const QJsonObject root{
+        {"version", DESKTOP_RESOURCE_INDEX_VERSION},
+        {"entries", entries},
+    };
+
+    QDir().mkpath(QFileInfo(_path).path());
+
+    QSaveFile file(_path);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+
+    return file.commit();
+}
+
+QMap<QString, DesktopResourceIndexEntry>& DesktopResourceIndex::entries() {
+    return _entries;
+}
+
+void DesktopResourceIndexBatch::record(const QString& pathToAppImage, const QString& desktopFilePath) {
+    // looking up the resources involves the file system, which is done before locking the mutex
+    DesktopResourceIndexEntry entry{
+        QFileInfo(pathToAppImage).absoluteFilePath(),
+        DesktopResourceIndex::findResourcesOwnedBy(desktopFilePath),
+    };
+
+    QMutexLocker locker(&_mutex);
+    _entries.insert(desktopFilePath, std::move(entry));
+}
+
+bool DesktopResourceIndexBatch::commit() {
+    QMutexLocker locker(&_mutex);
+
+    if (_entries.isEmpty()) {
+        return true;
+    }
+
+    DesktopResourceIndex index;
+
+    if (!index.lock()) {
+        return false;
+    }
+
+    index.load();
+
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+        index.entries().insert(it.key(), it.value());
+    }
+
+    _entries.clear();
+
+    return index.save();
+}
+
+bool recordDesktopIntegrationResources(const QString& pathToAppImage, const QString& desktopFilePath) {
+    DesktopResourceIndexBatch batch;
+    batch.record(pathToAppImage, desktopFilePath);
+    return batch.commit();
+}
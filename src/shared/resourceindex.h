@@ -0,0 +1,89 @@
+/*
+ * Desktop integration resource index
+ *
+ * Maps the desktop files installed for AppImages to the AppImages' paths and the other resources (icons, MIME
+ * definitions) that belong to them. This allows for cleaning up the resources of AppImages which have been removed
+ * without parsing every desktop file and walking the entire icons directory tree every time.
+ *
+ * The index is just a cache: desktop files which are not listed in there (e.g., because they have been installed by
+ * an older version or by another tool using libappimage) are parsed once and added to the index during cleanup.
+ */
+
+#pragma once
+
+// system headers
+#include <memory>
+
+// library headers
+#include <QLockFile>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QStringList>
+
+struct DesktopResourceIndexEntry {
+    QString appImagePath;
+    // icons and MIME definitions, not including the desktop file itself
+    QStringList resources;
+};
+
+class DesktopResourceIndex {
+public:
+    explicit DesktopResourceIndex(QString path = defaultPath());
+
+public:
+    // path to the index file within $XDG_CACHE_HOME
+    static QString defaultPath();
+
+    // lists the icons and MIME definitions libappimage installed along with the given desktop file
+    // libappimage prefixes all of them with appimagekit_<MD5 digest of the AppImage's path>
+    static QStringList findResourcesOwnedBy(const QString& desktopFilePath);
+
+    // the index is updated by several processes (e.g., the daemon and AppImageLauncher), so the lock must be held from
+    // loading the index until saving it
+    // the lock is held until this object is destroyed
+    // returns false if the lock couldn't be acquired in time
+    bool lock();
+
+    // returns false if the index doesn't exist or cannot be parsed; the index is empty then
+    bool load();
+
+    // writes the index atomically
+    bool save() const;
+
+    // entries, keyed by the desktop files' paths
+    QMap<QString, DesktopResourceIndexEntry>& entries();
+
+private:
+    const QString _path;
+    QMap<QString, DesktopResourceIndexEntry> _entries;
+    std::unique_ptr<QMutexLocker> _threadLock;
+    std::unique_ptr<QLockFile> _fileLock;
+};
+
+// collects the resources installed for a batch of integrations, so the index needs to be loaded and saved just once
+class DesktopResourceIndexBatch {
+public:
+    DesktopResourceIndexBatch() = default;
+
+    DesktopResourceIndexBatch(const DesktopResourceIndexBatch&) = delete;
+    DesktopResourceIndexBatch& operator=(const DesktopResourceIndexBatch&) = delete;
+
+public:
+    // looks up the resources installed for an integrated AppImage
+    // must be called after the desktop file and icons have been installed
+    // safe to be called from multiple threads at once
+    void record(const QString& pathToAppImage, const QString& desktopFilePath);
+
+    // merges the recorded entries into the index
+    bool commit();
+
+private:
+    QMutex _mutex;
+    QMap<QString, DesktopResourceIndexEntry> _entries;
+};
+
+// records the resources installed for an integrated AppImage in the index
+// must be called after the desktop file and icons have been installed
+bool recordDesktopIntegrationResources(const QString& pathToAppImage, const QString& desktopFilePath);
@@ -1,4 +1,5 @@
 // system includes
+#include <cerrno>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -8,48 +9,43 @@ extern "C" {
     #include <appimage/appimage.h>
     #include <glib.h>
     // #include <libgen.h>
+    #include <fcntl.h>
     #include <sys/stat.h>
     #include <stdio.h>
     #include <unistd.h>
 }
 
 // library includes
+#include <QApplication>
 #include <QDebug>
 #include <QIcon>
-#include <QtDBus>
 #include <QDirIterator>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonParseError>
+#include <QFile>
+#include <QFileInfo>
 #include <QLibraryInfo>
-#include <QMap>
-#include <QMapIterator>
 #include <QMessageBox>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QObject>
-#include <QRegularExpression>
+#include <QProcess>
+#include <QProgressDialog>
+#include <QHash>
 #include <QSet>
 #include <QSettings>
 #include <QStandardPaths>
 #include <QWindow>
 #include <QPushButton>
 #include <QPixmap>
-#ifdef ENABLE_UPDATE_HELPER
-#include <appimage/update.h>
-#endif
 
 // local headers
 #include "shared.h"
-#include "translationmanager.h"
-
-static void gKeyFileDeleter(GKeyFile* ptr) {
-    if (ptr != nullptr)
-        g_key_file_free(ptr);
-}
-
-static void gErrorDeleter(GError* ptr) {
-    if (ptr != nullptr)
-        g_error_free(ptr);
-}
+#include "appimagesniffer.h"
+#include "filecopy.h"
+#include "integrationengine.h"
+#include "resourceindex.h"
+#include "integrationindex.h"
+#include "extractcache.h"
+#include "tracing.h"
 
 bool makeExecutable(const QString& path) {
     struct stat fileStat{};
@@ -151,6 +147,10 @@ void createConfigFile(int askToMove,
         file.write("\n");
     }
 
+    // opt-in features, not configurable in the first run dialog
+    file.write("# extract_and_run = false\n");
+    file.write("# extract_and_run_cache_size = 4096\n");
+
     file.write("\n\n");
 
     // daemon configs
@@ -175,6 +175,9 @@ void createConfigFile(int askToMove,
         }
         file.write("\n");
     }
+
+    // opt-in features, not configurable in the first run dialog
+    file.write("# enable_zygote = false\n");
 }
 
 QSettings* getConfig(QObject* parent) {
@@ -198,6 +201,8 @@ QSettings* getConfig(QObject* parent) {
 
 // TODO: check if this works with Wayland
 bool isHeadless() {
+    appimagelauncher::TraceSpan span("isHeadless");
+
     bool isHeadless = true;
 
     // not really clean to abuse env vars as "global storage", but hey, it works
@@ -251,10 +256,7 @@ void displayWarning(const QString& message) {
 }
 
 QDir integratedAppImagesDestination() {
-    auto config = getConfig();
-
-    if (config == nullptr)
-        return DEFAULT_INTEGRATION_DESTINATION;
+    const auto config = currentConfig();
 
     static const QString keyName("AppImageLauncher/destination");
     if (config->contains(keyName))
@@ -394,17 +396,40 @@ QSet<QString> additionalAppImagesLocations(const bool includeAllMountPoints) {
     return additionalLocations;
 }
 
-bool shallMonitorMountedFilesystems(const QSettings* config) {
-    Q_ASSERT(config != nullptr);
+bool shallMonitorMountedFilesystems(const ConfigSnapshot& config) {
+    return config.value("appimagelauncherd/monitor_mounted_filesystems", "false").toBool();
+}
+
+bool shallEnableLaunchZygote(const ConfigSnapshot& config) {
+    return config.value("appimagelauncherd/enable_zygote", "false").toBool();
+}
+
+QString daemonMetricsFilePath(const ConfigSnapshot& config) {
+    const auto path = config.value("appimagelauncherd/metrics_file", "").toString();
 
-    return config->value("appimagelauncherd/monitor_mounted_filesystems", "false").toBool();
+    if (path.isEmpty()) {
+        return path;
+    }
+
+    return expandTilde(path);
 }
 
-QDirSet getAdditionalDirectoriesFromConfig(const QSettings* config) {
-    Q_ASSERT(config != nullptr);
+std::chrono::milliseconds daemonMetricsWriteInterval(const ConfigSnapshot& config) {
+    constexpr auto defaultInterval = 60;
 
+    bool ok = false;
+    auto seconds = config.value("appimagelauncherd/metrics_interval", defaultInterval).toInt(&ok);
+
+    if (!ok || seconds <= 0) {
+        seconds = defaultInterval;
+    }
+
+    return std::chrono::seconds(seconds);
+}
+
+QDirSet getAdditionalDirectoriesFromConfig(const ConfigSnapshot& config) {
     constexpr auto configKey = "appimagelauncherd/additional_directories_to_watch";
-    const auto configValue = config->value(configKey, "").toString();
+    const auto configValue = config.value(configKey, "").toString();
     qDebug() << configKey << "value:" << configValue;
 
     QDirSet additionalDirs{};
@@ -442,7 +467,7 @@ QDirSet getAdditionalDirectoriesFromConfig(const QSettings* config) {
     return additionalDirs;
 }
 
-QDirSet daemonDirectoriesToWatch(const QSettings* config) {
+QDirSet daemonDirectoriesToWatch(const ConfigSnapshot& config) {
     QDirSet watchedDirectories;
 
     // of course we need to watch the main integration directory
@@ -508,46 +533,6 @@ QString buildPathToIntegratedAppImage(const QString& pathToAppImage) {
     return integratedAppImagesDestination().path() + "/" + fileName;
 }
 
-std::map<std::string, std::string> findCollisions(const QString& currentNameEntry) {
-    std::map<std::string, std::string> collisions{};
-
-    // default locations of desktop files on systems
-    const auto directories = {
-        QString("/usr/share/applications/"),
-        QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/applications/"
-    };
-
-    for (const auto& directory : directories) {
-        QDirIterator iterator(directory, QDirIterator::FollowSymlinks);
-
-        while (iterator.hasNext()) {
-            const auto filename = iterator.next();
-
-            if (!QFileInfo(filename).isFile() || !filename.endsWith(".desktop"))
-                continue;
-
-            std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), gKeyFileDeleter);
-            std::shared_ptr<GError*> error(nullptr, gErrorDeleter);
-
-            // if the key file parser can't load the file, it's most likely not a valid desktop file, so we just skip this file
-            if (!g_key_file_load_from_file(desktopFile.get(), filename.toStdString().c_str(), G_KEY_FILE_KEEP_TRANSLATIONS, error.get()))
-                continue;
-
-            auto* nameEntry = g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, error.get());
-
-            // invalid desktop file, needs to be skipped
-            if (nameEntry == nullptr)
-                continue;
-
-            if (QString(nameEntry).trimmed().startsWith(currentNameEntry.trimmed())) {
-                collisions[filename.toStdString()] = nameEntry;
-            }
-        }
-    }
-
-    return collisions;
-}
-
 bool updateDesktopDatabaseAndIconCaches() {
     const auto dataLocation = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
 
@@ -611,298 +596,72 @@ QString privateLibDirPath(const QString& srcSubdirName) {
 #endif
 
 bool installDesktopFileAndIcons(const QString& pathToAppImage, bool resolveCollisions) {
-    if (appimage_register_in_system(pathToAppImage.toStdString().c_str(), false) != 0) {
-        displayError(QObject::tr("Failed to register AppImage in system via libappimage"));
-        return false;
-    }
-
-    const auto* desktopFilePath = appimage_registered_desktop_file_path(pathToAppImage.toStdString().c_str(), nullptr, false);
+    auto context = appimagelauncher::IntegrationContext::fromApplication();
+    context.resolveCollisions = resolveCollisions;
 
-    // sanity check -- if the file doesn't exist, the function returns NULL
-    if (desktopFilePath == nullptr) {
-        displayError(QObject::tr("Failed to find integrated desktop file"));
-        return false;
-    }
-
-    // check that file exists
-    if (!QFile(desktopFilePath).exists()) {
-        displayError(QObject::tr("Couldn't find integrated AppImage's desktop file"));
-        return false;
+    for (const auto& warning : context.warnings) {
+        displayWarning(warning);
     }
 
-    /* write AppImageLauncher specific entries to desktop file
-     *
-     * unfortunately, QSettings doesn't work as a desktop file reader/writer, and libqtxdg isn't really meant to be
-     * used by projects via add_subdirectory/ExternalProject
-     * a system dependency is not an option for this project, and we link to glib already anyway, so let's just use
-     * glib, which is known to work
-     */
-
-    std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), gKeyFileDeleter);
-
-    std::shared_ptr<GError*> error(nullptr, gErrorDeleter);
+    // collisions with integrations performed by other engines are still detected by looking at the desktop files
+    appimagelauncher::IntegrationEngine engine;
+    const auto result = engine.installDesktopFileAndIcons(pathToAppImage, context);
 
-    const auto flags = GKeyFileFlags(G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS);
-
-    auto handleError = [error, desktopFile]() {
-        std::ostringstream ss;
-        ss << QObject::tr("Failed to load desktop file:").toStdString() << std::endl << (*error)->message;
-        displayError(QString::fromStdString(ss.str()));
-    };
-
-    if (!g_key_file_load_from_file(desktopFile.get(), desktopFilePath, flags, error.get())) {
-        handleError();
-        return false;
+    for (const auto& warning : result.warnings) {
+        displayWarning(warning);
     }
 
-    const auto* nameEntry = g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, error.get());
-
-    if (nameEntry == nullptr) {
-        displayWarning(QObject::tr("AppImage has invalid desktop file"));
-    }
-
-    if (resolveCollisions) {
-        // TODO: support multilingual collisions
-        auto collisions = findCollisions(nameEntry);
-
-        // make sure to remove own entry
-        collisions.erase(collisions.find(desktopFilePath));
-
-        if (!collisions.empty()) {
-            // collisions are resolved like in the filesystem: a monotonically increasing number in brackets is
-            // appended to the Name in order to keep the number monotonically increasing, we look for the highest
-            // number in brackets in the existing entries, add 1 to it, and append it in brackets to the current
-            // desktop file's Name entry
-
-            unsigned int currentNumber = 1;
-
-            QRegularExpression regex(R"(^.*\(([0-9]+)\)$)");
-
-            for (const auto& collision : collisions) {
-                const auto& currentNameEntry = collision.second;
-
-                auto match = regex.match(QString::fromStdString(currentNameEntry));
-
-                if (match.hasMatch()) {
-                    // 0 = entire string
-                    // 1 = first group
-                    const QString numString = match.captured(1);
-                    const int num = numString.toInt();
-
-                    // monotonic counting, i.e., never try to "be smart" by e.g., filling in the gaps between
-                    // previous numbers
-                    if (num >= currentNumber) {
-                        currentNumber = num + 1;
-                    }
-                }
-            }
-
-            auto newName = QString(nameEntry) + " (" + QString::number(currentNumber) + ")";
-            g_key_file_set_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, newName.toStdString().c_str());
-        }
-    }
-
-    auto convertToCharPointerList = [](const std::vector<std::string>& stringList) {
-        std::vector<const char*> pointerList;
-
-        // reserve space to increase efficiency
-        pointerList.reserve(stringList.size());
-
-        // convert string list to list of const char pointers
-        for (const auto& action : stringList) {
-            pointerList.push_back(action.c_str());
-        }
-
-        return pointerList;
-    };
-
-    std::vector<std::string> desktopActions;
-
-    // we may not just overwrite the existing actions key, as then the actions cannot be used any more from the context menu
-    {
-        const auto* actionsEntry = g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_ACTIONS, error.get());
-        for (const QString& action : QString(actionsEntry).split(";")) {
-            if (action.isEmpty()) {
-                continue;
-            }
-
-            desktopActions.emplace_back(action.toStdString());
-        }
-    }
-
-    // use a "vendor prefix" to avoid collisions with existing actions, as "Update" and "Remove" are generic terms
-    static const std::string removeActionKey{"AppImageLauncher-Remove-AppImage"};
-    static const std::string updateActionKey{"AppImageLauncher-Update-AppImage"};
-
-    desktopActions.emplace_back(removeActionKey);
-
-    // load translations from JSON file(s)
-    QMap<QString, QString> removeActionNameTranslations;
-
-#ifdef ENABLE_UPDATE_HELPER
-    QMap<QString, QString> updateActionNameTranslations;
-
-    {
-        QDirIterator i18nDirIterator(TranslationManager::getTranslationDir());
-
-        while(i18nDirIterator.hasNext()) {
-            const auto& filePath = i18nDirIterator.next();
-            const auto& fileName = QFileInfo(filePath).fileName();
-
-            if (!QFileInfo(filePath).isFile() || !(fileName.startsWith("desktopfiles.") && fileName.endsWith(".json")))
-                continue;
-
-            // check whether filename's format is alright, otherwise parsing the locale might try to access a
-            // non-existing (or the wrong) member
-            auto splitFilename = fileName.split(".");
-
-            if (splitFilename.size() != 3)
-                continue;
-
-            // parse locale from filename
-            auto locale = splitFilename[1];
-
-            QFile jsonFile(filePath);
-
-            if (!jsonFile.open(QIODevice::ReadOnly)) {
-                displayWarning(QMessageBox::tr("Could not parse desktop file translations:\nCould not open file for reading:\n\n%1").arg(fileName));
-            }
-
-            // TODO: need to make sure that this doesn't try to read huge files at once
-            auto data = jsonFile.readAll();
-
-            QJsonParseError parseError{};
-            auto jsonDoc = QJsonDocument::fromJson(data, &parseError);
-
-            // show warning on syntax errors and continue
-            if (parseError.error != QJsonParseError::NoError || jsonDoc.isNull() || !jsonDoc.isObject()) {
-                displayWarning(QMessageBox::tr("Could not parse desktop file translations:\nInvalid syntax:\n\n%1").arg(parseError.errorString()));
-            }
-
-            auto jsonObj = jsonDoc.object();
-
-            for (const auto& key : jsonObj.keys()) {
-                auto value = jsonObj[key].toString();
-                auto splitKey = key.split("/");
-
-                if (key.startsWith("Desktop Action update")) {
-                    qDebug() << "update: adding" << value << "for locale" << locale;
-                    updateActionNameTranslations[locale] = value;
-                } else if (key.startsWith("Desktop Action remove")) {
-                    qDebug() << "remove: adding" << value << "for locale" << locale;
-                    removeActionNameTranslations[locale] = value;
-                }
-            }
-        }
-    }
-#endif
-
-#ifndef BUILD_LITE
-    auto privateLibDir = privateLibDirPath("ui");
-
-    const char helperIconName[] = "AppImageLauncher";
-#else
-    const char helperIconName[] = "AppImageLauncher-Lite";
-#endif
-
-    // add Remove action
-    {
-        const auto removeSectionName = "Desktop Action " + removeActionKey;
-
-        g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Name", "Delete this AppImage");
-        g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Icon", helperIconName);
-
-        std::ostringstream removeExecPath;
-
-#ifndef BUILD_LITE
-        removeExecPath << privateLibDir.toStdString() << "/remove";
-#else
-        removeExecPath << getenv("HOME") << "/.local/lib/appimagelauncher-lite/appimagelauncher-lite.AppImage remove";
-#endif
-
-        removeExecPath << " \"" << pathToAppImage.toStdString() << "\"";
-
-        g_key_file_set_string(desktopFile.get(), removeSectionName.c_str(), "Exec", removeExecPath.str().c_str());
-
-        // install translations
-        auto it = QMapIterator<QString, QString>(removeActionNameTranslations);
-        while (it.hasNext()) {
-            auto entry = it.next();
-            g_key_file_set_locale_string(desktopFile.get(), removeSectionName.c_str(), "Name", entry.key().toStdString().c_str(), entry.value().toStdString().c_str());
-        }
+    if (!result.success()) {
+        displayError(result.errorMessage);
+        return false;
     }
 
-#ifdef ENABLE_UPDATE_HELPER
-    // add Update action
-    {
-        appimage::update::Updater updater(pathToAppImage.toStdString());
-
-        // but only if there's update information
-        if (!updater.updateInformation().empty()) {
-            // section needs to be announced in desktop actions list
-            desktopActions.emplace_back(updateActionKey);
+    appimagelauncher::IntegrationEngine::notifyIconsChanged();
 
-            const auto updateSectionName = "Desktop Action " + updateActionKey;
+    return true;
+}
 
-            g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Name", "Update this AppImage");
-            g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Icon", helperIconName);
+bool updateDesktopFileAndIcons(const QString& pathToAppImage) {
+    return installDesktopFileAndIcons(pathToAppImage, true);
+}
 
-            std::ostringstream updateExecPath;
+bool askToOverwriteIntegratedAppImage() {
+    std::ostringstream message;
+    message << QObject::tr("AppImage with same filename has already been integrated.").toStdString() << std::endl
+            << std::endl
+            << QObject::tr("Do you wish to overwrite the existing AppImage?").toStdString() << std::endl
+            << QObject::tr("Choosing No will run the AppImage once, and leave the system in its current state.").toStdString();
+
+    auto* messageBox = new QMessageBox(
+        QMessageBox::Warning,
+        QObject::tr("Warning"),
+        QString::fromStdString(message.str()),
+        QMessageBox::Yes | QMessageBox::No
+    );
 
-#ifndef BUILD_LITE
-            updateExecPath << privateLibDir.toStdString() << "/update";
-#else
-            updateExecPath << getenv("HOME") << "/.local/lib/appimagelauncher-lite/appimagelauncher-lite.AppImage update";
-#endif
-            updateExecPath << " \"" << pathToAppImage.toStdString() << "\"";
+    messageBox->setDefaultButton(QMessageBox::No);
+    messageBox->show();
 
-            g_key_file_set_string(desktopFile.get(), updateSectionName.c_str(), "Exec", updateExecPath.str().c_str());
+    QApplication::exec();
 
-            // install translations
-            auto it = QMapIterator<QString, QString>(updateActionNameTranslations);
-            while (it.hasNext()) {
-                auto entry = it.next();
-                g_key_file_set_locale_string(desktopFile.get(), updateSectionName.c_str(), "Name", entry.key().toStdString().c_str(), entry.value().toStdString().c_str());
-            }
-        }
-    }
-#endif
+    return messageBox->clickedButton() != messageBox->button(QMessageBox::No);
+}
 
-    // add desktop actions key
-    g_key_file_set_string_list(
-            desktopFile.get(),
-            G_KEY_FILE_DESKTOP_GROUP,
-            G_KEY_FILE_DESKTOP_KEY_ACTIONS,
-            convertToCharPointerList(desktopActions).data(),
-            desktopActions.size()
+bool askToCopyAppImageInstead() {
+    auto* messageBox = new QMessageBox(
+        QMessageBox::Critical,
+        QObject::tr("Error"),
+        QObject::tr("Failed to move AppImage to target location.\n"
+                    "Try to copy AppImage instead?"),
+        QMessageBox::Ok | QMessageBox::Cancel
     );
 
-    // add version key
-    const auto version = QApplication::applicationVersion().replace("version ", "").toStdString();
-    g_key_file_set_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, "X-AppImageLauncher-Version", version.c_str());
-
-    // save desktop file to disk
-    if (!g_key_file_save_to_file(desktopFile.get(), desktopFilePath, error.get())) {
-        handleError();
-        return false;
-    }
+    messageBox->setDefaultButton(QMessageBox::Ok);
+    messageBox->show();
 
-    // make desktop file executable ("trustworthy" to some DEs)
-    // TODO: handle this in libappimage
-    makeExecutable(desktopFilePath);
+    QApplication::exec();
 
-    // notify KDE/Plasma about icon change
-    {
-        auto message = QDBusMessage::createSignal(QStringLiteral("/KIconLoader"), QStringLiteral("org.kde.KIconLoader"), QStringLiteral("iconChanged"));
-        message.setArguments({0});
-        QDBusConnection::sessionBus().send(message);
-    }
-
-    return true;
-}
-
-bool updateDesktopFileAndIcons(const QString& pathToAppImage) {
-    return installDesktopFileAndIcons(pathToAppImage, true);
+    return messageBox->clickedButton() != messageBox->button(QMessageBox::Cancel);
 }
 
 IntegrationState integrateAppImage(const QString& pathToAppImage, const QString& pathToIntegratedAppImage) {
@@ -918,25 +677,7 @@ IntegrationState integrateAppImage(const QString& pathToAppImage, const QString&
         // need to check whether file exists
         // if it does, the existing AppImage needs to be removed before rename can be called
         if (QFile(pathToIntegratedAppImage).exists()) {
-            std::ostringstream message;
-            message << QObject::tr("AppImage with same filename has already been integrated.").toStdString() << std::endl
-                    << std::endl
-                    << QObject::tr("Do you wish to overwrite the existing AppImage?").toStdString() << std::endl
-                    << QObject::tr("Choosing No will run the AppImage once, and leave the system in its current state.").toStdString();
-
-            auto* messageBox = new QMessageBox(
-                QMessageBox::Warning,
-                QObject::tr("Warning"),
-                QString::fromStdString(message.str()),
-                QMessageBox::Yes | QMessageBox::No
-            );
-
-            messageBox->setDefaultButton(QMessageBox::No);
-            messageBox->show();
-
-            QApplication::exec();
-
-            if (messageBox->clickedButton() == messageBox->button(QMessageBox::No)) {
+            if (!askToOverwriteIntegratedAppImage()) {
                 return INTEGRATION_ABORTED;
             }
 
@@ -944,24 +685,32 @@ IntegrationState integrateAppImage(const QString& pathToAppImage, const QString&
         }
 
         if (!QFile(pathToAppImage).rename(pathToIntegratedAppImage)) {
-            auto* messageBox = new QMessageBox(
-                QMessageBox::Critical,
-                QObject::tr("Error"),
-                QObject::tr("Failed to move AppImage to target location.\n"
-                            "Try to copy AppImage instead?"),
-                QMessageBox::Ok | QMessageBox::Cancel
-            );
-
-            messageBox->setDefaultButton(QMessageBox::Ok);
-            messageBox->show();
+            if (!askToCopyAppImageInstead())
+                return INTEGRATION_FAILED;
 
-            QApplication::exec();
+            // copying multi-GB AppImages can take a while, so we show the progress and keep the UI responsive
+            QProgressDialog progressDialog(
+                QObject::tr("Copying AppImage to target location..."), QObject::tr("Cancel"), 0, 100
+            );
+            progressDialog.setWindowModality(Qt::ApplicationModal);
+            progressDialog.setMinimumDuration(500);
+
+            const auto copyResult = appimagelauncher::copyFile(
+                pathToAppImage, pathToIntegratedAppImage,
+                [&progressDialog](qint64 bytesCopied, qint64 bytesTotal) {
+                    progressDialog.setValue(bytesTotal > 0 ? static_cast<int>(bytesCopied * 100 / bytesTotal) : 100);
+                    QCoreApplication::processEvents();
+                    return !progressDialog.wasCanceled();
+                }
+            );
 
-            if (messageBox->clickedButton() == messageBox->button(QMessageBox::Cancel))
-                return INTEGRATION_FAILED;
+            // like choosing not to overwrite an existing AppImage, the AppImage is run once from where it is
+            if (copyResult.canceled) {
+                return INTEGRATION_ABORTED;
+            }
 
-            if (!QFile(pathToAppImage).copy(pathToIntegratedAppImage)) {
-                displayError("Failed to copy AppImage to target location");
+            if (!copyResult.success) {
+                displayError(QObject::tr("Failed to copy AppImage to target location:\n\n%1").arg(copyResult.errorMessage()));
                 return INTEGRATION_FAILED;
             }
         }
@@ -974,11 +723,13 @@ IntegrationState integrateAppImage(const QString& pathToAppImage, const QString&
 }
 
 QString getAppImageDigestMd5(const QString& path) {
+    appimagelauncher::TraceSpan span("digest");
+
     // try to read embedded MD5 digest
     unsigned long offset = 0, length = 0;
 
     // first of all, digest calculation is supported only for type 2
-    if (appimage_get_type(path.toStdString().c_str(), false) != 2)
+    if (sniffAppImageType(path) != 2 || appimage_get_type(path.toStdString().c_str(), false) != 2)
         return "";
 
     auto rv = appimage_get_elf_section_offset_and_length(path.toStdString().c_str(), ".digest_md5", &offset, &length);
@@ -1040,11 +791,162 @@ bool hasAlreadyBeenIntegrated(const QString& pathToAppImage) {
     return appimage_is_registered_in_system(pathToAppImage.toStdString().c_str());
 }
 
+// the index is rewritten as a whole, so concurrent updates from the worker threads need to be serialized
+// concurrent updates from other processes are not synchronized; the worst case is a lost entry, which just means the
+// AppImage is launched via AppImageLauncher once more, which then adds it again
+static QMutex integrationIndexMutex;
+
+// loads the current index and drops all entries which are outdated or refer to the given AppImage
+static std::vector<appimagelauncher::IntegrationIndexEntry> loadCurrentIntegrationIndexEntries(const std::string& indexPath, const std::string& appImagePath) {
+    std::vector<appimagelauncher::IntegrationIndexEntry> entries;
+
+    for (auto& entry : appimagelauncher::IntegrationIndex(indexPath).entries()) {
+        if (entry.appImagePath == appImagePath || !appimagelauncher::integrationIndexEntryIsCurrent(entry)) {
+            continue;
+        }
+
+        entries.emplace_back(std::move(entry));
+    }
+
+    return entries;
+}
+
+bool addToIntegrationIndex(const QString& pathToAppImage) {
+    // in extract-and-run mode, all launches must go through AppImageLauncher, which runs the extracted copy
+    if (extractAndRunEnabled(*currentConfig())) {
+        return removeFromIntegrationIndex(pathToAppImage);
+    }
+
+    // the interpreter looks up the canonical path, so we have to store that one
+    const auto canonicalPath = QFileInfo(pathToAppImage).canonicalFilePath().toStdString();
+
+    if (canonicalPath.empty()) {
+        return false;
+    }
+
+    std::shared_ptr<char> desktopFilePath(
+        appimage_registered_desktop_file_path(pathToAppImage.toStdString().c_str(), nullptr, false),
+        [](char* p) { free(p); }
+    );
+
+    if (desktopFilePath == nullptr) {
+        return false;
+    }
+
+    appimagelauncher::IntegrationIndexEntry newEntry;
+
+    if (!appimagelauncher::makeIntegrationIndexEntry(canonicalPath, desktopFilePath.get(), newEntry)) {
+        return false;
+    }
+
+    const auto indexPath = appimagelauncher::defaultIntegrationIndexPath();
+
+    QMutexLocker lock(&integrationIndexMutex);
+
+    auto entries = loadCurrentIntegrationIndexEntries(indexPath, canonicalPath);
+    entries.emplace_back(std::move(newEntry));
+
+    return appimagelauncher::writeIntegrationIndex(indexPath, entries);
+}
+
+bool removeFromIntegrationIndex(const QString& pathToAppImage) {
+    const auto indexPath = appimagelauncher::defaultIntegrationIndexPath();
+
+    QMutexLocker lock(&integrationIndexMutex);
+
+    // if the file is gone already, we can't calculate the canonical path any more, but the entry is outdated anyway
+    // and will be dropped by loading the entries
+    const auto canonicalPath = QFileInfo(pathToAppImage).canonicalFilePath().toStdString();
+
+    return appimagelauncher::writeIntegrationIndex(indexPath, loadCurrentIntegrationIndexEntries(indexPath, canonicalPath));
+}
+
+QSet<QString> getIndexedAppImagePaths() {
+    QSet<QString> paths;
+
+    {
+        QMutexLocker lock(&integrationIndexMutex);
+
+        for (const auto& entry : appimagelauncher::IntegrationIndex(appimagelauncher::defaultIntegrationIndexPath()).entries()) {
+            paths.insert(QString::fromStdString(entry.appImagePath));
+        }
+    }
+
+    DesktopResourceIndex resourceIndex;
+    resourceIndex.load();
+
+    for (const auto& entry : resourceIndex.entries()) {
+        paths.insert(entry.appImagePath);
+    }
+
+    return paths;
+}
+
 bool isInDirectory(const QString& pathToAppImage, const QDir& directory) {
     return directory == QFileInfo(pathToAppImage).absoluteDir();
 }
 
+// parses a desktop file installed by libappimage to find the path of the AppImage it belongs to
+// returns an empty string if the file cannot be parsed
+static QString appImagePathFromDesktopFile(const QString& desktopFilePath) {
+    std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), [](GKeyFile* p) {
+        g_key_file_free(p);
+    });
+
+    if (!g_key_file_load_from_file(desktopFile.get(), desktopFilePath.toStdString().c_str(), G_KEY_FILE_NONE, nullptr)) {
+        return "";
+    }
+
+    std::shared_ptr<char> execValue(g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, nullptr), [](char* p) {
+        free(p);
+    });
+
+    // if there is no Exec value in the file, the desktop file is apparently broken, therefore we skip the file
+    if (execValue == nullptr) {
+        return "";
+    }
+
+    std::shared_ptr<char> tryExecValue(g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_TRY_EXEC, nullptr), [](char* p) {
+        free(p);
+    });
+
+    // TryExec is optional, although recently the desktop integration functions started to force add such keys
+    // with a path to the desktop file
+    // (before, if it existed, the key was replaced with the AppImage's path)
+    // If it exists, we assume its value is the full path to the AppImage, which can be used to check the existence
+    // of the AppImage
+    // FIXME: the split command for the Exec value might not work if there's a space in the filename
+    // we really need a parser that understands the desktop file escaping
+    if (tryExecValue != nullptr) {
+        return QString(tryExecValue.get());
+    }
+
+    return QString(execValue.get()).split(" ").first();
+}
+
+// checks whether a file exists without caring about any of its attributes
+// statx(...) allows us to tell the file system not to synchronize attributes we're not interested in anyway (e.g., on
+// network file systems)
+static bool fileExists(const QString& path) {
+    const auto pathStr = path.toStdString();
+
+#ifdef STATX_TYPE
+    struct statx stx{};
+
+    const auto rv = statx(AT_FDCWD, pathStr.c_str(), AT_STATX_DONT_SYNC, 0, &stx);
+
+    if (rv == 0 || errno != ENOSYS) {
+        return rv == 0;
+    }
+#endif
+
+    struct stat st{};
+    return stat(pathStr.c_str(), &st) == 0;
+}
+
 bool cleanUpOldDesktopIntegrationResources(bool verbose) {
+    appimagelauncher::TraceSpan span("cleanup");
+
     auto dirPath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/applications";
 
     auto directory = QDir(dirPath);
@@ -1054,72 +956,87 @@ bool cleanUpOldDesktopIntegrationResources(bool verbose) {
 
     directory.setNameFilters(filters);
 
-    for (auto desktopFilePath : directory.entryList()) {
-        desktopFilePath = dirPath + "/" + desktopFilePath;
+    // the index tells us which AppImage every desktop file belongs to, and which resources were installed along with
+    // it, so we don't need to parse all the desktop files and walk the icons directory tree every time
+    DesktopResourceIndex index;
+
+    // without the lock, the cleanup is still performed, but the index is left alone
+    const auto indexLocked = index.lock();
 
-        std::shared_ptr<GKeyFile> desktopFile(g_key_file_new(), [](GKeyFile* p) {
-            g_key_file_free(p);
-        });
+    if (!indexLocked) {
+        std::cerr << "Failed to lock desktop integration resource index" << std::endl;
+    }
+
+    index.load();
+
+    auto& entries = index.entries();
+    bool indexChanged = false;
+
+    QSet<QString> desktopFilePaths;
 
-        if (!g_key_file_load_from_file(desktopFile.get(), desktopFilePath.toStdString().c_str(), G_KEY_FILE_NONE, nullptr)) {
+    for (const auto& fileName : directory.entryList()) {
+        const auto desktopFilePath = dirPath + "/" + fileName;
+        desktopFilePaths.insert(desktopFilePath);
+
+        if (entries.contains(desktopFilePath)) {
             continue;
         }
 
-        std::shared_ptr<char> execValue(g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, nullptr), [](char* p) {
-            free(p);
-        });
+        // desktop files unknown to the index are parsed once, and added to the index
+        const auto appImagePath = appImagePathFromDesktopFile(desktopFilePath);
 
-        // if there is no Exec value in the file, the desktop file is apparently broken, therefore we skip the file
-        if (execValue == nullptr) {
+        if (appImagePath.isEmpty()) {
             continue;
         }
 
-        std::shared_ptr<char> tryExecValue(g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_TRY_EXEC, nullptr), [](char* p) {
-            free(p);
-        });
+        entries.insert(desktopFilePath, {appImagePath, DesktopResourceIndex::findResourcesOwnedBy(desktopFilePath)});
+        indexChanged = true;
+    }
 
-        // TryExec is optional, although recently the desktop integration functions started to force add such keys
-        // with a path to the desktop file
-        // (before, if it existed, the key was replaced with the AppImage's path)
-        // If it exists, we assume its value is the full path to the AppImage, which can be used to check the existence
-        // of the AppImage
-        QString appImagePath;
+    // several desktop files might belong to the same AppImage, so we check every AppImage just once
+    QHash<QString, bool> appImageExists;
 
-        if (tryExecValue != nullptr) {
-            appImagePath = QString(tryExecValue.get());
-        } else {
-            appImagePath = QString(execValue.get()).split(" ").first();
-        }
+    for (auto it = entries.begin(); it != entries.end();) {
+        const auto& desktopFilePath = it.key();
+        const auto& entry = it.value();
 
-        // now, check whether AppImage exists
-        // FIXME: the split command for the Exec value might not work if there's a space in the filename
-        // we really need a parser that understands the desktop file escaping
-        if (!QFile(appImagePath).exists()) {
-            if (verbose)
-                std::cout << "AppImage no longer exists, cleaning up resources: " << appImagePath.toStdString() << std::endl;
+        // desktop files which have been removed by other means (e.g., appimage_unregister_in_system(...)) are dropped
+        if (!desktopFilePaths.contains(desktopFilePath)) {
+            it = entries.erase(it);
+            indexChanged = true;
+            continue;
+        }
 
-            if (verbose)
-                std::cout << "Removing desktop file: " << desktopFilePath.toStdString() << std::endl;
+        if (!appImageExists.contains(entry.appImagePath)) {
+            appImageExists.insert(entry.appImagePath, fileExists(entry.appImagePath));
+        }
 
-            QFile(desktopFilePath).remove();
+        if (appImageExists.value(entry.appImagePath)) {
+            ++it;
+            continue;
+        }
 
-            // TODO: clean up related resources such as icons or MIME definitions
+        if (verbose)
+            std::cout << "AppImage no longer exists, cleaning up resources: " << entry.appImagePath.toStdString() << std::endl;
 
-            auto* iconValue = g_key_file_get_string(desktopFile.get(), G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_ICON, nullptr);
+        if (verbose)
+            std::cout << "Removing desktop file: " << desktopFilePath.toStdString() << std::endl;
 
-            if (iconValue != nullptr) {
-                const auto dataLocation = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-                const auto iconsPath = QString::fromStdString(dataLocation.toStdString() + "/share/icons/");
+        QFile(desktopFilePath).remove();
 
-                for (QDirIterator it(iconsPath, QDirIterator::Subdirectories); it.hasNext();) {
-                    auto path = it.next();
+        for (const auto& resource : entry.resources) {
+            if (verbose)
+                std::cout << "Removing resource: " << resource.toStdString() << std::endl;
 
-                    if (QFileInfo(path).completeBaseName().startsWith(iconValue)) {
-                        QFile::remove(path);
-                    }
-                }
-            }
+            QFile::remove(resource);
         }
+
+        it = entries.erase(it);
+        indexChanged = true;
+    }
+
+    if (indexChanged && indexLocked && !index.save()) {
+        std::cerr << "Failed to save desktop integration resource index" << std::endl;
     }
 
     return true;
@@ -1151,6 +1068,10 @@ bool desktopFileHasBeenUpdatedSinceLastUpdate(const QString& pathToAppImage) {
 }
 
 bool isAppImage(const QString& path) {
+    // libappimage is only asked if the magic bytes look fine
+    if (sniffAppImageType(path) < 0)
+        return false;
+
     const auto type = appimage_get_type(path.toUtf8(), false);
     return type > 0 && type <= 2;
 }
@@ -1287,6 +1208,9 @@ QString pathToPrivateDataDirectory() {
 }
 
 bool unregisterAppImage(const QString& pathToAppImage) {
+    // must be done first, the interpreter must not skip AppImageLauncher for an AppImage that is not integrated
+    removeFromIntegrationIndex(pathToAppImage);
+
     auto rv = appimage_unregister_in_system(pathToAppImage.toStdString().c_str(), false);
 
     if (rv != 0)
@@ -3,15 +3,18 @@
 #pragma once
 
 // system headers
+#include <chrono>
 #include <string>
 #include <memory>
 
 // library headers
 #include <QDir>
+#include <QSet>
 #include <QString>
 #include <QSettings>
 
 // local headers
+#include "config.h"
 #include "types.h"
 
 enum IntegrationState {
@@ -58,6 +61,12 @@ bool updateDesktopFileAndIcons(const QString& pathToAppImage);
 //   - icons of freshly integrated AppImages are displayed in the launcher
 bool updateDesktopDatabaseAndIconCaches();
 
+// asks the user whether an AppImage with the same filename in the integration destination may be overwritten
+bool askToOverwriteIntegratedAppImage();
+
+// asks the user whether an AppImage which cannot be moved into the integration destination shall be copied instead
+bool askToCopyAppImageInstead();
+
 // integrates an AppImage using a standard workflow used across all AppImageLauncher applications
 IntegrationState integrateAppImage(const QString& pathToAppImage, const QString& pathToIntegratedAppImage);
 
@@ -71,7 +80,11 @@ void createConfigFile(int askToMove, const QString& destination, int enableDaemo
 // replaces ~ character in paths with real home directory, if necessary and possible
 QString expandTilde(QString path);
 
+// calculate path to config file
+QString getConfigFilePath();
+
 // load config file and return it
+// to just read config values, currentConfig() should be used instead, which doesn't parse the file on every call
 QSettings* getConfig(QObject* parent = nullptr);
 
 // return directory into which the integrated AppImages will be moved
@@ -81,9 +94,18 @@ QDir integratedAppImagesDestination();
 // to move to the main location, if they're in one of these, it's all good)
 QSet<QString> additionalAppImagesLocations(bool includeValidMountPoints = false);
 
+// checks whether the daemon shall launch integrated AppImages on behalf of the binfmt_misc interpreter
+bool shallEnableLaunchZygote(const ConfigSnapshot& config);
+
+// path of the file the daemon shall write its metrics to periodically, empty if disabled
+QString daemonMetricsFilePath(const ConfigSnapshot& config);
+
+// interval in which the daemon shall write its metrics file
+std::chrono::milliseconds daemonMetricsWriteInterval(const ConfigSnapshot& config);
+
 // calculate list of directories the daemon has to watch
 // AppImages inside there should furthermore not be moved out of there and into the main integration directory
-QDirSet daemonDirectoriesToWatch(const QSettings* config);
+QDirSet daemonDirectoriesToWatch(const ConfigSnapshot& config);
 
 // build path to standard location for integrated AppImages
 QString buildPathToIntegratedAppImage(const QString& pathToAppImage);
@@ -96,6 +118,18 @@ QString getAppImageDigestMd5(const QString& path);
 // checks whether AppImage has been integrated already
 bool hasAlreadyBeenIntegrated(const QString& pathToAppImage);
 
+// records an integrated AppImage in the integration index, which allows the binfmt interpreter to launch it directly
+// without having to start AppImageLauncher
+// must only be called for AppImages which are located in a directory in which AppImageLauncher won't ask any questions
+bool addToIntegrationIndex(const QString& pathToAppImage);
+
+// removes an AppImage from the integration index, making sure AppImageLauncher will be run the next time it is launched
+bool removeFromIntegrationIndex(const QString& pathToAppImage);
+
+// returns the paths of all AppImages listed in the integration index or the desktop integration resource index
+// AppImages which are in neither of them don't have any desktop integration resources left which need to be removed
+QSet<QString> getIndexedAppImagePaths();
+
 // checks whether file is in a given directory
 bool isInDirectory(const QString& pathToAppImage, const QDir& directory);
 
@@ -0,0 +1,349 @@
+#pragma once
+
+/*
+ * Low overhead timeline tracing in Chrome's trace event format, which can be loaded into chrome://tracing or Perfetto.
+ *
+ * Launching an AppImage involves several processes (binfmt interpreter, AppImageLauncher, bypass launcher, the patched
+ * runtime with our preload library), therefore all of them append their events to one shared file. This makes it
+ * possible to see where the time goes across the entire launch.
+ *
+ * Tracing is enabled by setting $APPIMAGELAUNCHER_TRACE, which is inherited by all the processes involved. Its value
+ * may be an absolute path to the trace file. Any other value selects a per-session file in $XDG_RUNTIME_DIR. There's no
+ * fallback to /tmp, where other users could plant the predictable file name. Trace files which are symlinks or belong to
+ * another user are never written to.
+ *
+ * This header is used by the C preload library, the statically linked interpreter and the Qt based components, so it
+ * must remain valid C, and must not depend on anything but libc. It must not allocate memory either, as the preload
+ * library calls it from within hooks. For the same reason, files are opened with raw system calls, bypassing the
+ * preload library's open(...) hooks.
+ *
+ * Every event is written with a single write(...) call to a file opened with O_APPEND, so events from different
+ * processes don't get mixed up. The file starts with [ and every event is terminated by a comma; the closing ] is
+ * optional in the trace event format, which allows processes to keep appending events.
+ *
+ * The state is kept per translation unit. When tracing is disabled, looking up the environment variable once per
+ * translation unit is all the overhead there is.
+ */
+
+// system headers
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define TRACING_ENV_VAR "APPIMAGELAUNCHER_TRACE"
+
+// longer events are truncated
+#define TRACING_EVENT_BUFFER_SIZE 1024
+
+// the component is recorded as the category of the events
+#ifndef TRACING_CATEGORY
+#ifdef COMPONENT_NAME
+#define TRACING_CATEGORY COMPONENT_NAME
+#else
+#define TRACING_CATEGORY "appimagelauncher"
+#endif
+#endif
+
+#define TRACING_FD_UNINITIALIZED (-2)
+
+inline static int tracing_open_(const char* const path, const int flags, const int mode) {
+    return (int) syscall(SYS_openat, AT_FDCWD, path, flags | O_CLOEXEC, mode);
+}
+
+/**
+ * Calculate the path of the trace file.
+ * @param buffer buffer to write path to
+ * @param buffer_size size of buffer
+ * @return 0 on success, -1 if tracing is disabled or the path doesn't fit into the buffer
+ */
+inline static int tracing_file_path(char* const buffer, const size_t buffer_size) {
+    const char* const value = getenv(TRACING_ENV_VAR);
+
+    if (value == NULL || value[0] == '\0') {
+        return -1;
+    }
+
+    int length;
+
+    if (value[0] == '/') {
+        length = snprintf(buffer, buffer_size, "%s", value);
+    } else {
+        // the session ID is shared by the processes launched from the same terminal or desktop session
+        const char* const runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+        // the runtime directory is private to the user, a shared directory would allow others to plant the file
+        if (runtime_dir == NULL || runtime_dir[0] != '/') {
+            return -1;
+        }
+
+        length = snprintf(buffer, buffer_size, "%s/appimagelauncher-trace-%ld.json", runtime_dir, (long) getsid(0));
+    }
+
+    if (length < 0 || (size_t) length >= buffer_size) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// opens an existing trace file for appending
+// symlinks, special files and files owned by other users are rejected, so tracing can't be abused to write to files
+// planted by someone else
+// returns -1 on errors, with errno set to ENOENT if the file doesn't exist
+inline static int tracing_open_existing_(const char* const path) {
+    const int fd = tracing_open_(path, O_WRONLY | O_APPEND | O_NOFOLLOW | O_NONBLOCK, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+
+    return fd;
+}
+
+// opens the trace file for appending, creating it if necessary
+// returns -1 on errors
+inline static int tracing_open_file(void) {
+    char path[PATH_MAX];
+
+    if (tracing_file_path(path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    const int fd = tracing_open_existing_(path);
+
+    if (fd >= 0 || errno != ENOENT) {
+        return fd;
+    }
+
+    // the opening bracket is written to a temporary file which is then linked into place, so no other process can
+    // append an event before it
+    char temp_path[PATH_MAX + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", path, (long) getpid());
+
+    const int temp_fd = tracing_open_(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+
+    if (temp_fd < 0) {
+        return -1;
+    }
+
+    static const char header[] = "[\n";
+    const int header_written = write(temp_fd, header, sizeof(header) - 1) == (ssize_t) (sizeof(header) - 1);
+    close(temp_fd);
+
+    // if another process has been faster, its file is used
+    // link(...) doesn't replace existing files or follow symlinks at the destination
+    if (header_written) {
+        link(temp_path, path);
+    }
+
+    unlink(temp_path);
+
+    return tracing_open_existing_(path);
+}
+
+// returns the trace file's descriptor, or -1 if tracing is disabled
+inline static int tracing_fd(void) {
+    static int fd = TRACING_FD_UNINITIALIZED;
+
+    const int current_fd = __atomic_load_n(&fd, __ATOMIC_ACQUIRE);
+
+    if (current_fd != TRACING_FD_UNINITIALIZED) {
+        return current_fd;
+    }
+
+    // the Qt based components may trace from more than one thread, only one of them gets to keep its descriptor
+    const int new_fd = tracing_open_file();
+    int expected = TRACING_FD_UNINITIALIZED;
+
+    if (!__atomic_compare_exchange_n(&fd, &expected, new_fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (new_fd >= 0) {
+            close(new_fd);
+        }
+
+        return expected;
+    }
+
+    return new_fd;
+}
+
+inline static int tracing_enabled(void) {
+    return tracing_fd() >= 0;
+}
+
+// the monotonic clock is shared by all processes, so the events can be put on one timeline
+inline static uint64_t tracing_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// appends a string to the buffer, escaping it for use in a JSON string
+// returns the new length, which is capped so that there's always some space left for the closing characters
+inline static size_t tracing_append_escaped(char* const buffer, const size_t buffer_size, size_t length,
+                                            const char* string) {
+    // space for the escape sequence and the end of the event
+    const size_t limit = buffer_size - 16;
+
+    for (; *string != '\0' && length < limit; ++string) {
+        const unsigned char c = (unsigned char) *string;
+
+        if (c == '"' || c == '\\') {
+            buffer[length++] = '\\';
+            buffer[length++] = (char) c;
+        } else if (c < 0x20) {
+            length += (size_t) snprintf(buffer + length, buffer_size - length, "\\u%04x", c);
+        } else {
+            buffer[length++] = (char) c;
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Write a single event.
+ * @param phase event type, e.g., 'X' for complete events or 'i' for instant events
+ * @param name name of the event, must not contain characters which need to be escaped
+ * @param start_ns start of the event (see tracing_now_ns())
+ * @param duration_ns duration of complete events, ignored for other events
+ * @param detail optional string shown along with the event (e.g., a path), may be NULL
+ */
+inline static void tracing_write_event(const char phase, const char* const name, const uint64_t start_ns,
+                                       const uint64_t duration_ns, const char* const detail) {
+    const int fd = tracing_fd();
+
+    if (fd < 0) {
+        return;
+    }
+
+    char buffer[TRACING_EVENT_BUFFER_SIZE];
+
+    // timestamps are specified in microseconds
+    int length = snprintf(
+        buffer, sizeof(buffer),
+        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%ld,\"tid\":%ld",
+        name, TRACING_CATEGORY, phase,
+        (unsigned long long) (start_ns / 1000), (unsigned) (start_ns % 1000),
+        (long) getpid(), (long) syscall(SYS_gettid)
+    );
+
+    if (length < 0 || (size_t) length >= sizeof(buffer) / 2) {
+        return;
+    }
+
+    if (phase == 'X') {
+        length += snprintf(
+            buffer + length, sizeof(buffer) - length, ",\"dur\":%llu.%03u",
+            (unsigned long long) (duration_ns / 1000), (unsigned) (duration_ns % 1000)
+        );
+    } else if (phase == 'i') {
+        // instant events are shown for their thread only
+        length += snprintf(buffer + length, sizeof(buffer) - length, ",\"s\":\"t\"");
+    }
+
+    size_t total_length = (size_t) length;
+
+    if (detail != NULL) {
+        static const char args_prefix[] = ",\"args\":{\"detail\":\"";
+        memcpy(buffer + total_length, args_prefix, sizeof(args_prefix) - 1);
+        total_length += sizeof(args_prefix) - 1;
+
+        total_length = tracing_append_escaped(buffer, sizeof(buffer), total_length, detail);
+
+        buffer[total_length++] = '"';
+        buffer[total_length++] = '}';
+    }
+
+    static const char suffix[] = "},\n";
+    memcpy(buffer + total_length, suffix, sizeof(suffix) - 1);
+    total_length += sizeof(suffix) - 1;
+
+    // tracing is best effort, errors are ignored
+    const ssize_t rv = write(fd, buffer, total_length);
+    (void) rv;
+}
+
+struct tracing_span {
+    const char* name;
+    uint64_t start_ns;
+};
+
+// starts a span, which is written to the trace file once it is ended
+inline static struct tracing_span tracing_begin(const char* const name) {
+    struct tracing_span span;
+    span.name = name;
+    span.start_ns = tracing_enabled() ? tracing_now_ns() : 0;
+    return span;
+}
+
+inline static void tracing_end_with_detail(const struct tracing_span* const span, const char* const detail) {
+    if (!tracing_enabled()) {
+        return;
+    }
+
+    tracing_write_event('X', span->name, span->start_ns, tracing_now_ns() - span->start_ns, detail);
+}
+
+inline static void tracing_end(const struct tracing_span* const span) {
+    tracing_end_with_detail(span, NULL);
+}
+
+// marks a point in time, e.g., right before replacing the current process with another one
+inline static void tracing_instant(const char* const name, const char* const detail) {
+    if (!tracing_enabled()) {
+        return;
+    }
+
+    tracing_write_event('i', name, tracing_now_ns(), 0, detail);
+}
+
+#ifdef __cplusplus
+namespace appimagelauncher {
+
+    /**
+     * Traces the time until it goes out of scope.
+     * Spans which end with the process being replaced (exec*(...)) must be ended explicitly.
+     */
+    class TraceSpan {
+    public:
+        explicit TraceSpan(const char* const name) : _span(tracing_begin(name)) {}
+
+        ~TraceSpan() {
+            end();
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+        void end(const char* const detail = nullptr) {
+            if (_ended) {
+                return;
+            }
+
+            _ended = true;
+            tracing_end_with_detail(&_span, detail);
+        }
+
+    private:
+        tracing_span _span;
+        bool _ended = false;
+    };
+
+}
+#endif
@@ -11,6 +11,7 @@
 // local includes
 #include "trashbin.h"
 #include "shared.h"
+#include "appimagesniffer.h"
 
 class TrashBin::PrivateData {
     public:
@@ -66,7 +67,7 @@ bool TrashBin::cleanUp() {
         if (!QFileInfo(currentPath).isFile())
             continue;
 
-        if (appimage_get_type(currentPath.toStdString().c_str(), false) <= 0)
+        if (sniffAppImageType(currentPath) < 0 || appimage_get_type(currentPath.toStdString().c_str(), false) <= 0)
             continue;
 
         if (!d->canBeCleanedUp(currentPath)) {
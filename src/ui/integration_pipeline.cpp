@@ -0,0 +1,298 @@
+// system includes
+#include <atomic>
+#include <csignal>
+#include <functional>
+#include <utility>
+extern "C" {
+#include <stdlib.h>
+}
+
+// library includes
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QProcess>
+#include <QProgressDialog>
+#include <QTimer>
+
+// local headers
+#include "integration_pipeline.h"
+#include "daemonclient.h"
+#include "filecopy.h"
+#include "integrationengine.h"
+#include "shared.h"
+
+namespace {
+    // interval in which the progress of background work is shown
+    constexpr int PROGRESS_UPDATE_INTERVAL_MSEC = 100;
+
+    class BackgroundThread : public QThread {
+    public:
+        explicit BackgroundThread(std::function<void()> function) : _function(std::move(function)) {}
+
+    protected:
+        void run() override {
+            _function();
+        }
+
+    private:
+        std::function<void()> _function;
+    };
+
+    // runs the event loop until the thread has finished, so the UI stays responsive in the meantime
+    void waitForThread(QThread* thread) {
+        QEventLoop eventLoop;
+        QObject::connect(thread, &QThread::finished, &eventLoop, &QEventLoop::quit);
+
+        // the thread might have finished before we connected to the signal
+        if (!thread->isFinished()) {
+            eventLoop.exec();
+        }
+
+        thread->wait();
+    }
+
+    void runInBackground(std::function<void()> function) {
+        BackgroundThread thread(std::move(function));
+        thread.start();
+        waitForThread(&thread);
+    }
+}
+
+IntegrationPipeline::IntegrationPipeline(QString pathToAppImage, QStringList appImageArgs)
+    : _pathToAppImage(std::move(pathToAppImage)), _appImageArgs(std::move(appImageArgs)) {}
+
+IntegrationPipeline::~IntegrationPipeline() {
+    if (_prepareThread != nullptr) {
+        _prepareThread->wait();
+    }
+}
+
+void IntegrationPipeline::prepare() {
+    if (_prepareThread != nullptr) {
+        return;
+    }
+
+    // for type 2 AppImages without an embedded digest, this means reading the entire file
+    _prepareThread.reset(new BackgroundThread([this]() {
+        _pathToIntegratedAppImage = buildPathToIntegratedAppImage(_pathToAppImage);
+    }));
+
+    _prepareThread->start();
+}
+
+QString IntegrationPipeline::pathToIntegratedAppImage() {
+    prepare();
+    waitForThread(_prepareThread.get());
+
+    return _pathToIntegratedAppImage;
+}
+
+bool IntegrationPipeline::launch(const QString& path) {
+    if (!makeExecutable(path)) {
+        displayError(QObject::tr("Could not make AppImage executable: %1").arg(path));
+        return false;
+    }
+
+    // suppress desktop integration script etc.
+    setenv("DESKTOPINTEGRATION", "AppImageLauncher", true);
+
+    // like runAppImage(...), we use the bypass launcher, but don't replace our own process, as we still have work to
+    // do
+    const auto pathToBinfmtBypassLauncher = privateLibDirPath("binfmt-bypass") + "/binfmt-bypass";
+
+    _appImageProcess.reset(new QProcess);
+
+    // the AppImage uses our terminal, as if it had been run directly
+    _appImageProcess->setProcessChannelMode(QProcess::ForwardedChannels);
+    _appImageProcess->setInputChannelMode(QProcess::ForwardedInputChannel);
+
+    _appImageProcess->start(pathToBinfmtBypassLauncher, QStringList{path} + _appImageArgs);
+
+    if (!_appImageProcess->waitForStarted(-1)) {
+        _appImageProcess.reset();
+        displayError(QObject::tr("Failed to run AppImage: %1").arg(path));
+        return false;
+    }
+
+    // like system(...) does, we leave keyboard generated signals to the AppImage, which receives them as a member of
+    // our process group anyway, so the integration is completed when the user interrupts the AppImage
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    return true;
+}
+
+int IntegrationPipeline::waitForAppImage(const int exitCodeIfNotLaunched) {
+    if (_appImageProcess == nullptr) {
+        return exitCodeIfNotLaunched;
+    }
+
+    _appImageProcess->waitForFinished(-1);
+
+    // QProcess doesn't tell which signal the launcher has been killed with
+    if (_appImageProcess->exitStatus() != QProcess::NormalExit) {
+        return 1;
+    }
+
+    return _appImageProcess->exitCode();
+}
+
+int IntegrationPipeline::integrateAndRun() {
+    const auto appImageName = QFileInfo(_pathToAppImage).fileName();
+
+    QProgressDialog progressDialog;
+    progressDialog.setWindowTitle(QObject::tr("AppImageLauncher"));
+    progressDialog.setCancelButton(nullptr);
+    // busy indicator, the duration of most steps is unknown
+    progressDialog.setRange(0, 0);
+    progressDialog.setMinimumDuration(0);
+    // the dialog is reused for all steps, so it must not close itself once the copy is complete
+    progressDialog.setAutoReset(false);
+    progressDialog.setAutoClose(false);
+
+    progressDialog.setLabelText(QObject::tr("Preparing integration of %1...").arg(appImageName));
+
+    // usually, the digest has been calculated while the user was looking at the integration dialog already
+    if (!_prepareThread || !_prepareThread->isFinished()) {
+        progressDialog.show();
+    }
+
+    const auto pathToIntegratedAppImage = this->pathToIntegratedAppImage();
+
+    progressDialog.hide();
+
+    // create target directory
+    QDir().mkdir(QFileInfo(pathToIntegratedAppImage).dir().absolutePath());
+
+    bool needToCopy = false;
+
+    // check whether AppImage is in integration directory already
+    if (QFileInfo(_pathToAppImage).absoluteFilePath() != QFileInfo(pathToIntegratedAppImage).absoluteFilePath()) {
+        // need to check whether file exists
+        // if it does, the existing AppImage needs to be removed before rename can be called
+        if (QFile(pathToIntegratedAppImage).exists()) {
+            if (!askToOverwriteIntegratedAppImage()) {
+                return launch(_pathToAppImage) ? waitForAppImage(1) : 1;
+            }
+
+            QFile(pathToIntegratedAppImage).remove();
+        }
+
+        if (!QFile(_pathToAppImage).rename(pathToIntegratedAppImage)) {
+            if (!askToCopyAppImageInstead()) {
+                return 1;
+            }
+
+            // the original file is kept, so we can run the AppImage from there while it's being copied
+            needToCopy = true;
+            launch(_pathToAppImage);
+        }
+    }
+
+    if (!needToCopy) {
+        launch(pathToIntegratedAppImage);
+    }
+
+    progressDialog.show();
+
+    if (needToCopy) {
+        std::atomic<int> percentage{0};
+        std::atomic<bool> canceled{false};
+
+        progressDialog.setLabelText(QObject::tr("Copying %1 to target location...").arg(appImageName));
+        progressDialog.setRange(0, 100);
+        progressDialog.setCancelButtonText(QObject::tr("Cancel"));
+
+        QObject::connect(&progressDialog, &QProgressDialog::canceled, [&canceled]() {
+            canceled = true;
+        });
+
+        // the dialog lives in this thread, so the copy thread can't update it directly
+        QTimer progressTimer;
+        progressTimer.setInterval(PROGRESS_UPDATE_INTERVAL_MSEC);
+        QObject::connect(&progressTimer, &QTimer::timeout, [&progressDialog, &percentage]() {
+            progressDialog.setValue(percentage);
+        });
+        progressTimer.start();
+
+        appimagelauncher::CopyResult copyResult;
+
+        runInBackground([this, &pathToIntegratedAppImage, &copyResult, &percentage, &canceled]() {
+            copyResult = appimagelauncher::copyFile(
+                _pathToAppImage, pathToIntegratedAppImage,
+                [&percentage, &canceled](qint64 bytesCopied, qint64 bytesTotal) {
+                    percentage = bytesTotal > 0 ? static_cast<int>(bytesCopied * 100 / bytesTotal) : 100;
+                    return !canceled;
+                }
+            );
+        });
+
+        progressTimer.stop();
+
+        // the AppImage is running from its original location already, so we can just leave things as they are
+        if (copyResult.canceled) {
+            progressDialog.hide();
+            return waitForAppImage(1);
+        }
+
+        if (!copyResult.success) {
+            progressDialog.hide();
+            displayError(QObject::tr("Failed to copy AppImage to target location:\n\n%1").arg(copyResult.errorMessage()));
+            return waitForAppImage(1);
+        }
+
+        progressDialog.setCancelButton(nullptr);
+        progressDialog.setRange(0, 0);
+    }
+
+    progressDialog.setLabelText(QObject::tr("Integrating %1 into the system...").arg(appImageName));
+
+    // the context has to be created in this thread, as it reads the application's state
+    const auto context = appimagelauncher::IntegrationContext::fromApplication();
+    appimagelauncher::IntegrationResult integrationResult;
+
+    runInBackground([&pathToIntegratedAppImage, &context, &integrationResult]() {
+        // the daemon has all the state loaded already, and updates the caches and the integration index as well
+        if (const auto failures = appimagelauncher::DaemonClient::integrate({pathToIntegratedAppImage})) {
+            if (failures->contains(pathToIntegratedAppImage)) {
+                integrationResult.error = appimagelauncher::IntegrationError::RegistrationFailed;
+                integrationResult.errorMessage = failures->value(pathToIntegratedAppImage).toString();
+            }
+
+            return;
+        }
+
+        appimagelauncher::IntegrationEngine engine;
+        integrationResult = engine.installDesktopFileAndIcons(pathToIntegratedAppImage, context);
+
+        if (!integrationResult.success()) {
+            return;
+        }
+
+        // make sure the icons in the launcher are refreshed
+        // the exit codes are not evaluated, the function always succeeds
+        updateDesktopDatabaseAndIconCaches();
+
+        // the integrated AppImage resides in the integration destination, therefore the binfmt interpreter may
+        // launch it directly in the future
+        addToIntegrationIndex(pathToIntegratedAppImage);
+    });
+
+    progressDialog.hide();
+
+    for (const auto& warning : context.warnings + integrationResult.warnings) {
+        displayWarning(warning);
+    }
+
+    if (!integrationResult.success()) {
+        displayError(integrationResult.errorMessage);
+        return waitForAppImage(1);
+    }
+
+    appimagelauncher::IntegrationEngine::notifyIconsChanged();
+
+    return waitForAppImage(1);
+}
@@ -0,0 +1,64 @@
+#ifndef APPIMAGELAUNCHER_INTEGRATION_PIPELINE_H
+#define APPIMAGELAUNCHER_INTEGRATION_PIPELINE_H
+
+// system includes
+#include <memory>
+
+// library includes
+#include <QProcess>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+/*
+ * Integrates an AppImage and runs it, without making the user wait for the integration to finish.
+ *
+ * The slow steps (calculating the AppImage's digest, copying it to another file system, installing the desktop file
+ * and refreshing the desktop database and icon caches) run in background threads, while the UI stays responsive and
+ * shows their progress. The AppImage is launched as early as possible: right after it has been moved into the
+ * integration destination, or, if it has to be copied there, from its current location before the copy starts.
+ *
+ * The AppImage runs as a child process which shares our terminal. Once the integration is complete, we wait for it to
+ * exit, so callers (e.g., shells) see its exit code as if they had run it directly.
+ */
+class IntegrationPipeline {
+public:
+    // appImageArgs are the arguments passed to the AppImage, not including the path to the AppImage
+    IntegrationPipeline(QString pathToAppImage, QStringList appImageArgs);
+
+    // waits for background work to finish
+    ~IntegrationPipeline();
+
+    IntegrationPipeline(const IntegrationPipeline&) = delete;
+    IntegrationPipeline& operator=(const IntegrationPipeline&) = delete;
+
+public:
+    // starts calculating the path within the integration destination in the background
+    // should be called as early as possible (e.g., before asking the user whether to integrate the AppImage at all)
+    void prepare();
+
+    // runs the pipeline, and returns the AppImage's exit code
+    int integrateAndRun();
+
+private:
+    // path the AppImage will be moved to, waits for prepare() to finish if necessary
+    QString pathToIntegratedAppImage();
+
+    // launches the AppImage as a child process
+    bool launch(const QString& path);
+
+    // waits for the AppImage to exit, and returns its exit code
+    // returns exitCodeIfNotLaunched if the AppImage hasn't been launched
+    int waitForAppImage(int exitCodeIfNotLaunched);
+
+private:
+    const QString _pathToAppImage;
+    const QStringList _appImageArgs;
+
+    QString _pathToIntegratedAppImage;
+    std::unique_ptr<QThread> _prepareThread;
+
+    std::unique_ptr<QProcess> _appImageProcess;
+};
+
+#endif //APPIMAGELAUNCHER_INTEGRATION_PIPELINE_H
@@ -30,10 +30,13 @@ extern "C" {
 
 // local headers
 #include "shared.h"
+#include "extractcache.h"
 #include "trashbin.h"
 #include "translationmanager.h"
 #include "first-run.h"
 #include "integration_dialog.h"
+#include "integration_pipeline.h"
+#include "tracing.h"
 
 // Runs an AppImage. Returns suitable exit code for main application.
 int runAppImage(const QString& pathToAppImage, unsigned long argc, char** argv) {
@@ -58,6 +61,33 @@ int runAppImage(const QString& pathToAppImage, unsigned long argc, char** argv)
     // suppress desktop integration script etc.
     setenv("DESKTOPINTEGRATION", "AppImageLauncher", true);
 
+    // if the user opted in, type 2 AppImages are run from an extracted copy in the cache, which avoids FUSE
+    // arguments reserved for the runtime (e.g., --appimage-extract) need the actual runtime, though
+    if (type == 2 && getenv("APPIMAGELAUNCHER_DISABLE") == nullptr) {
+        bool hasRuntimeArgs = false;
+
+        for (unsigned long i = 1; i < argc; i++) {
+            if (QString(argv[i]).startsWith("--appimage-")) {
+                hasRuntimeArgs = true;
+                break;
+            }
+        }
+
+        const auto config = currentConfig();
+
+        if (!hasRuntimeArgs && extractAndRunEnabled(*config)) {
+            int inUseLockFd;
+            const auto appDirPath = getOrCreateExtractedAppDir(fullPathToAppImage, extractCacheBudget(*config),
+                                                               inUseLockFd);
+
+            if (!appDirPath.isEmpty()) {
+                return runExtractedAppImage(pathToAppImage, appDirPath, inUseLockFd, argc, argv);
+            }
+
+            std::cerr << "Failed to extract AppImage, running it normally" << std::endl;
+        }
+    }
+
     auto makeVectorBuffer = [](const std::string& str) {
         std::vector<char> strBuffer(str.size() + 1, '\0');
         strncpy(strBuffer.data(), str.c_str(), str.size());
@@ -88,6 +118,7 @@ int runAppImage(const QString& pathToAppImage, unsigned long argc, char** argv)
     // args need to be null terminated
     args.push_back(nullptr);
 
+    tracing_instant("exec binfmt-bypass", pathToAppImage.toStdString().c_str());
     execv(pathToBinfmtBypassLauncher.c_str(), args.data());
 
     const auto& error = errno;
@@ -139,6 +170,9 @@ QCoreApplication* getApp(char** argv) {
 }
 
 int main(int argc, char** argv) {
+    // the time spent before main() (e.g., by the dynamic loader) shows up as the gap between this and the previous event
+    tracing_instant("AppImageLauncher main", nullptr);
+
     // create a suitable application object (either graphical (QApplication) or headless (QCoreApplication))
     // Use a fake argc value to avoid QApplication from modifying the arguments
     QCoreApplication* app = getApp(argv);
@@ -255,11 +289,10 @@ int main(int argc, char** argv) {
     }
 
     // enable and start/disable and stop appimagelauncherd service
-    auto config = getConfig();
+    auto config = currentConfig();
 
     // assumes defaults if config doesn't exist or lacks the related key(s)
-    if (config == nullptr || !config->contains("AppImageLauncher/enable_daemon") ||
-        config->value("AppImageLauncher/enable_daemon").toBool()) {
+    if (!config->contains("AppImageLauncher/enable_daemon") || config->value("AppImageLauncher/enable_daemon").toBool()) {
         system("systemctl --user enable appimagelauncherd.service");
         system("systemctl --user start  appimagelauncherd.service");
     } else {
@@ -274,12 +307,14 @@ int main(int argc, char** argv) {
     }
 
     // if config doesn't exist, create a default one
-    if (config == nullptr) {
+    // currentConfig() never returns null, a missing file results in an empty snapshot
+    if (!config->exists()) {
         showFirstRunDialog();
-        config = getConfig();
+        config = currentConfig();
     }
 
-    if (config == nullptr) {
+    // the defaults are assumed in this case
+    if (!config->exists()) {
         displayError("Could not read config file");
     }
 
@@ -312,49 +347,29 @@ int main(int argc, char** argv) {
     if (pathToAppImage.startsWith("/tmp/.mount_"))
         return runAppImage(pathToAppImage, appImageArgv.size(), appImageArgv.data());
 
-    const auto pathToIntegratedAppImage = buildPathToIntegratedAppImage(pathToAppImage);
-
-    auto integrateAndRunAppImage = [&pathToAppImage, &pathToIntegratedAppImage, &appImageArgv]() {
-        // check whether integration was successful
-        auto rv = integrateAppImage(pathToAppImage, pathToIntegratedAppImage);
+    // the first argument is the path to the AppImage
+    QStringList appImageArgs;
+    for (size_t i = 1; i < appImageArgv.size(); i++) {
+        appImageArgs << appImageArgv[i];
+    }
 
-        // make sure the icons in the launcher are refreshed
-        if (!updateDesktopDatabaseAndIconCaches())
-            return 1;
+    // the AppImage is launched as soon as possible, the rest of the integration happens in the background
+    IntegrationPipeline integrationPipeline(pathToAppImage, appImageArgs);
 
-        if (rv == INTEGRATION_FAILED) {
-            return 1;
-        } else if (rv == INTEGRATION_ABORTED) {
-            return runAppImage(pathToAppImage, appImageArgv.size(), appImageArgv.data());
-        } else {
-            return runAppImage(pathToIntegratedAppImage, appImageArgv.size(), appImageArgv.data());
-        }
+    auto integrateAndRunAppImage = [&integrationPipeline]() {
+        return integrationPipeline.integrateAndRun();
     };
 
     // after checking whether the AppImage can/must be run without integrating it, we now check whether it actually
     // has been integrated already
     if (hasAlreadyBeenIntegrated(pathToAppImage)) {
-        auto updateAndRunAppImage = [&pathToAppImage, &appImageArgv]() {
-            // in case there was an update of AppImageLauncher, we should should also update the desktop database
-            // and icon caches
-            if (!desktopFileHasBeenUpdatedSinceLastUpdate(pathToAppImage)) {
-                if (!updateDesktopFileAndIcons(pathToAppImage))
-                    return 1;
-
-                // make sure the icons in the launcher are refreshed after updating the desktop file
-                if (!updateDesktopDatabaseAndIconCaches())
-                    return 1;
-            }
-            return runAppImage(pathToAppImage, appImageArgv.size(), appImageArgv.data());
-        };
-
         // assume we have to ask
         // prove me wrong!
         bool needToAskAboutMoving = true;
 
         // okay, I'll try to prove you wrong
         {
-            auto directoriesNotToAskAboutMovingFor = daemonDirectoriesToWatch(config);
+            auto directoriesNotToAskAboutMovingFor = daemonDirectoriesToWatch(*config);
 
             // normally the main integration destination should be contained
             // but bugs happen, and we want to be sure not to create a weird situation where you'd be asked about
@@ -379,6 +394,26 @@ int main(int argc, char** argv) {
             }
         }
 
+        auto updateAndRunAppImage = [&pathToAppImage, &appImageArgv, needToAskAboutMoving]() {
+            // in case there was an update of AppImageLauncher, we should should also update the desktop database
+            // and icon caches
+            if (!desktopFileHasBeenUpdatedSinceLastUpdate(pathToAppImage)) {
+                if (!updateDesktopFileAndIcons(pathToAppImage))
+                    return 1;
+
+                // make sure the icons in the launcher are refreshed after updating the desktop file
+                if (!updateDesktopDatabaseAndIconCaches())
+                    return 1;
+            }
+
+            // if we didn't have to ask, the next launch won't have to either, so the binfmt interpreter may launch the
+            // AppImage directly in the future
+            if (!needToAskAboutMoving)
+                addToIntegrationIndex(pathToAppImage);
+
+            return runAppImage(pathToAppImage, appImageArgv.size(), appImageArgv.data());
+        };
+
         if (needToAskAboutMoving) {
             auto* messageBox = new QMessageBox(
                 QMessageBox::Warning,
@@ -400,6 +435,10 @@ int main(int argc, char** argv) {
             messageBox->setDefaultButton(QMessageBox::Yes);
             messageBox->show();
 
+            // calculating the path to the integrated AppImage may require reading the entire file, which can be done
+            // while the user makes up their mind
+            integrationPipeline.prepare();
+
             QApplication::exec();
 
             // if the user selects No, then continue as if the AppImage would not be in this directory
@@ -423,6 +462,9 @@ int main(int argc, char** argv) {
     auto integrationDialog = new IntegrationDialog(pathToAppImage, integratedAppImagesDestinationPath);
     integrationDialog->show();
 
+    // the path to the integrated AppImage is calculated while the user reads the dialog
+    integrationPipeline.prepare();
+
     // As the integration dialog is the only window in our application we can safely use its exec method
     integrationDialog->exec();
 
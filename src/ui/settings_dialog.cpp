@@ -154,13 +154,11 @@ void SettingsDialog::saveSettings() {
     // this is supposed to support the option while hiding it in the settings
     int monitorMountedFilesystems = -1;
     {
-        const auto oldSettings = getConfig();
+        const auto oldSettings = currentConfig();
 
         static constexpr auto oldKey = "appimagelauncherd/monitor_mounted_filesystems";
 
-        // getConfig might return a null pointer if the config file doesn't exist
-        // we have to handle this, obviously
-        if (oldSettings != nullptr && oldSettings->contains(oldKey)) {
+        if (oldSettings->contains(oldKey)) {
             const auto oldValue = oldSettings->value(oldKey).toBool();
             monitorMountedFilesystems = oldValue ? 1 : 0;
         }
@@ -181,8 +179,8 @@ void SettingsDialog::toggleDaemon() {
     if (settingsFile) {
         if (settingsFile->value("AppImageLauncher/enable_daemon", "true").toBool()) {
             system("systemctl --user enable  appimagelauncherd.service");
-            // we want to actually restart the service to apply the new configuration
-            system("systemctl --user restart appimagelauncherd.service");
+            // a running daemon picks up the new configuration by itself, there's no need to restart it
+            system("systemctl --user start   appimagelauncherd.service");
         } else {
             system("systemctl --user disable appimagelauncherd.service");
             system("systemctl --user stop    appimagelauncherd.service");